@@ -1,18 +1,99 @@
+//	Feature test macros: POSIX clocks and anonymous mappings are declared in strict C modes too
+#if !defined(_WIN32)
+	#if !defined(_POSIX_C_SOURCE)
+		#define _POSIX_C_SOURCE 200112L
+	#endif
+	#if !defined(_DEFAULT_SOURCE)
+		#define _DEFAULT_SOURCE
+	#endif
+#endif
+
 //	Standard includes
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <math.h>
+#include <time.h>
 
 //	Includes
 #include "ldevtools.h"
+#include "ldvsnapshot.h"
+#include "ldvtrace.h"
 #include "lstate.h"
 #include "ltable.h"
 #include "lauxlib.h"
 #include "lfunc.h"
+#include "lstring.h"
+#include "ldebug.h"
 
 #ifdef _WIN32
 	#include <windows.h>
+	#include <io.h>
+#else
+	#include <sys/mman.h>
+	#include <unistd.h>
+	#include <sched.h>
+	#include <pthread.h>
+	//		Systems, which do not know _DEFAULT_SOURCE, name anonymous mappings by older name
+	#if !defined(MAP_ANONYMOUS) && defined(MAP_ANON)
+		#define MAP_ANONYMOUS MAP_ANON
+	#endif
+#endif
+
+//		Native backtraces of sampled allocations (systems without backtraces sample no native frames)
+#if defined(_WIN32)
+	#define LDV_BACKTRACE(frames, count) ((int)CaptureStackBackTrace(0, (DWORD)(count), (frames), NULL))
+#elif defined(__GLIBC__) || defined(__APPLE__) || defined(__FreeBSD__)
+	#include <execinfo.h>
+	#define LDV_BACKTRACE(frames, count) backtrace((frames), (count))
+#else
+	#define LDV_BACKTRACE(frames, count) 0
+#endif
+
+#if defined(_MSC_VER)
+	#include <intrin.h>
+	#define LDV_THREAD_LOCAL __declspec(thread)
+	#define LDV_RETURN_ADDRESS() _ReturnAddress()
+	#define LDV_TRY_LOCK(lock) (_InterlockedExchange((lock), 1) == 0)
+	#define LDV_UNLOCK(lock) _InterlockedExchange((lock), 0)
+	#define LDV_LOCKED(lock) (*(lock) != 0)
+	#define LDV_YIELD() SwitchToThread()
+	#define LDV_ATOMIC_ADD(ptr, value) ((size_t)InterlockedExchangeAddSizeT((ptr), (value)) + (value))
+	#define LDV_ATOMIC_LOAD(ptr) (*(volatile size_t*)(ptr))
+	#define LDV_ATOMIC_CAS(ptr, expected, desired) (InterlockedCompareExchangePointer((void* volatile*)(ptr), (void*)(desired), (void*)(expected)) == (void*)(expected))
+#else
+	#define LDV_THREAD_LOCAL __thread
+	#define LDV_RETURN_ADDRESS() __builtin_return_address(0)
+	#define LDV_TRY_LOCK(lock) (__atomic_exchange_n((lock), 1, __ATOMIC_ACQUIRE) == 0)
+	#define LDV_UNLOCK(lock) __atomic_store_n((lock), 0, __ATOMIC_RELEASE)
+	#define LDV_LOCKED(lock) (__atomic_load_n((lock), __ATOMIC_RELAXED) != 0)
+	#define LDV_YIELD() sched_yield()
+	#define LDV_ATOMIC_ADD(ptr, value) __atomic_add_fetch((ptr), (value), __ATOMIC_RELAXED)
+	#define LDV_ATOMIC_LOAD(ptr) __atomic_load_n((ptr), __ATOMIC_RELAXED)
+	#define LDV_ATOMIC_CAS(ptr, expected, desired) __sync_bool_compare_and_swap((ptr), (expected), (desired))
+#endif
+
+//		Thread exit callbacks, which flush caches of exiting threads
+#ifdef _WIN32
+	typedef DWORD ThreadExitKey;
+	#define LDV_EXIT_CALLBACK WINAPI
+	#define LDV_EXIT_KEY_CREATE(key, callback) ((*(key) = FlsAlloc(callback)) != FLS_OUT_OF_INDEXES)
+	#define LDV_EXIT_KEY_SET(key, value) FlsSetValue((key), (value))
+#else
+	typedef pthread_key_t ThreadExitKey;
+	#define LDV_EXIT_CALLBACK
+	#define LDV_EXIT_KEY_CREATE(key, callback) (pthread_key_create((key), (callback)) == 0)
+	#define LDV_EXIT_KEY_SET(key, value) pthread_setspecific((key), (value))
+#endif
+
+//		Conversion of size_t in ldv output (runtimes of older windows compilers do not know "z" length modifier)
+#ifdef _WIN32
+	#define LDV_SIZE_FORMAT "Iu"
+#else
+	#define LDV_SIZE_FORMAT "zu"
 #endif
 
 //	Types
@@ -23,12 +104,52 @@ typedef unsigned int ldv_block_type;
 #define LDV_UNUSED(x) (void)(x);
 //		Maximal buffer size
 #define MEM_BUFF_SIZE 1000000
+//		Maximal size of heap region in words
+#define MAX_REGION_SIZE 0x7FFFFFFF
 //		Gets raw memory
 #define RAW_MEMORY(x) ((ldv_block_type*)x)
 //		Maximal dumping depth
 #define MAX_DUMP_DEPTH 100000
 //		Size of indent in characters
 #define INDENT_SIZE 2
+//		Minimal size of block in words (head + two free list links)
+#define MIN_BLOCK_WORDS 4
+//		Blocks smaller than this size (in words) are kept in exact size bins
+#define SMALL_BIN_LIMIT 64
+//		Count of exact size bins
+#define SMALL_BIN_COUNT (SMALL_BIN_LIMIT - MIN_BLOCK_WORDS)
+//		Count of power of two ranges of large blocks (sizes [2^k, 2^(k+1)) words)
+#define LARGE_RANGE_COUNT 26
+//		Log2 of count of bins, which split power of two range into equal parts
+#define LARGE_SPLIT_BITS 3
+//		Count of large bins
+#define LARGE_BIN_COUNT (LARGE_RANGE_COUNT << LARGE_SPLIT_BITS)
+//		Total count of free list bins
+#define BIN_COUNT (SMALL_BIN_COUNT + LARGE_BIN_COUNT)
+//		Count of words in bins bitmap
+#define BIN_MAP_SIZE ((BIN_COUNT + 31) / 32)
+//		Index of "no block" in free lists
+#define NO_BLOCK ((ldv_block_type)-1)
+//		Size of slab page in bytes (page header included)
+#define SLAB_PAGE_BYTES 4096
+//		Count of slab size classes
+#define SLAB_CLASS_COUNT 11
+//		Maximal size of object, which is served by slab pages
+#define SLAB_MAX_SIZE 128
+//		Alignment of slab page header and slots in bytes
+#define SLAB_ALIGN 8
+//		Count of words in slots bitmap of slab page (the smallest slot is 16 bytes)
+#define SLAB_MAP_SIZE (SLAB_PAGE_BYTES / 16 / 32)
+//		Magic value of slab page header
+#define SLAB_MAGIC 0x51AB51AB
+//		Maximal size of blocks cached by thread, cache is flushed to heap, when it grows larger
+#define THREAD_CACHE_BYTES 0x10000
+//		Count of blocks, which refill empty list of thread cache at once
+#define THREAD_CACHE_BATCH 32
+//		Count of attempts to take heap lock, before thread yields
+#define LOCK_SPIN_COUNT 64
+//		Magic value of blocks cached by thread (second word of block)
+#define CACHE_MAGIC ((uintptr_t)0xCAC4E10C)
 //		LDV assertions
 #define LDV_ASSERT(x) assert(x);
 //		Checking ldv depth
@@ -73,17 +194,55 @@ typedef enum UserDataLabel
 {
 	Allocated,
 	Free
-};
+} UserDataLabel;
 
-//		Output char buffer
-static char out_buff[1000];
+//		Size of output buffer reserved for one message (longer messages grow buffer)
+#define OUT_BUFF_SIZE 1000
+//		Initial size of output buffer
+#define LOG_BUFF_SIZE 0x10000
+//		Size of buffered output, which is flushed to target at once
+#define LOG_FLUSH_SIZE 0x10000
+//		Initial count of cells of block tags table
+#define TAG_SET_SIZE 1024
+//		Initial count of allocation sites
+#define TAG_SITE_COUNT 64
+//		Count of lua type variants, which are counted by block tags
+#define TAG_TYPE_COUNT 64
+//		Maximal count of lua frames of sampled stack (outer frames are cut)
+#define SAMPLE_MAX_DEPTH 64
+//		Maximal count of native frames of sampled stack (frames of allocator and lua memory manager are skipped)
+#define SAMPLE_NATIVE_DEPTH 4
+//		Count of native frames, which are captured to skip frames of allocator
+#define SAMPLE_CAPTURE_DEPTH 16
+//		Maximal length of frame name of sampled stack
+#define SAMPLE_NAME_SIZE 64
+//		Initial count of cells of sampled stacks table
+#define SAMPLE_SET_SIZE 256
+//		Size of write buffer of heap snapshot
+#define SNAPSHOT_BUFF_SIZE 0x100000
+//		Initial count of blocks in quarantine queue
+#define QUARANTINE_QUEUE_SIZE 256
+//		Size of write buffer of allocation trace
+#define TRACE_BUFF_SIZE 0x100000
+//		Initial count of cells of trace ids table
+#define TRACE_SET_SIZE 1024
 //		Memory buffer
 static ldv_block_type mem_buf[MEM_BUFF_SIZE] = { MEM_BUFF_SIZE };
-//		ALLOC MASK 
+//		ALLOC MASK (same byte in every position, so blocks are filled with memset)
 static const ldv_block_type ALLOC_MASK = 0xA1A1A1A1;
-//		FREE MASK 
+//		FREE MASK (same byte in every position, so blocks are filled with memset)
 static const ldv_block_type FREE_MASK = 0xFEFEFEFE;
-  
+//		REDZONE MASK (same byte in every position, so redzones are filled with memset)
+static const ldv_block_type REDZONE_MASK = 0xFBFBFBFB;
+//		QUARANTINE MASK (same byte in every position, so quarantined blocks are filled with memset)
+static const ldv_block_type QUARANTINE_MASK = 0xFDFDFDFD;
+//		Count of payload words poisoned in header only mode
+#define POISON_HEADER_WORDS 4
+//		Slot sizes of slab size classes
+static const unsigned short slab_sizes[SLAB_CLASS_COUNT] = { 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128 };
+//		Slab size classes of objects (indexed by size of object in 8 byte units, rounded up)
+static const unsigned char slab_classes[SLAB_MAX_SIZE / 8 + 1] = { 0, 0, 0, 1, 2, 3, 4, 5, 6, 7, 7, 8, 8, 9, 9, 10, 10 };
+
 /*
         Helper structure to mark blocks in memory buffer. It is used by memory manager
 */
@@ -95,680 +254,6788 @@ typedef struct BlockHead
     ldv_block_type prev_index;
 } BlockHead;
 
-//	PUBLIC LUA API FUNCTIONS
-/*===========PUBLIC LUA API BEGIN============*/
 /*
-		Prints dumpt of ldv memory heap
-		Params: none
-		Return: none
+		Region of ldv heap. Regions are never moved, so heap grows without moving allocated blocks
 */
-static int dumpHeap(lua_State* L)
+typedef struct HeapRegion
 {
-	LDV_UNUSED(L)
-	ldv_dump_heap();
-	return 0;
-}
+	/*	Memory of region	*/
+	ldv_block_type* mem;
+	/*	Size of region in words	*/
+	ldv_block_type size;
+	/*	Heap, which owns region	*/
+	struct ldv_heap* heap;
+	/*	Flag, whether memory of region is reserved from system	*/
+	int reserved;
+	/*	Position of region in list of heap regions	*/
+	unsigned int rank;
+	/*	Heads of free lists (indices of first free blocks in bins)	*/
+	ldv_block_type bin_heads[BIN_COUNT];
+	/*	Tails of free lists (indices of last free blocks in bins)	*/
+	ldv_block_type bin_tails[BIN_COUNT];
+	/*	Bitmap of non empty bins	*/
+	ldv_block_type bin_map[BIN_MAP_SIZE];
+	/*	Flag, whether bins describe current region layout	*/
+	int bins_ready;
+	/*	Count of blocks in free lists	*/
+	size_t free_blocks;
+	/*	Size of blocks in free lists in words	*/
+	size_t free_words;
+	/*	Size of the largest block in free lists in words (upper bound of sizes, while it is stale)	*/
+	ldv_block_type largest_free;
+	/*	Flag, whether the largest block was taken from free lists, so largest size is rescanned on demand	*/
+	int largest_stale;
+	/*	Bitmap of gem block heads (one bit per word of region)	*/
+	ldv_block_type* live_map;
+	/*	Count of quarantined blocks (gem blocks, which are not marked in bitmap of gem blocks)	*/
+	size_t quarantine_blocks;
+	/*	Next region of heap	*/
+	struct HeapRegion* next;
+} HeapRegion;
 
 /*
-		Checks ldv heap on erros
-		Params: none
-		Return: error code
+		Slab page. Page is kept in gem block of heap region and serves slots of one size class.
+		Slots follow the header, allocated slots are marked in bitmap
 */
-static int checkHeap(lua_State* L)
+typedef struct SlabPage
 {
-	LDV_UNUSED(L)
-	const int err_code = ldv_check_heap(); 
-	lua_pushinteger(L, err_code);
-	return 1;
-}
+	/*	Magic value of slab page (SLAB_MAGIC)	*/
+	ldv_block_type magic;
+	/*	Size class of page	*/
+	unsigned short size_class;
+	/*	Size of slot in bytes	*/
+	unsigned short slot_size;
+	/*	Count of slots in page	*/
+	unsigned short slot_count;
+	/*	Count of free slots in page	*/
+	unsigned short free_count;
+	/*	Payload of heap block, which holds page	*/
+	void* block;
+	/*	Next page with free slots of same size class	*/
+	struct SlabPage* next_partial;
+	/*	Previous page with free slots of same size class	*/
+	struct SlabPage* prev_partial;
+	/*	Bitmap of allocated slots (bits of missing slots are set)	*/
+	ldv_block_type slot_map[SLAB_MAP_SIZE];
+} SlabPage;
 
 /*
-		Dumps object
-		Params: object to dump
-		Return: none
-		NOTE: (alex) in current implementation it is unsafe way to dump object
+		Tag of heap block: lua type and allocation site of block
 */
-static int dumpObject(lua_State* L)
+typedef struct BlockTag
 {
-	ldv_dump_value(MAX_DUMP_DEPTH, L, L->top - 1);
-	return 0;
-}
+	/*	Address of block (0 - empty cell)	*/
+	const void* ptr;
+	/*	Index of allocation site (0 - unknown site)	*/
+	unsigned int site;
+	/*	Lua type variant of object (LUA_TNIL - memory, which is not lua object)	*/
+	unsigned char type;
+} BlockTag;
 
 /*
-		Check objects 
-		Params: none
-		Return: none
+		Live memory of tagged blocks
 */
-static int checkObjects(lua_State* L)
+typedef struct TagCounter
 {
-	ldv_check_ptrs(L);
-	return 0;
-}
-/*===========PUBLIC LUA API END==============*/
+	/*	Size of live blocks in bytes	*/
+	size_t live_bytes;
+	/*	Count of live blocks	*/
+	size_t live_blocks;
+} TagCounter;
 
-//              Public functions available from LUA script
-static const luaL_Reg ldv_tab_funcs[] =
+/*
+		Allocation site: line of lua function, which is running at allocation
+*/
+typedef struct TagSite
 {
-  {"dumpHeap", dumpHeap},
-  {"checkHeap", checkHeap},
-  {"dumpObject", dumpObject},
-  {"checkObjects", checkObjects},
-  {NULL, NULL}
-};
-
+	/*	Source of function (copy of chunk name, 0 - unknown site)	*/
+	char* source;
+	/*	Line of function (-1 - no line information)	*/
+	int line;
+	/*	Hash of source and line	*/
+	size_t hash;
+	/*	Live memory, allocated at site	*/
+	TagCounter counter;
+} TagSite;
 
-//	Internal helpers
 /*
-		Logs message
-		Params: indent value, format message, variadic args
-		Return: none
+		Block tags of heap. Tables are allocated by system allocator, so they never touch ldv heap
 */
-static void ldv_log(const int indent, const char* format, ...)
+typedef struct BlockTags
 {
-	for (int i = 0; i < indent; ++i)
-		out_buff[i] = ' ';
-	va_list args;
-	va_start (args, format);
-	vsprintf(out_buff + indent, format, args);
-	va_end (args);
-
-#ifdef _WIN32
-	OutputDebugStringA(out_buff);
-#endif
-
-	printf(out_buff);
-}
+	/*	Flag, whether new blocks are tagged	*/
+	int enabled;
+	/*	Lua state, which call stack gives allocation sites (NULL - sites are not recorded)	*/
+	lua_State* L;
+	/*	Open addressing table of tags (keyed by block address)	*/
+	BlockTag* cells;
+	/*	Count of cells (power of two)	*/
+	size_t capacity;
+	/*	Count of tags	*/
+	size_t count;
+	/*	Allocation sites (site 0 is unknown site)	*/
+	TagSite* sites;
+	/*	Count of allocation sites	*/
+	unsigned int site_count;
+	/*	Capacity of allocation sites	*/
+	unsigned int site_capacity;
+	/*	Open addressing index of allocation sites (site index + 1, 0 - empty cell)	*/
+	unsigned int* site_cells;
+	/*	Count of cells of index (power of two)	*/
+	size_t site_cell_capacity;
+	/*	Live memory of lua types	*/
+	TagCounter types[TAG_TYPE_COUNT];
+} BlockTags;
 
 /*
-		Checks, whether ptr is valid
-		Params: none
-		Return: valid flag (zero means not valid ptr)
+		Sampled stack. Stack is kept in folded form: frames from the outermost one are separated by ';'
 */
-static int check_ptr(const void* ptr)
+typedef struct SampledStack
 {
-	const int check_res = mem_buf <= ptr && ptr < mem_buf + MEM_BUFF_SIZE;
-	LDV_ASSERT(check_res)
-	return check_res;
-}
+	/*	Folded stack (0 - empty cell)	*/
+	char* frames;
+	/*	Hash of folded stack	*/
+	size_t hash;
+	/*	Count of samples	*/
+	size_t count;
+	/*	Estimation of bytes allocated at stack	*/
+	double bytes;
+} SampledStack;
 
 /*
-		Checks, whether block is lied within memory pool
-		Params: block
-		Return: check result
+		Sampling profiler of allocations. Intervals between samples are geometrically distributed,
+		so each allocated byte is sampled with the same probability. Tables live out of ldv heap
 */
-static int valid_block(ldv_block_type* block)
+typedef struct AllocSampler
 {
-	return mem_buf <= block && block < mem_buf + MEM_BUFF_SIZE;
-}
+	/*	Mean count of bytes between samples (0 - sampling is disabled)	*/
+	size_t mean_bytes;
+	/*	Lua state, which call stack is sampled	*/
+	lua_State* L;
+	/*	Count of bytes till next sample	*/
+	size_t countdown;
+	/*	State of random generator	*/
+	uint64_t random;
+	/*	Open addressing table of sampled stacks (keyed by folded stack)	*/
+	SampledStack* stacks;
+	/*	Count of cells (power of two)	*/
+	size_t capacity;
+	/*	Count of sampled stacks	*/
+	size_t count;
+} AllocSampler;
 
 /*
-		Gets data mask, which defines data layout in block info
-		Params: none
-		Return: block data mask
+		Freed block, which is kept from reuse by quarantine
 */
-static ldv_block_type block_data_mask(void)
+typedef struct QuarantinedBlock
 {
-	return (1 << (sizeof(ldv_block_type) * 8) - 1) - 1;
-}
+	/*	Payload of block	*/
+	void* ptr;
+	/*	Size of freed object	*/
+	size_t size;
+} QuarantinedBlock;
 
 /*
-		Gets block flag mask
-		Params: none
-		Return: block flag mask
+		Queue of freed blocks (ring buffer). Blocks are reused, when newer blocks push them out of queue
 */
-static ldv_block_type block_flag_mask(void)
+typedef struct Quarantine
 {
-	return 1 << (sizeof(ldv_block_type) * 8 - 1);
-}
+	/*	Blocks of queue	*/
+	QuarantinedBlock* blocks;
+	/*	Position of the oldest block	*/
+	size_t first;
+	/*	Count of blocks in queue	*/
+	size_t count;
+	/*	Capacity of queue	*/
+	size_t capacity;
+	/*	Size of quarantined objects	*/
+	size_t bytes;
+	/*	Maximal size of quarantined objects (0 - quarantine is disabled)	*/
+	size_t limit;
+} Quarantine;
 
 /*
-        Sets next/prev head to BlockHead
-        Params: blocks info, head type, index
-        Return: none
+		Id of block in allocation trace
 */
-static void set_head(BlockHead* binfo, HeadType head_type, ldv_block_type head)
+typedef struct TraceCell
 {
-	LDV_ASSERT(check_ptr(binfo))
-	const int data_mask = block_data_mask();
-	const int flag_mask = block_flag_mask();
-	const ldv_block_type cl_head = head & data_mask;
-	if (head_type == NextHead)
-	{
-		binfo->next_index = (valid_block(RAW_MEMORY(binfo) + cl_head) ? flag_mask : 0) | cl_head;
-	}
-	else
-	{
-		binfo->prev_index = (valid_block(RAW_MEMORY(binfo) - cl_head) ? cl_head : 0) | (flag_mask & binfo->prev_index);
-	}
-}
+	/*	Address of block (0 - empty cell)	*/
+	const void* ptr;
+	/*	Id of block	*/
+	uint32_t id;
+} TraceCell;
 
 /*
-		Gets head of head type
-		Params: block head, head type
-		Return: head of head type
+		Recorder of allocation trace (see ldvtrace.h). Records are streamed to file through buffer
 */
-static ldv_block_type get_head_offset(BlockHead* bhead, HeadType head_type)
+typedef struct AllocTrace
 {
-	LDV_ASSERT(check_ptr(bhead))
-	int data_mask = block_data_mask();
-	return head_type == NextHead ? bhead->next_index & data_mask : bhead->prev_index & data_mask;
-}
+	/*	Trace file (NULL - recording is off)	*/
+	FILE* file;
+	/*	Write buffer	*/
+	unsigned char* buf;
+	/*	Size of buffered records	*/
+	size_t size;
+	/*	Flag, whether write failed (trace is cut)	*/
+	int failed;
+	/*	Open addressing table of ids (keyed by block address)	*/
+	TraceCell* cells;
+	/*	Count of cells (power of two)	*/
+	size_t capacity;
+	/*	Count of live ids	*/
+	size_t count;
+	/*	Ids of freed blocks, which are reused	*/
+	uint32_t* free_ids;
+	/*	Count of reusable ids	*/
+	size_t free_count;
+	/*	Capacity of reusable ids	*/
+	size_t free_capacity;
+	/*	Count of ids (maximal id + 1)	*/
+	uint32_t id_count;
+	/*	Time of previous record in nanoseconds	*/
+	uint64_t last_time;
+	/*	Header of trace (counters are written, when recording stops)	*/
+	ldv_trace_header header;
+} AllocTrace;
 
 /*
-		Marks block with specific label
-		Params: block info, label type
-		Return: none
+		LDV heap. Heaps do not share any state, so each lua state is able to use own heap on own thread.
+		Heap in thread safe mode is shared by threads: it is guarded by lock and small blocks are cached by threads
 */
-static void mark_block(BlockHead* bhead, const UserDataLabel label)
+struct ldv_heap
 {
-	LDV_ASSERT(check_ptr(bhead))	
-	ldv_block_type* p = RAW_MEMORY(bhead);
-	const ldv_block_type next_end = get_head_offset(bhead, NextHead);
-	for (ldv_block_type i = 2; i != next_end; ++i)
-	{
-		LDV_ASSERT(check_ptr(p + i))	
-		*(p + i) = label == Allocated ? ALLOC_MASK : FREE_MASK;
-	}
-}
+	/*	Regions of heap (in allocation order)	*/
+	HeapRegion* regions;
+	/*	Regions of heap sorted by address (to find region of pointer)	*/
+	HeapRegion** region_table;
+	/*	Count of heap regions	*/
+	unsigned int region_count;
+	/*	Tree of sizes of the largest garbage blocks of regions in words: node has children 2 * node and 2 * node + 1,
+		leaves start at region_leaves in heap order of regions	*/
+	ldv_block_type* region_largest;
+	/*	Regions in heap order (leaves of tree of the largest garbage blocks)	*/
+	HeapRegion** region_ranks;
+	/*	Count of leaves of tree of the largest garbage blocks (power of two)	*/
+	unsigned int region_leaves;
+	/*	Size of regions added to heap in bytes	*/
+	size_t region_bytes;
+	/*	Maximal size of heap in bytes (0 - heap is not limited)	*/
+	size_t limit;
+	/*	Poisoning policy of blocks	*/
+	ldv_poison_mode poison_mode;
+	/*	Allocation counters (free memory counters are kept by regions)	*/
+	ldv_stats stats;
+	/*	Flag, whether small objects are served by slab pages	*/
+	int slab_enabled;
+	/*	Lists of slab pages with free slots (one list per size class)	*/
+	SlabPage* slab_partial[SLAB_CLASS_COUNT];
+	/*	Slab pages sorted by address (to find page of pointer)	*/
+	SlabPage** slab_pages;
+	/*	Count of slab pages	*/
+	unsigned int slab_page_count;
+	/*	Capacity of slab pages table	*/
+	unsigned int slab_page_capacity;
+	/*	Flag, whether ldv_compact is allowed to move memory of lua objects	*/
+	int relocation_enabled;
+	/*	Minimal size of redzone after payload of heap blocks	*/
+	size_t redzone_bytes;
+	/*	Freed blocks, which are kept from reuse	*/
+	Quarantine quarantine;
+	/*	Flag, whether incremental check of objects is in progress	*/
+	int check_active;
+	/*	Index of gc list, which is checked by incremental check	*/
+	int check_list;
+	/*	Next object to check by incremental check (it is advanced, when object is freed)	*/
+	const GCObject* check_object;
+	/*	Global state of lua state, which objects are checked by incremental check	*/
+	const global_State* check_state;
+	/*	Heads of lists of objects with finalizers at last step of incremental check (see ldv_check_ptrs_step)	*/
+	const GCObject* check_finobj;
+	const GCObject* check_tobefnz;
+	/*	Tags of blocks (lua type and allocation site)	*/
+	BlockTags tags;
+	/*	Sampling profiler of allocations	*/
+	AllocSampler sampler;
+	/*	Running coroutine, which call stack gives allocation sites and sampled stacks instead of states of tags and sampler
+		(NULL - those states are running)	*/
+	lua_State* running;
+	/*	Recorder of allocation trace	*/
+	AllocTrace trace;
+	/*	Flag, whether heap is shared by threads	*/
+	int thread_safe;
+	/*	Lock of heap in thread safe mode (0 - free, 1 - taken)	*/
+	volatile long lock;
+	/*	Epoch of heap memory (blocks cached by threads at other epoch are gone)	*/
+	unsigned int cache_epoch;
+};
 
 /*
-		Computes hold data size in bytes
-		Params: block head
-		Return: size of block head data
+		Cache of freed small blocks of thread. Blocks are linked by their first word and kept allocated in heap,
+		each block fits any object of its slab size class. Counters of cached operations are merged to heap under lock
 */
-static ldv_block_type data_size(BlockHead* bhead)
+typedef struct ThreadCache
 {
-	LDV_ASSERT(check_ptr(bhead))
-	return ((bhead->next_index & block_data_mask()) - 2) * sizeof(ldv_block_type);
-}
+	/*	Heap of cached blocks	*/
+	ldv_heap* heap;
+	/*	Epoch of heap memory, when blocks were cached	*/
+	unsigned int epoch;
+	/*	Lists of cached blocks of slab size classes	*/
+	void* blocks[SLAB_CLASS_COUNT];
+	/*	Size of cached blocks	*/
+	size_t bytes;
+	/*	Allocation counters, which are not merged to heap yet (live counters are updated on heap by each operation)	*/
+	ldv_stats delta;
+} ThreadCache;
 
 /*
-		Checks data, pointed with "sized" ptr
-		Params: pointer to raw data, min size of data
-		Return: check result
+		Entry of registry of live heaps
 */
-static int check_sized_ptr(const void* ptr, const unsigned int min_size)
+typedef struct LiveHeap
 {
-	ldv_block_type* raw_data = RAW_MEMORY(ptr) - 2;
-	const int check_location = mem_buf <= raw_data && raw_data < mem_buf + MEM_BUFF_SIZE;
-	LDV_ASSERT(check_location)
-	if (!check_location)
-		return 0;
-	const ldv_block_type next = get_head_offset((BlockHead*)raw_data, NextHead);
-	const int check_size = next * sizeof(ldv_block_type) >= min_size + sizeof(ldv_block_type) * 2;
-	LDV_ASSERT(check_size)
-	return check_size;
-}
+	/*	Heap (it is not dereferenced by registry)	*/
+	const ldv_heap* heap;
+	/*	Current epoch of heap memory	*/
+	unsigned int epoch;
+} LiveHeap;
+
+//		Region of static memory buffer (first region of default heap)
+static HeapRegion static_region = { mem_buf, MEM_BUFF_SIZE, NULL, 0, 0, { 0 }, { 0 }, { 0 }, 0, 0, 0, 0, 0, NULL, 0, NULL };
+//		Default heap (used, when ldv_frealloc gets no heap)
+static ldv_heap default_heap;
+//		Flag, whether default heap is initialized
+static int default_heap_ready = 0;
+//		Last epoch of heap memory (epochs are unique among heaps)
+static unsigned int cache_epochs = 0;
+//		Registry of live heaps. Thread flushes its cache to other heap, only if that heap is still registered at epoch of cached blocks
+static LiveHeap* live_heaps = NULL;
+//		Count of registered heaps
+static size_t live_heap_count = 0;
+//		Capacity of registry of live heaps
+static size_t live_heap_capacity = 0;
+//		Lock of registry of live heaps (it is taken before heap lock)
+static volatile long live_heaps_lock = 0;
+//		Key of thread exit callback, which flushes cache of thread
+static ThreadExitKey cache_exit_key;
+//		State of key of thread exit callback (0 - not created, 1 - created, -1 - creation failed)
+static int cache_exit_state = 0;
 
 /*
-        Gets status of current state type
-        Params: block info, state type
-        Return: state status
+		Free list links. They are kept in first payload words of garbage block
 */
-StateStatus status(BlockHead* binfo, StateType flag)
+typedef struct FreeLinks
 {
-	LDV_ASSERT(check_ptr(binfo))
-	int mask = block_flag_mask();
-	switch (flag)
-	{
-		case DataState:
-			return binfo->prev_index & mask ? Gem : Garbage;
-		case NextHeadState:
-			return binfo->next_index & mask ? MiddleHead : MarginHead;
-		case PrevHeadState:
-			return (binfo->prev_index & (~mask)) != 0 ? MiddleHead : MarginHead;
-	}
-	return Error;
-}
+	/*	Index of next free block in bin	*/
+	ldv_block_type next_free;
+	/*	Index of previous free block in bin	*/
+	ldv_block_type prev_free;
+} FreeLinks;
 
 /*
-		Sets state status of block head
-		Params: block head
-		Return: none
+		Buffered output of ldv. Each thread has own output
 */
-void set_status(BlockHead* binfo, StateStatus status)
+typedef struct LogSink
 {
-	LDV_ASSERT(check_ptr(binfo))
-	int mask = block_flag_mask();
-	switch (status)
-	{
-		case Gem:
-			binfo->prev_index = binfo->prev_index | mask;
-			break;
-		case Garbage:
-			binfo->prev_index = binfo->prev_index & (~mask);
-			break;
-		default:
-			/*	TODO: (alex) add assertion here?	*/
-			break;
-	}
-}
+	/*	Target of output	*/
+	ldv_sink target;
+	/*	Flag, whether stream of target is opened by ldv (and has to be closed by it)	*/
+	int owned_file;
+	/*	Buffered output (zero terminated)	*/
+	char* buf;
+	/*	Start of output of current target in buffer (output before it belongs to redirected memory target)	*/
+	size_t base;
+	/*	Size of buffered output	*/
+	size_t size;
+	/*	Capacity of buffer	*/
+	size_t capacity;
+	/*	Depth of output batches (output is flushed by lines out of batches)	*/
+	int batch_depth;
+	/*	Maximal size of output of current target (0 - output is not limited)	*/
+	size_t limit;
+	/*	Size of output of current target	*/
+	size_t written;
+	/*	Flag, whether output was cut by limit	*/
+	int truncated;
+} LogSink;
 
 /*
-		Gets block head with given offset
-		Params: block, offset type, block offset
-		Return: offset block head
+		Saved output state of redirection
 */
-static BlockHead* raw_move_head(BlockHead* head, HeadType head_type, ldv_block_type offset)
+typedef struct LogCapture
 {
-	LDV_ASSERT(check_ptr(head))
-	if (head_type == NextHead)
-		return (BlockHead*)(RAW_MEMORY(head) + offset);
-	return (BlockHead*)(RAW_MEMORY(head) - offset);
-}
+	/*	Target of output before redirection	*/
+	ldv_sink prev_target;
+	/*	Flag, whether stream of previous target is opened by ldv	*/
+	int prev_owned_file;
+	/*	Start of output of previous target in buffer	*/
+	size_t prev_base;
+	/*	Output limit of previous target	*/
+	size_t prev_limit;
+	/*	Size of output of previous target	*/
+	size_t prev_written;
+	/*	Truncation flag of previous target	*/
+	int prev_truncated;
+	/*	Start of redirected output in buffer	*/
+	size_t start;
+} LogCapture;
 
 /*
-		Frees memory allocated via ldv_malloc
-		Params: pointer to memory
-		Return: none
+		Set of objects, expanded by dump. Open addressing hash table, which lives out of ldv heap
 */
-static void ldv_free(void* ptr)
+typedef struct VisitedSet
 {
-	if (ptr == NULL)
-		return;
-	LDV_ASSERT(check_ptr(ptr))
-	BlockHead* b_info = (BlockHead*)(RAW_MEMORY(ptr) - 2);
-	set_status(b_info, Garbage);
-	mark_block(b_info, Free);
-	ldv_block_type bheads_offsets[2] = {0, get_head_offset(b_info, PrevHead)};
-	for (int i = 0; i < 2; ++i)
-	{
-		BlockHead* bhead = raw_move_head(b_info, PrevHead, bheads_offsets[i]);
-		if (status(bhead, DataState) == Garbage && status(bhead, NextHeadState) == MiddleHead)
-		{
-			ldv_block_type next_offset = get_head_offset(bhead, NextHead);
-			BlockHead* next_head = raw_move_head(bhead, NextHead, next_offset);
-			if (status(next_head, DataState) == Garbage)
-			{
-				ldv_block_type next_next_offset = get_head_offset(next_head, NextHead);
-				set_head(bhead, NextHead, next_offset + next_next_offset);
-				if (status(next_head, NextHeadState) == MiddleHead)
-				{
-					set_head(raw_move_head(bhead, NextHead, next_offset + next_next_offset), PrevHead, next_offset + next_next_offset);
-				}
-			}
-			mark_block(bhead, Free);
-		}
-	}
-}
+	/*	Addresses of objects (0 - empty cell)	*/
+	const void** keys;
+	/*	Dump ids of objects	*/
+	unsigned int* ids;
+	/*	Count of cells (power of two)	*/
+	size_t capacity;
+	/*	Count of objects	*/
+	size_t count;
+	/*	Depth of nested dumps, which share set	*/
+	int sessions;
+} VisitedSet;
 
 /*
-		Finds best fitted memory to alloc
-		Params: fit size
-		Return: pointer to free memory
+		Kinds of edges between walked objects
 */
-static BlockHead* find_fit_head(size_t nsize)
+typedef enum WalkEdge
 {
-	BlockHead* best_fit_head = 0;
-	BlockHead* start_head = (BlockHead*)mem_buf;
-	for (;;)
-	{
-		ldv_block_type next_offset = get_head_offset(start_head, NextHead);
-		if (status(start_head, DataState) == Garbage)
-		{
-			const ldv_block_type start_d_size = data_size(start_head);
-			if (start_d_size >= nsize)
-			{
-				if (best_fit_head == 0)
-					best_fit_head = start_head;
-				const ldv_block_type fit_d_size = data_size(best_fit_head);
-				best_fit_head =  fit_d_size > start_d_size ? start_head : best_fit_head;
-			}
-		}
-		if (status(start_head, NextHeadState) == MarginHead)
-			break;
-		start_head = raw_move_head(start_head, NextHead, next_offset);
-	}
-	return best_fit_head;
-}
+	WalkArrayItem,		/*	Item of table array part	*/
+	WalkNodeKey,		/*	Key of table node	*/
+	WalkNodeValue,		/*	Value of table node	*/
+	WalkMetatable,		/*	Metatable of table or user data	*/
+	WalkUpvalue,		/*	Upvalue of closure	*/
+	WalkProto,			/*	Proto of lua closure	*/
+	WalkUpvalueName,	/*	Name of proto upvalue	*/
+	WalkConstant,		/*	Constant of proto	*/
+	WalkChildProto,		/*	Nested proto	*/
+	WalkUserValue,		/*	User value of user data	*/
+	WalkStackSlot		/*	Slot of thread stack	*/
+} WalkEdge;
 
 /*
-		Allocates memory with size
-		Params: size of needed memory
-		Return: none
+		Item of object walk: lua value or object, which is not kept in lua value (proto, upvalue name)
 */
-static void* ldv_malloc(size_t nsize)
+typedef struct WalkItem
 {
-	BlockHead* fit_head = find_fit_head(nsize);
-	if (fit_head == 0)
-		return 0;
-	set_status(fit_head, Gem);
-	ldv_block_type next_head_off = get_head_offset(fit_head, NextHead);
-	ldv_block_type next_block_off = 2 + nsize / sizeof(ldv_block_type) + ( nsize % sizeof(ldv_block_type) == 0 ? 0 : 1);
-	/*	TODO: (alex) think about best way to solve problem (next_head - next_block == 1)*/
-	if (next_block_off + 1 == next_head_off)
-		next_block_off = next_head_off;
-	BlockHead* next_block = raw_move_head(fit_head, NextHead, next_block_off);
-	if (next_block_off < next_head_off)
-	{	
-		set_status(next_block, Garbage);
-		set_head(next_block, NextHead, next_head_off - next_block_off);
-		if (status(next_block, NextHeadState) == MiddleHead)
-		{
-			set_head(raw_move_head(fit_head, NextHead, next_head_off), PrevHead, next_head_off - next_block_off);
-		}
-	}
-	set_head(fit_head, NextHead, next_block_off);
-	if (status(fit_head, NextHeadState) == MiddleHead)
-	{
-		set_head(next_block, PrevHead, next_block_off);
-	}
-	mark_block(fit_head, Allocated);
-	return RAW_MEMORY(fit_head) + 2;
-}
+	/*	Type tag of item (variant tag of value, LUA_TPROTO for proto)	*/
+	int type;
+	/*	Value of item (NULL for objects out of values)	*/
+	const TValue* value;
+	/*	Object of item (NULL for not collectable values)	*/
+	const void* obj;
+} WalkItem;
 
 /*
-	Loads ldv library
-	Params: lua state
-	Return: returns count
+		Frame of work stack of object walker
 */
-static int ldv_load_libf(lua_State* L)
+typedef struct WalkFrame
 {
-	luaL_newlib(L, ldv_tab_funcs);
-  	return 1;
-}
+	/*	Walked item	*/
+	WalkItem item;
+	/*	Remaining depth of item	*/
+	int depth;
+	/*	Index of next child	*/
+	size_t cursor;
+	/*	Count of followed children	*/
+	size_t followed;
+} WalkFrame;
+
+struct ObjectWalker;
 
-/*			PRIVATE FUNCS				*/
 /*
-		Checks validity of table 
-		Params: lua state, table
-		Return: valid state
+		Visitor of object walk
 */
-int check_table(lua_State* L, const Table* table)
+typedef struct WalkVisitor
 {
-	if (table->array && !check_ptr(table->array) || table->node && !check_ptr(table->node))
-		return 0;
-	for (unsigned int i = 0; i < table->sizearray; ++i)
-	{
-		if (!check_ptr(table->array + i))
-			return 0;
-	}
-	for (unsigned int i = 0; i < table->lsizenode; ++i)
-	{
-		if (!check_ptr(table->node + i))
-			return 0;	
-	}
-	if (table->metatable && !check_ptr(table->metatable))
-		return 0;
-	return table->metatable && check_table(L, table->metatable);
-}
+	/*	Called on entering item. Returns flag, whether children of item are walked	*/
+	int (*enter)(struct ObjectWalker* walker, const WalkItem* item, const int depth);
+	/*	Called before child of item (optional). Returns flag, whether child is walked	*/
+	int (*edge)(struct ObjectWalker* walker, const WalkItem* parent, const WalkEdge edge, const size_t index, const size_t followed);
+	/*	Called after children of item (optional)	*/
+	void (*leave)(struct ObjectWalker* walker, const WalkItem* item, const size_t followed);
+} WalkVisitor;
 
 /*
-		Checks upvalue 
-		Params: lua state, upvalue
-		Return: valid state
+		Iterative walker of lua object graph. Work stack lives out of ldv heap
 */
-int check_upvalue(lua_State* L, const UpVal* upval)
+typedef struct ObjectWalker
 {
-	const UpVal* val = upval;
-	while (val != NULL)
-	{
-		if (!check_ptr(val) || !check_ptr(val->v))
-			return 0;
-		val = upisopen(val) ? val->u.open.next : NULL;
-	}
-	return 1;
-}
+	/*	Visitor of walk	*/
+	const WalkVisitor* visitor;
+	/*	Lua state	*/
+	lua_State* L;
+	/*	User data of visitor	*/
+	void* ud;
+	/*	Work stack	*/
+	WalkFrame* frames;
+	/*	Count of frames in work stack	*/
+	size_t count;
+	/*	Capacity of work stack	*/
+	size_t capacity;
+	/*	Objects entered by walk (maintained by visitor)	*/
+	VisitedSet visited;
+	/*	Flag, whether walk is stopped	*/
+	int stopped;
+} ObjectWalker;
 
 /*
-		Checks validity of cclosure 
-		Params: lua state, cclosure
-		Return: valid state
+		Writer of heap snapshot. Records are collected in large buffer, names are kept in memory till the end of snapshot
 */
-int check_cclosure(lua_State* L, const CClosure* cclosure)
+typedef struct SnapshotWriter
 {
-	return 1;
-}
+	/*	Snapshot file	*/
+	FILE* file;
+	/*	Write buffer	*/
+	char* buf;
+	/*	Size of buffered data	*/
+	size_t size;
+	/*	Size of written data	*/
+	size_t written;
+	/*	Flag, whether write failed	*/
+	int failed;
+	/*	Names of objects	*/
+	char* names;
+	/*	Size of names	*/
+	size_t name_bytes;
+	/*	Capacity of names	*/
+	size_t name_capacity;
+	/*	Count of written references	*/
+	size_t edge_count;
+} SnapshotWriter;
 
 /*
-		Checks validity of string 
-		Params: lua state, string
-		Return: valid state
+		Reference graph of gc objects in compressed sparse row form. Vertex 0 is virtual root, which refers to roots of lua state
 */
-int check_string(lua_State* L, const TString* str)
+typedef struct ObjectGraph
 {
-	return 1;
+	/*	Vertices of objects (vertex is id of object)	*/
+	VisitedSet ids;
+	/*	Objects of vertices (NULL for virtual root)	*/
+	const GCObject** objects;
+	/*	Position of the first reference of each vertex in targets (count of vertices + 1 items)	*/
+	unsigned int* first_edge;
+	/*	Referenced vertices	*/
+	unsigned int* targets;
+	/*	Count of vertices	*/
+	size_t count;
+	/*	Count of references	*/
+	size_t edge_count;
+	/*	Capacity of targets	*/
+	size_t edge_capacity;
+} ObjectGraph;
+
+/*
+		Array or hash part of table, which is relocated by compaction
+*/
+typedef struct RelocatedPart
+{
+	/*	Memory of part	*/
+	void* mem;
+	/*	Table, which owns part	*/
+	Table* table;
+	/*	Flag, whether part is hash part (array part otherwise)	*/
+	int node;
+	/*	Slot of region of part in region table of heap	*/
+	unsigned int slot;
+	/*	Position of region of part in list of heap regions	*/
+	unsigned int rank;
+} RelocatedPart;
+
+/*
+		Garbage block, which is a target of compaction
+*/
+typedef struct CompactHole
+{
+	/*	Region of block	*/
+	HeapRegion* region;
+	/*	Head of block (taken block keeps its head as position in index, its size in tree is 0)	*/
+	BlockHead* head;
+} CompactHole;
+
+/*
+		Region of heap in compaction index
+*/
+typedef struct CompactRegion
+{
+	/*	Position of region in list of heap regions	*/
+	unsigned int rank;
+	/*	Range of garbage blocks of region in index	*/
+	size_t first;
+	size_t end;
+} CompactRegion;
+
+/*
+		Index of garbage blocks for compaction. Blocks are kept in heap order (regions in order of heap list,
+		blocks by address within region), tree of maximal sizes over them finds the lowest fitted block
+		below given position in logarithmic time
+*/
+typedef struct CompactIndex
+{
+	/*	Garbage blocks in heap order	*/
+	CompactHole* holes;
+	/*	Count of garbage blocks	*/
+	size_t count;
+	/*	Capacity of garbage blocks	*/
+	size_t capacity;
+	/*	Regions, indexed by slots of region table of heap	*/
+	CompactRegion* regions;
+	/*	Tree of maximal sizes of blocks in words: node has children 2 * node and 2 * node + 1, leaves start at leaf_count	*/
+	ldv_block_type* sizes;
+	/*	Count of leaves of tree (power of two)	*/
+	size_t leaf_count;
+} CompactIndex;
+
+/*
+		Object with retained size, candidate of top retainers
+*/
+typedef struct RetainedObject
+{
+	/*	Retained size	*/
+	size_t retained;
+	/*	Depth first number of object vertex	*/
+	unsigned int number;
+} RetainedObject;
+
+/*
+		Group of long strings with same contents
+*/
+typedef struct StringGroup
+{
+	/*	The first found string of group (NULL - empty cell)	*/
+	const TString* string;
+	/*	Hash of contents	*/
+	uint64_t hash;
+	/*	Count of strings	*/
+	size_t copies;
+	/*	Size of memory of all copies but one	*/
+	size_t wasted;
+} StringGroup;
+
+//		Output of current thread
+static LDV_THREAD_LOCAL LogSink log_sink;
+//		Objects, expanded by dump of current thread
+static LDV_THREAD_LOCAL VisitedSet dump_visited;
+//		Cache of freed small blocks of current thread
+static LDV_THREAD_LOCAL ThreadCache thread_cache;
+//		Initial count of cells in set of expanded objects
+#define VISITED_SET_SIZE 256
+//		Initial count of frames in work stack of object walker
+#define WALK_STACK_SIZE 256
+
+/*
+		Begins batch of output. Batch output is flushed by large portions
+		Params: none
+		Return: none
+*/
+static void log_batch_begin(void)
+{
+	++log_sink.batch_depth;
+}
+
+/*
+		Ends batch of output. Output is flushed at the end of outermost batch
+		Params: none
+		Return: none
+*/
+static void log_batch_end(void)
+{
+	if (--log_sink.batch_depth == 0)
+		ldv_log_flush();
+}
+
+/*
+		Redirects output to other target. Output of memory targets is kept in buffer, so redirections may be nested
+		Params: redirection state, target (NULL - memory), maximal size of output (0 - output is not limited)
+		Return: none
+*/
+static void log_capture_begin(LogCapture* capture, const ldv_sink* target, size_t limit)
+{
+	ldv_log_flush();
+	capture->prev_target = log_sink.target;
+	capture->prev_owned_file = log_sink.owned_file;
+	capture->prev_base = log_sink.base;
+	capture->prev_limit = log_sink.limit;
+	capture->prev_written = log_sink.written;
+	capture->prev_truncated = log_sink.truncated;
+	capture->start = log_sink.size;
+	if (target != NULL)
+	{
+		log_sink.target = *target;
+	}
+	else
+	{
+		memset(&log_sink.target, 0, sizeof(ldv_sink));
+		log_sink.target.type = LDV_SINK_MEMORY;
+	}
+	log_sink.owned_file = 0;
+	log_sink.base = log_sink.size;
+	log_sink.limit = limit;
+	log_sink.written = 0;
+	log_sink.truncated = 0;
+}
+
+/*
+		Gets output of memory target of redirection
+		Params: redirection state, size of output (out)
+		Return: output
+*/
+static const char* log_captured(const LogCapture* capture, size_t* size)
+{
+	*size = log_sink.size - capture->start;
+	return log_sink.buf != 0 ? log_sink.buf + capture->start : "";
+}
+
+/*
+		Restores output, redirected by log_capture_begin. Output of stream target is flushed, output of memory target is dropped
+		Params: redirection state
+		Return: none
+*/
+static void log_capture_end(const LogCapture* capture)
+{
+	ldv_log_flush();
+	log_sink.size = capture->start;
+	if (log_sink.buf != 0)
+		log_sink.buf[log_sink.size] = 0;
+	log_sink.target = capture->prev_target;
+	log_sink.owned_file = capture->prev_owned_file;
+	log_sink.base = capture->prev_base;
+	log_sink.limit = capture->prev_limit;
+	log_sink.written = capture->prev_written;
+	log_sink.truncated = capture->prev_truncated;
+}
+
+//	PUBLIC LUA API FUNCTIONS
+/*===========PUBLIC LUA API BEGIN============*/
+/*
+		Prints dumpt of ldv memory heap
+		Params: none
+		Return: none
+*/
+static int dumpHeap(lua_State* L)
+{
+	ldv_dump_heap(ldv_state_heap(L));
+	return 0;
+}
+
+/*
+		Checks ldv heap on erros
+		Params: none
+		Return: error code
+*/
+static int checkHeap(lua_State* L)
+{
+	const int err_code = ldv_check_heap(ldv_state_heap(L)); 
+	lua_pushinteger(L, err_code);
+	return 1;
+}
+
+/*
+		Dumps value to current output (it is called by dumpObject in protected mode)
+		Params: value, dumping depth
+		Return: none
+*/
+static int dump_protected(lua_State* L)
+{
+	const int depth = (int)lua_tointeger(L, 2);
+	lua_settop(L, 1);
+	log_batch_begin();
+	ldv_dump_value(depth, L, L->top - 1);
+	log_batch_end();
+	return 0;
+}
+
+/*
+		Dumps object to string or to file
+		Params: object to dump, options table (optional): depth - dumping depth,
+				maxsize - maximal size of dump in bytes, path - path of file to write dump
+		Return: dump (size of dump, if dump is written to file), flag whether dump is cut by maxsize
+*/
+static int dumpObject(lua_State* L)
+{
+	int depth = MAX_DUMP_DEPTH;
+	size_t limit = 0;
+	const char* path = NULL;
+	luaL_checkany(L, 1);
+	if (lua_istable(L, 2))
+	{
+		lua_getfield(L, 2, "depth");
+		depth = (int)luaL_optinteger(L, -1, depth);
+		lua_getfield(L, 2, "maxsize");
+		limit = (size_t)luaL_optinteger(L, -1, 0);
+		lua_getfield(L, 2, "path");
+		path = luaL_optstring(L, -1, NULL);
+	}
+	ldv_sink sink;
+	memset(&sink, 0, sizeof(ldv_sink));
+	sink.type = LDV_SINK_FILE;
+	if (path != NULL && (sink.file = fopen(path, "w")) == NULL)
+		return luaL_error(L, "cannot open dump file %s", path);
+	LogCapture log_capture;
+	log_capture_begin(&log_capture, sink.file != NULL ? &sink : NULL, limit);
+	/*	Error of dump must not leave output redirected or file opened	*/
+	const int batch_depth = log_sink.batch_depth;
+	lua_pushcfunction(L, dump_protected);
+	lua_pushvalue(L, 1);
+	lua_pushinteger(L, depth);
+	if (lua_pcall(L, 2, 0, 0) != LUA_OK)
+	{
+		log_sink.batch_depth = batch_depth;
+		log_capture_end(&log_capture);
+		if (sink.file != NULL)
+			fclose(sink.file);
+		return lua_error(L);
+	}
+	const int truncated = log_sink.truncated;
+	if (sink.file != NULL)
+	{
+		const size_t written = log_sink.written;
+		log_capture_end(&log_capture);
+		fclose(sink.file);
+		lua_pushinteger(L, (lua_Integer)written);
+	}
+	else
+	{
+		size_t size = 0;
+		const char* dump = log_captured(&log_capture, &size);
+		lua_pushlstring(L, dump, size);
+		log_capture_end(&log_capture);
+	}
+	lua_pushboolean(L, truncated);
+	return 2;
+}
+
+/*
+		Check objects. Check with budget is incremental: it checks at most budget objects and resumes on next call
+		Params: budget (optional)
+		Return: check result (budget is not passed) or check status ("running", "done" or "failed")
+*/
+static int checkObjects(lua_State* L)
+{
+	static const char* const statuses[] = { "running", "done", "failed" };
+	/*	Argument is checked and result is pushed outside of output batch, so errors do not leave batch open	*/
+	const int stepped = !lua_isnoneornil(L, 1);
+	const lua_Integer budget = stepped ? luaL_checkinteger(L, 1) : 0;
+	luaL_argcheck(L, budget >= 0, 1, "negative budget");
+	log_batch_begin();
+	const int result = stepped ? (int)ldv_check_ptrs_step(L, (size_t)budget) : ldv_check_ptrs(L);
+	log_batch_end();
+	if (stepped)
+		lua_pushstring(L, statuses[result]);
+	else
+		lua_pushboolean(L, result);
+	return 1;
+}
+
+/*
+		Gets reallocation counters
+		Params: none
+		Return: count of reallocations served in place, count of moved reallocations
+*/
+static int reallocStats(lua_State* L)
+{
+	size_t in_place = 0, moved = 0;
+	ldv_realloc_stats(ldv_state_heap(L), &in_place, &moved);
+	lua_pushinteger(L, (lua_Integer)in_place);
+	lua_pushinteger(L, (lua_Integer)moved);
+	return 2;
+}
+
+/*
+		Sets poisoning policy of ldv heap
+		Params: policy name ("off", "header" or "full")
+		Return: previous policy name
+*/
+static int setPoison(lua_State* L)
+{
+	static const char* const modes[] = { "off", "header", "full", NULL };
+	const int mode = luaL_checkoption(L, 1, NULL, modes);
+	lua_pushstring(L, modes[ldv_set_poison(ldv_state_heap(L), (ldv_poison_mode)mode)]);
+	return 1;
+}
+
+/*
+		Gets statistics of ldv heap
+		Params: none
+		Return: table of statistics (histogram is keyed by upper bound of bucket size)
+*/
+static int stats(lua_State* L)
+{
+	ldv_stats heap_stats;
+	ldv_get_stats(ldv_state_heap(L), &heap_stats);
+	const struct { const char* name; size_t value; } counters[] =
+	{
+		{ "live_bytes", heap_stats.live_bytes },
+		{ "live_blocks", heap_stats.live_blocks },
+		{ "peak_bytes", heap_stats.peak_bytes },
+		{ "alloc_count", heap_stats.alloc_count },
+		{ "free_count", heap_stats.free_count },
+		{ "realloc_count", heap_stats.realloc_count },
+		{ "realloc_in_place", heap_stats.realloc_in_place_count },
+		{ "realloc_moved", heap_stats.realloc_moved_count },
+		{ "free_blocks", heap_stats.free_blocks },
+		{ "free_bytes", heap_stats.free_bytes },
+		{ "largest_free", heap_stats.largest_free },
+		{ "invalid_frees", heap_stats.invalid_frees },
+		{ "overflows", heap_stats.overflows },
+		{ "freed_writes", heap_stats.freed_writes },
+		{ "lock_contentions", heap_stats.lock_contentions }
+	};
+	lua_createtable(L, 0, sizeof(counters) / sizeof(counters[0]) + 2);
+	for (unsigned int i = 0; i < sizeof(counters) / sizeof(counters[0]); ++i)
+	{
+		lua_pushinteger(L, (lua_Integer)counters[i].value);
+		lua_setfield(L, -2, counters[i].name);
+	}
+	lua_pushnumber(L, (lua_Number)heap_stats.fragmentation);
+	lua_setfield(L, -2, "fragmentation");
+	lua_createtable(L, 0, LDV_HISTOGRAM_SIZE);
+	for (unsigned int i = 0; i < LDV_HISTOGRAM_SIZE; ++i)
+	{
+		lua_pushinteger(L, (lua_Integer)heap_stats.histogram[i]);
+		lua_rawseti(L, -2, (lua_Integer)1 << i);
+	}
+	lua_setfield(L, -2, "histogram");
+	return 1;
+}
+
+/*
+		Analyses fragmentation of free memory of ldv heap
+		Params: none
+		Return: table { free_blocks, free_bytes, largest_free, gem_blocks, gem_bytes, histogram },
+				histogram of garbage blocks is keyed by upper bound of bucket size ({ blocks, bytes } items)
+*/
+static int fragmentation(lua_State* L)
+{
+	ldv_fragmentation report;
+	ldv_get_fragmentation(ldv_state_heap(L), &report);
+	const struct { const char* name; size_t value; } counters[] =
+	{
+		{ "free_blocks", report.free_blocks },
+		{ "free_bytes", report.free_bytes },
+		{ "largest_free", report.largest_free },
+		{ "gem_blocks", report.gem_blocks },
+		{ "gem_bytes", report.gem_bytes }
+	};
+	lua_createtable(L, 0, sizeof(counters) / sizeof(counters[0]) + 1);
+	for (unsigned int i = 0; i < sizeof(counters) / sizeof(counters[0]); ++i)
+	{
+		lua_pushinteger(L, (lua_Integer)counters[i].value);
+		lua_setfield(L, -2, counters[i].name);
+	}
+	lua_createtable(L, 0, LDV_HISTOGRAM_SIZE);
+	for (unsigned int i = 0; i < LDV_HISTOGRAM_SIZE; ++i)
+	{
+		if (report.free_count[i] == 0)
+			continue;
+		lua_createtable(L, 0, 2);
+		lua_pushinteger(L, (lua_Integer)report.free_count[i]);
+		lua_setfield(L, -2, "blocks");
+		lua_pushinteger(L, (lua_Integer)report.free_size[i]);
+		lua_setfield(L, -2, "bytes");
+		lua_rawseti(L, -2, (lua_Integer)1 << i);
+	}
+	lua_setfield(L, -2, "histogram");
+	return 1;
+}
+
+/*
+		Analyses health of string table (see ldv_get_strtable_stats)
+		Params: none
+		Return: table { size, count, load_factor, empty_buckets, max_chain, average_chain, expected_collisions,
+				observed_collisions, same_hash, histogram, longest }, histogram is keyed by chain length (from 0),
+				longest is list of { bucket, length, distinct_hashes, hash }
+*/
+static int strtableStats(lua_State* L)
+{
+	ldv_strtable_stats stats;
+	if (ldv_get_strtable_stats(L, &stats) != 0)
+		return luaL_error(L, "not enough memory");
+	const struct { const char* name; lua_Integer value; } counters[] =
+	{
+		{ "size", stats.size },
+		{ "count", stats.count },
+		{ "empty_buckets", stats.empty_buckets },
+		{ "max_chain", stats.max_chain },
+		{ "same_hash", stats.same_hash }
+	};
+	const struct { const char* name; double value; } rates[] =
+	{
+		{ "load_factor", stats.load_factor },
+		{ "average_chain", stats.average_chain },
+		{ "expected_collisions", stats.expected_collisions },
+		{ "observed_collisions", stats.observed_collisions }
+	};
+	lua_createtable(L, 0, sizeof(counters) / sizeof(counters[0]) + sizeof(rates) / sizeof(rates[0]) + 2);
+	for (unsigned int i = 0; i < sizeof(counters) / sizeof(counters[0]); ++i)
+	{
+		lua_pushinteger(L, counters[i].value);
+		lua_setfield(L, -2, counters[i].name);
+	}
+	for (unsigned int i = 0; i < sizeof(rates) / sizeof(rates[0]); ++i)
+	{
+		lua_pushnumber(L, (lua_Number)rates[i].value);
+		lua_setfield(L, -2, rates[i].name);
+	}
+	lua_createtable(L, LDV_CHAIN_HISTOGRAM_SIZE, 0);
+	for (int i = 0; i < LDV_CHAIN_HISTOGRAM_SIZE; ++i)
+	{
+		lua_pushinteger(L, (lua_Integer)stats.chain_histogram[i]);
+		lua_rawseti(L, -2, i);
+	}
+	lua_setfield(L, -2, "histogram");
+	lua_createtable(L, stats.longest_count, 0);
+	for (int i = 0; i < stats.longest_count; ++i)
+	{
+		const ldv_strtable_chain* chain = &stats.longest[i];
+		lua_createtable(L, 0, 4);
+		lua_pushinteger(L, chain->bucket);
+		lua_setfield(L, -2, "bucket");
+		lua_pushinteger(L, chain->length);
+		lua_setfield(L, -2, "length");
+		lua_pushinteger(L, chain->distinct_hashes);
+		lua_setfield(L, -2, "distinct_hashes");
+		lua_pushinteger(L, (lua_Integer)chain->hash);
+		lua_setfield(L, -2, "hash");
+		lua_rawseti(L, -2, i + 1);
+	}
+	lua_setfield(L, -2, "longest");
+	return 1;
+}
+
+/*
+		Sets size of quarantine of freed blocks (see ldv_set_quarantine)
+		Params: maximal size of quarantined objects in bytes (0 - quarantine is disabled)
+		Return: previous size of quarantine
+*/
+static int setQuarantine(lua_State* L)
+{
+	const lua_Integer bytes = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, bytes >= 0, 1, "negative size");
+	lua_pushinteger(L, (lua_Integer)ldv_set_quarantine(ldv_state_heap(L), (size_t)bytes));
+	return 1;
+}
+
+/*
+		Enables/disables relocating mode of ldv heap (see ldv_set_relocation)
+		Params: enabled flag
+		Return: previous enabled flag
+*/
+static int setRelocation(lua_State* L)
+{
+	lua_pushboolean(L, ldv_set_relocation(ldv_state_heap(L), lua_toboolean(L, 1)));
+	return 1;
+}
+
+/*
+		Compacts ldv heap by moving table parts to lower free blocks (relocating mode has to be enabled)
+		Params: none
+		Return: count of moved blocks, size of moved memory, size of the largest free block
+*/
+static int compact(lua_State* L)
+{
+	ldv_compaction compaction;
+	const int code = ldv_compact(L, &compaction);
+	if (code == 1)
+		return luaL_error(L, "relocating mode of heap is disabled");
+	if (code != 0)
+		return luaL_error(L, "not enough memory for compaction");
+	lua_pushinteger(L, (lua_Integer)compaction.moved_blocks);
+	lua_pushinteger(L, (lua_Integer)compaction.moved_bytes);
+	lua_pushinteger(L, (lua_Integer)compaction.largest_free_after);
+	return 3;
+}
+
+/*
+		Sets target of ldv output
+		Params: path of output file (none - stdout)
+		Return: none
+*/
+static int setSink(lua_State* L)
+{
+	const char* path = luaL_optstring(L, 1, NULL);
+	ldv_sink sink;
+	memset(&sink, 0, sizeof(ldv_sink));
+	sink.type = LDV_SINK_STDOUT;
+	if (path != NULL)
+	{
+		sink.type = LDV_SINK_FILE;
+		sink.file = fopen(path, "w");
+		if (sink.file == NULL)
+			return luaL_error(L, "cannot open ldv output file %s", path);
+	}
+	ldv_set_sink(&sink);
+	log_sink.owned_file = path != NULL;
+	return 0;
+}
+
+/*
+		Calls function and captures ldv output
+		Params: function, arguments of function
+		Return: captured output
+*/
+static int capture(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	LogCapture log_capture;
+	log_capture_begin(&log_capture, NULL, 0);
+	const int status = lua_pcall(L, lua_gettop(L) - 1, 0, 0);
+	if (status != LUA_OK)
+	{
+		log_capture_end(&log_capture);
+		return lua_error(L);
+	}
+	size_t size = 0;
+	const char* output = log_captured(&log_capture, &size);
+	lua_pushlstring(L, output, size);
+	log_capture_end(&log_capture);
+	return 1;
+}
+
+/*
+		Resumes coroutine, while it is running coroutine of heap (see ldv_switch_thread). Follows resume of coroutine library
+		Params: lua state (arguments are on top of stack), coroutine, count of arguments
+		Return: count of results, which are moved to lua state (-1 - error, error object is on top of stack)
+*/
+static int resume_switched(lua_State* L, lua_State* co, int narg)
+{
+	if (!lua_checkstack(co, narg))
+	{
+		lua_pushliteral(L, "too many arguments to resume");
+		return -1;
+	}
+	if (lua_status(co) == LUA_OK && lua_gettop(co) == 0)
+	{
+		lua_pushliteral(L, "cannot resume dead coroutine");
+		return -1;
+	}
+	lua_xmove(L, co, narg);
+	ldv_heap* heap = ldv_state_heap(L);
+	lua_State* prev_running = ldv_switch_thread(heap, co);
+	const int status = lua_resume(co, L, narg);
+	ldv_switch_thread(heap, prev_running);
+	if (status != LUA_OK && status != LUA_YIELD)
+	{
+		lua_xmove(co, L, 1);
+		return -1;
+	}
+	const int nres = lua_gettop(co);
+	if (!lua_checkstack(L, nres + 1))
+	{
+		lua_pop(co, nres);
+		lua_pushliteral(L, "too many results to resume");
+		return -1;
+	}
+	lua_xmove(co, L, nres);
+	return nres;
+}
+
+/*
+		Resumes coroutine like coroutine.resume, while allocation sites and sampled stacks are taken from coroutine
+		Params: coroutine, arguments
+		Return: true and results of coroutine or false and error object
+*/
+static int resume(lua_State* L)
+{
+	lua_State* co = lua_tothread(L, 1);
+	luaL_argcheck(L, co != NULL, 1, "coroutine expected");
+	const int nres = resume_switched(L, co, lua_gettop(L) - 1);
+	if (nres < 0)
+	{
+		lua_pushboolean(L, 0);
+		lua_insert(L, -2);
+		return 2;
+	}
+	lua_pushboolean(L, 1);
+	lua_insert(L, -(nres + 1));
+	return nres + 1;
+}
+
+/*
+		Resumes coroutine of function, made by wrap (upvalue)
+		Params: arguments
+		Return: results of coroutine
+*/
+static int resumeWrapped(lua_State* L)
+{
+	lua_State* co = lua_tothread(L, lua_upvalueindex(1));
+	const int nres = resume_switched(L, co, lua_gettop(L));
+	if (nres < 0)
+	{
+		/*	Error message gets position of call like in coroutine.wrap	*/
+		if (lua_type(L, -1) == LUA_TSTRING)
+		{
+			luaL_where(L, 1);
+			lua_insert(L, -2);
+			lua_concat(L, 2);
+		}
+		return lua_error(L);
+	}
+	return nres;
+}
+
+/*
+		Makes coroutine like coroutine.wrap, its resumes take allocation sites and sampled stacks from coroutine
+		Params: body of coroutine
+		Return: function, which resumes coroutine
+*/
+static int wrap(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TFUNCTION);
+	lua_State* co = lua_newthread(L);
+	lua_pushvalue(L, 1);
+	lua_xmove(L, co, 1);
+	lua_pushcclosure(L, resumeWrapped, 1);
+	return 1;
+}
+
+/*
+		Enables tagging of heap blocks with lua type and allocation site. Sites are taken from main thread
+		and from coroutines, which are resumed by resume and wrap of ldv
+		Params: enabled flag, flag, whether allocation sites are recorded (true by default)
+		Return: success flag
+*/
+static int setTagging(lua_State* L)
+{
+	const int enabled = lua_toboolean(L, 1);
+	const int sites = lua_isnoneornil(L, 2) || lua_toboolean(L, 2);
+	lua_pushboolean(L, ldv_set_tagging(ldv_state_heap(L), enabled, sites ? G(L)->mainthread : NULL) == 0);
+	return 1;
+}
+
+/*
+		Pushes list of report entries of tagged blocks
+		Params: lua state, heap, grouping of blocks
+		Return: none
+*/
+static void push_tag_report(lua_State* L, const ldv_heap* heap, const ldv_tag_group group)
+{
+	const size_t count = ldv_tag_report(heap, group, NULL, 0);
+	ldv_tag_entry* entries = (ldv_tag_entry*)malloc((count != 0 ? count : 1) * sizeof(ldv_tag_entry));
+	const size_t size = entries != 0 ? ldv_tag_report(heap, group, entries, count) : 0;
+	lua_createtable(L, (int)(size < count ? size : count), 0);
+	for (size_t i = 0; i < size && i < count; ++i)
+	{
+		lua_createtable(L, 0, 4);
+		lua_pushstring(L, entries[i].name);
+		lua_setfield(L, -2, group == LDV_TAG_BY_TYPE ? "type" : "source");
+		if (group == LDV_TAG_BY_SITE)
+		{
+			lua_pushinteger(L, entries[i].line);
+			lua_setfield(L, -2, "line");
+		}
+		lua_pushinteger(L, (lua_Integer)entries[i].live_bytes);
+		lua_setfield(L, -2, "bytes");
+		lua_pushinteger(L, (lua_Integer)entries[i].live_blocks);
+		lua_setfield(L, -2, "blocks");
+		lua_rawseti(L, -2, (lua_Integer)i + 1);
+	}
+	free(entries);
+}
+
+/*
+		Reports live memory of tagged blocks
+		Params: none
+		Return: table { types = { {type, bytes, blocks}, ... }, sites = { {source, line, bytes, blocks}, ... } },
+				lists are sorted by bytes (descending order)
+*/
+static int tagReport(lua_State* L)
+{
+	const ldv_heap* heap = ldv_state_heap(L);
+	lua_createtable(L, 0, 2);
+	push_tag_report(L, heap, LDV_TAG_BY_TYPE);
+	lua_setfield(L, -2, "types");
+	push_tag_report(L, heap, LDV_TAG_BY_SITE);
+	lua_setfield(L, -2, "sites");
+	return 1;
+}
+
+/*
+		Sets mean interval of sampling profiler of allocations. Stacks are taken from main thread and from coroutines,
+		which are resumed by resume and wrap of ldv
+		Params: mean count of bytes between samples (0 - sampling is disabled, profile is dropped)
+		Return: previous mean count of bytes
+*/
+static int setSampling(lua_State* L)
+{
+	const lua_Integer mean_bytes = luaL_checkinteger(L, 1);
+	luaL_argcheck(L, mean_bytes >= 0, 1, "negative interval");
+	lua_pushinteger(L, (lua_Integer)ldv_set_sampling(ldv_state_heap(L), (size_t)mean_bytes, G(L)->mainthread));
+	return 1;
+}
+
+/*
+		Exports profile of sampled allocations in folded stack format (line per stack: frames, separated by ';', and bytes)
+		Params: path of output file (none - profile is returned as string)
+		Return: profile string or count of written bytes
+*/
+static int samples(lua_State* L)
+{
+	const char* path = luaL_optstring(L, 1, NULL);
+	ldv_sink sink;
+	memset(&sink, 0, sizeof(ldv_sink));
+	sink.type = LDV_SINK_FILE;
+	if (path != NULL && (sink.file = fopen(path, "w")) == NULL)
+		return luaL_error(L, "cannot open profile file %s", path);
+	LogCapture log_capture;
+	log_capture_begin(&log_capture, sink.file != NULL ? &sink : NULL, 0);
+	ldv_dump_samples(ldv_state_heap(L));
+	if (sink.file != NULL)
+	{
+		const size_t written = log_sink.written;
+		log_capture_end(&log_capture);
+		fclose(sink.file);
+		lua_pushinteger(L, (lua_Integer)written);
+	}
+	else
+	{
+		size_t size = 0;
+		const char* profile = log_captured(&log_capture, &size);
+		lua_pushlstring(L, profile, size);
+		log_capture_end(&log_capture);
+	}
+	return 1;
+}
+
+/*
+		Writes binary snapshot of heap blocks and gc object graph (see ldvsnapshot.h)
+		Params: path of snapshot file
+		Return: none
+*/
+static int snapshot(lua_State* L)
+{
+	const char* path = luaL_checkstring(L, 1);
+	if (ldv_snapshot(L, path) != 0)
+		return luaL_error(L, "cannot write snapshot file %s", path);
+	return 0;
+}
+
+/*
+		Starts recording of allocation trace of lua state heap (see ldv_trace_start)
+		Params: path of trace file
+		Return: none
+*/
+static int traceStart(lua_State* L)
+{
+	const char* path = luaL_checkstring(L, 1);
+	if (ldv_trace_start(ldv_state_heap(L), path) != 0)
+		return luaL_error(L, "cannot write trace file %s", path);
+	return 0;
+}
+
+/*
+		Stops recording of allocation trace
+		Params: none
+		Return: flag, whether trace is complete
+*/
+static int traceStop(lua_State* L)
+{
+	lua_pushboolean(L, ldv_trace_stop(ldv_state_heap(L)) == 0);
+	return 1;
+}
+
+/*
+		Finds gc objects, which retain the most memory (see ldv_top_retainers)
+		Params: max count of objects (10 by default)
+		Return: list of { type, address, name, size, retained }, sorted by retained size (descending order)
+*/
+static int topRetainers(lua_State* L)
+{
+	const lua_Integer max_count = luaL_optinteger(L, 1, 10);
+	luaL_argcheck(L, max_count >= 0, 1, "negative count");
+	size_t count = (size_t)max_count;
+	ldv_retainer* retainers = (ldv_retainer*)malloc((count != 0 ? count : 1) * sizeof(ldv_retainer));
+	if (retainers == 0 || ldv_top_retainers(L, retainers, &count) != 0)
+	{
+		free(retainers);
+		return luaL_error(L, "not enough memory for object graph");
+	}
+	lua_createtable(L, (int)count, 0);
+	for (size_t i = 0; i < count; ++i)
+	{
+		lua_createtable(L, 0, 5);
+		lua_pushstring(L, ttypename(novariant(retainers[i].type)));
+		lua_setfield(L, -2, "type");
+		lua_pushfstring(L, "%p", retainers[i].object);
+		lua_setfield(L, -2, "address");
+		lua_pushstring(L, retainers[i].name);
+		lua_setfield(L, -2, "name");
+		lua_pushinteger(L, (lua_Integer)retainers[i].size);
+		lua_setfield(L, -2, "size");
+		lua_pushinteger(L, (lua_Integer)retainers[i].retained);
+		lua_setfield(L, -2, "retained");
+		lua_rawseti(L, -2, (lua_Integer)i + 1);
+	}
+	free(retainers);
+	return 1;
+}
+
+/*
+		Finds long strings, which have same contents (see ldv_duplicate_strings)
+		Params: max count of groups (10 by default)
+		Return: list of { address, length, copies, wasted, sample }, sorted by wasted memory (descending order),
+				wasted memory of all groups
+*/
+static int duplicateStrings(lua_State* L)
+{
+	const lua_Integer max_count = luaL_optinteger(L, 1, 10);
+	luaL_argcheck(L, max_count >= 0, 1, "negative count");
+	size_t count = (size_t)max_count;
+	size_t wasted = 0;
+	ldv_duplicate* duplicates = (ldv_duplicate*)malloc((count != 0 ? count : 1) * sizeof(ldv_duplicate));
+	if (duplicates == 0 || ldv_duplicate_strings(L, duplicates, &count, &wasted) != 0)
+	{
+		free(duplicates);
+		return luaL_error(L, "not enough memory for string groups");
+	}
+	lua_createtable(L, (int)count, 0);
+	for (size_t i = 0; i < count; ++i)
+	{
+		lua_createtable(L, 0, 5);
+		lua_pushfstring(L, "%p", duplicates[i].object);
+		lua_setfield(L, -2, "address");
+		lua_pushinteger(L, (lua_Integer)duplicates[i].length);
+		lua_setfield(L, -2, "length");
+		lua_pushinteger(L, (lua_Integer)duplicates[i].copies);
+		lua_setfield(L, -2, "copies");
+		lua_pushinteger(L, (lua_Integer)duplicates[i].wasted);
+		lua_setfield(L, -2, "wasted");
+		lua_pushstring(L, duplicates[i].sample);
+		lua_setfield(L, -2, "sample");
+		lua_rawseti(L, -2, (lua_Integer)i + 1);
+	}
+	free(duplicates);
+	lua_pushinteger(L, (lua_Integer)wasted);
+	return 2;
+}
+
+/*
+		Pushes shape of table as lua table
+		Params: lua state, shape
+		Return: none
+*/
+static void push_table_shape(lua_State* L, const ldv_table_shape* shape)
+{
+	const struct { const char* name; size_t value; } counters[] =
+	{
+		{ "array_size", shape->array_size },
+		{ "array_used", shape->array_used },
+		{ "node_size", shape->node_size },
+		{ "node_used", shape->node_used },
+		{ "dead_keys", shape->dead_keys },
+		{ "integer_keys", shape->integer_keys },
+		{ "chains", shape->chains },
+		{ "max_chain", shape->max_chain },
+		{ "wasted", shape->wasted }
+	};
+	lua_createtable(L, 0, sizeof(counters) / sizeof(counters[0]) + 2);
+	for (unsigned int i = 0; i < sizeof(counters) / sizeof(counters[0]); ++i)
+	{
+		lua_pushinteger(L, (lua_Integer)counters[i].value);
+		lua_setfield(L, -2, counters[i].name);
+	}
+	lua_pushnumber(L, (lua_Number)shape->average_chain);
+	lua_setfield(L, -2, "average_chain");
+	if (shape->object != NULL)
+	{
+		lua_pushfstring(L, "%p", shape->object);
+		lua_setfield(L, -2, "address");
+	}
+}
+
+/*
+		Measures shape of table (see ldv_get_table_shape)
+		Params: table
+		Return: { address, array_size, array_used, node_size, node_used, dead_keys, integer_keys, chains, max_chain,
+				average_chain, wasted }
+*/
+static int tableShape(lua_State* L)
+{
+	luaL_checktype(L, 1, LUA_TTABLE);
+	ldv_table_shape shape;
+	if (ldv_get_table_shape((const Table*)lua_topointer(L, 1), &shape) != 0)
+		return luaL_error(L, "not enough memory");
+	push_table_shape(L, &shape);
+	return 1;
+}
+
+/*
+		Measures shapes of all tables (see ldv_table_shapes)
+		Params: max count of the worst shaped tables (10 by default)
+		Return: list of shapes (see tableShape), sorted by wasted memory (descending order),
+				totals of all tables (shape without address), count of tables
+*/
+static int tableShapes(lua_State* L)
+{
+	const lua_Integer max_count = luaL_optinteger(L, 1, 10);
+	luaL_argcheck(L, max_count >= 0, 1, "negative count");
+	size_t count = (size_t)max_count;
+	size_t table_count = 0;
+	ldv_table_shape total;
+	ldv_table_shape* shapes = (ldv_table_shape*)malloc((count != 0 ? count : 1) * sizeof(ldv_table_shape));
+	if (shapes == 0 || ldv_table_shapes(L, shapes, &count, &total, &table_count) != 0)
+	{
+		free(shapes);
+		return luaL_error(L, "not enough memory for table shapes");
+	}
+	lua_createtable(L, (int)count, 0);
+	for (size_t i = 0; i < count; ++i)
+	{
+		push_table_shape(L, &shapes[i]);
+		lua_rawseti(L, -2, (lua_Integer)i + 1);
+	}
+	free(shapes);
+	push_table_shape(L, &total);
+	lua_pushinteger(L, (lua_Integer)table_count);
+	return 3;
+}
+/*===========PUBLIC LUA API END==============*/
+
+//              Public functions available from LUA script
+static const luaL_Reg ldv_tab_funcs[] =
+{
+  {"dumpHeap", dumpHeap},
+  {"checkHeap", checkHeap},
+  {"dumpObject", dumpObject},
+  {"checkObjects", checkObjects},
+  {"reallocStats", reallocStats},
+  {"setPoison", setPoison},
+  {"stats", stats},
+  {"fragmentation", fragmentation},
+  {"strtableStats", strtableStats},
+  {"setRelocation", setRelocation},
+  {"setQuarantine", setQuarantine},
+  {"compact", compact},
+  {"setSink", setSink},
+  {"capture", capture},
+  {"setTagging", setTagging},
+  {"tagReport", tagReport},
+  {"setSampling", setSampling},
+  {"resume", resume},
+  {"wrap", wrap},
+  {"samples", samples},
+  {"snapshot", snapshot},
+  {"traceStart", traceStart},
+  {"traceStop", traceStop},
+  {"topRetainers", topRetainers},
+  {"duplicateStrings", duplicateStrings},
+  {"tableShape", tableShape},
+  {"tableShapes", tableShapes},
+  {NULL, NULL}
+};
+
+
+//	Internal helpers
+/*
+		Reserves space in output buffer
+		Params: size of space in bytes (terminating zero excluded)
+		Return: reservation result (zero means out of memory)
+*/
+static int log_reserve(size_t size)
+{
+	if (log_sink.size + size < log_sink.capacity)
+		return 1;
+	size_t capacity = log_sink.capacity != 0 ? log_sink.capacity : LOG_BUFF_SIZE;
+	while (log_sink.size + size >= capacity)
+		capacity *= 2;
+	char* buf = (char*)realloc(log_sink.buf, capacity);
+	if (buf == 0)
+		return 0;
+	log_sink.buf = buf;
+	log_sink.capacity = capacity;
+	return 1;
+}
+
+/*
+		Writes output to target
+		Params: target, output, size of output
+		Return: none
+*/
+static void log_write(const ldv_sink* target, const char* data, size_t size)
+{
+	switch (target->type)
+	{
+		case LDV_SINK_STDOUT:
+		{
+#ifdef _WIN32
+			OutputDebugStringA(data);
+#endif
+			fwrite(data, 1, size, stdout);
+			break;
+		}
+		case LDV_SINK_FILE:
+			fwrite(data, 1, size, target->file);
+			break;
+		case LDV_SINK_FD:
+		{
+			while (size > 0)
+			{
+#ifdef _WIN32
+				const int written = _write(target->fd, data, (unsigned int)size);
+#else
+				const ssize_t written = write(target->fd, data, size);
+#endif
+				if (written <= 0)
+					break;
+				data += written;
+				size -= (size_t)written;
+			}
+			break;
+		}
+		case LDV_SINK_CALLBACK:
+			target->writer(target->ud, data, size);
+			break;
+		case LDV_SINK_MEMORY:
+			break;
+	}
+}
+
+/*
+		Logs message
+		Params: indent value, format message, variadic args
+		Return: none
+*/
+static void ldv_log(const int indent, const char* format, ...)
+{
+	if (log_sink.limit != 0 && log_sink.written >= log_sink.limit)
+	{
+		log_sink.truncated = 1;
+		return;
+	}
+	if (!log_reserve(indent + OUT_BUFF_SIZE))
+		return;
+	char* out_buff = log_sink.buf + log_sink.size;
+	for (int i = 0; i < indent; ++i)
+		out_buff[i] = ' ';
+	const size_t room = log_sink.capacity - log_sink.size - indent;
+	va_list args;
+	va_list retry_args;
+	va_start (args, format);
+	va_copy (retry_args, args);
+	int length = vsnprintf(out_buff + indent, room, format, args);
+	if (length > 0 && (size_t)length >= room)
+	{
+		/*	Message does not fit buffer: buffer grows and message is formatted again	*/
+		if (log_reserve(indent + length))
+			vsnprintf(log_sink.buf + log_sink.size + indent, length + 1, format, retry_args);
+		else
+			length = (int)room - 1;
+	}
+	va_end (retry_args);
+	va_end (args);
+	size_t message_size = indent + (length > 0 ? length : 0);
+	if (log_sink.limit != 0 && log_sink.written + message_size > log_sink.limit)
+	{
+		message_size = log_sink.limit - log_sink.written;
+		log_sink.truncated = 1;
+	}
+	log_sink.size += message_size;
+	log_sink.written += message_size;
+	log_sink.buf[log_sink.size] = 0;
+	if (log_sink.size - log_sink.base >= LOG_FLUSH_SIZE || (log_sink.batch_depth == 0 && log_sink.size != log_sink.base && log_sink.buf[log_sink.size - 1] == '\n'))
+		ldv_log_flush();
+}
+
+/*
+		Finds slot of region, which holds pointer, in region table of heap (binary search by addresses)
+		Params: heap, pointer
+		Return: slot of region (count of regions - pointer is not in heap)
+*/
+static unsigned int region_slot(const ldv_heap* heap, const void* ptr)
+{
+	unsigned int low = 0;
+	unsigned int high = heap->region_count;
+	while (low < high)
+	{
+		const unsigned int middle = (low + high) / 2;
+		const HeapRegion* region = heap->region_table[middle];
+		if (ptr < (const void*)region->mem)
+			high = middle;
+		else if (ptr >= (const void*)(region->mem + region->size))
+			low = middle + 1;
+		else
+			return middle;
+	}
+	return heap->region_count;
+}
+
+/*
+		Finds heap region, which holds memory
+		Params: heap, pointer
+		Return: heap region (0 if pointer is out of heap)
+*/
+static HeapRegion* find_region(const ldv_heap* heap, const void* ptr)
+{
+	const unsigned int slot = region_slot(heap, ptr);
+	return slot < heap->region_count ? heap->region_table[slot] : 0;
+}
+
+/*
+		Checks, whether ptr is valid
+		Params: heap, pointer
+		Return: valid flag (zero means not valid ptr)
+*/
+static int check_ptr(const ldv_heap* heap, const void* ptr)
+{
+	const int check_res = find_region(heap, ptr) != 0;
+	LDV_ASSERT(check_res)
+	return check_res;
+}
+
+/*
+		Gets first slot of slab page
+		Params: slab page
+		Return: first slot
+*/
+static unsigned char* slab_slots(const SlabPage* page)
+{
+	return (unsigned char*)page + (sizeof(SlabPage) + SLAB_ALIGN - 1) / SLAB_ALIGN * SLAB_ALIGN;
+}
+
+/*
+		Finds slab page, which holds memory
+		Params: heap, pointer
+		Return: slab page (0 if pointer is out of slab pages)
+*/
+static SlabPage* find_slab_page(const ldv_heap* heap, const void* ptr)
+{
+	unsigned int low = 0;
+	unsigned int high = heap->slab_page_count;
+	while (low < high)
+	{
+		const unsigned int middle = (low + high) / 2;
+		SlabPage* page = heap->slab_pages[middle];
+		if (ptr < (const void*)slab_slots(page))
+			high = middle;
+		else if (ptr >= (const void*)((unsigned char*)page + SLAB_PAGE_BYTES))
+			low = middle + 1;
+		else
+			return page;
+	}
+	return 0;
+}
+
+/*
+		Checks, whether pointer is allocated slot of slab page
+		Params: slab page, pointer
+		Return: check result
+*/
+static int slab_slot_used(const SlabPage* page, const void* ptr)
+{
+	const size_t offset = (size_t)((const unsigned char*)ptr - slab_slots(page));
+	const size_t slot = offset / page->slot_size;
+	if (offset % page->slot_size != 0 || slot >= page->slot_count)
+		return 0;
+	return (page->slot_map[slot / 32] & ((ldv_block_type)1 << (slot % 32))) != 0;
+}
+
+/*
+		Checks, whether block is lied within memory pool
+		Params: heap region, block
+		Return: check result
+*/
+static int valid_block(const HeapRegion* region, ldv_block_type* block)
+{
+	return region->mem <= block && block < region->mem + region->size;
+}
+
+/*
+		Gets data mask, which defines data layout in block info
+		Params: none
+		Return: block data mask
+*/
+static ldv_block_type block_data_mask(void)
+{
+	return (1 << (sizeof(ldv_block_type) * 8) - 1) - 1;
+}
+
+/*
+		Gets block flag mask
+		Params: none
+		Return: block flag mask
+*/
+static ldv_block_type block_flag_mask(void)
+{
+	return 1 << (sizeof(ldv_block_type) * 8 - 1);
+}
+
+/*
+        Sets next/prev head to BlockHead
+        Params: heap region, blocks info, head type, index
+        Return: none
+*/
+static void set_head(const HeapRegion* region, BlockHead* binfo, HeadType head_type, ldv_block_type head)
+{
+	LDV_ASSERT(valid_block(region, RAW_MEMORY(binfo)))
+	const int data_mask = block_data_mask();
+	const int flag_mask = block_flag_mask();
+	const ldv_block_type cl_head = head & data_mask;
+	if (head_type == NextHead)
+	{
+		binfo->next_index = (valid_block(region, RAW_MEMORY(binfo) + cl_head) ? flag_mask : 0) | cl_head;
+	}
+	else
+	{
+		binfo->prev_index = (valid_block(region, RAW_MEMORY(binfo) - cl_head) ? cl_head : 0) | (flag_mask & binfo->prev_index);
+	}
+}
+
+/*
+		Gets head of head type
+		Params: block head, head type
+		Return: head of head type
+*/
+static ldv_block_type get_head_offset(BlockHead* bhead, HeadType head_type)
+{
+	int data_mask = block_data_mask();
+	return head_type == NextHead ? bhead->next_index & data_mask : bhead->prev_index & data_mask;
+}
+
+/*
+		Marks words of block with specific label according to poisoning policy of heap
+		Params: heap region, block info, first word, end word, label type
+		Return: none
+*/
+static void mark_words(const HeapRegion* region, BlockHead* bhead, const ldv_block_type first, ldv_block_type end, const UserDataLabel label)
+{
+	LDV_ASSERT(valid_block(region, RAW_MEMORY(bhead)))
+	const ldv_poison_mode poison_mode = region->heap->poison_mode;
+	if (poison_mode == LDV_POISON_OFF)
+		return;
+	if (poison_mode == LDV_POISON_HEADER && end > 2 + POISON_HEADER_WORDS)
+		end = 2 + POISON_HEADER_WORDS;
+	if (first >= end)
+		return;
+	ldv_block_type* p = RAW_MEMORY(bhead);
+	LDV_ASSERT(valid_block(region, p + end - 1))
+	memset(p + first, (unsigned char)(label == Allocated ? ALLOC_MASK : FREE_MASK), (end - first) * sizeof(ldv_block_type));
+}
+
+/*
+		Marks block with specific label
+		Params: heap region, block info, label type
+		Return: none
+*/
+static void mark_block(const HeapRegion* region, BlockHead* bhead, const UserDataLabel label)
+{
+	mark_words(region, bhead, 2, get_head_offset(bhead, NextHead), label);
+}
+
+/*
+		Computes hold data size in bytes
+		Params: block head
+		Return: size of block head data
+*/
+static ldv_block_type data_size(BlockHead* bhead)
+{
+	return ((bhead->next_index & block_data_mask()) - 2) * sizeof(ldv_block_type);
+}
+
+/*
+        Gets status of current state type
+        Params: block info, state type
+        Return: state status
+*/
+StateStatus status(BlockHead* binfo, StateType flag)
+{
+	int mask = block_flag_mask();
+	switch (flag)
+	{
+		case DataState:
+			return binfo->prev_index & mask ? Gem : Garbage;
+		case NextHeadState:
+			return binfo->next_index & mask ? MiddleHead : MarginHead;
+		case PrevHeadState:
+			return (binfo->prev_index & (~mask)) != 0 ? MiddleHead : MarginHead;
+	}
+	return Error;
+}
+
+/*
+		Sets state status of block head
+		Params: block head
+		Return: none
+*/
+void set_status(BlockHead* binfo, StateStatus status)
+{
+	int mask = block_flag_mask();
+	switch (status)
+	{
+		case Gem:
+			binfo->prev_index = binfo->prev_index | mask;
+			break;
+		case Garbage:
+			binfo->prev_index = binfo->prev_index & (~mask);
+			break;
+		default:
+			/*	TODO: (alex) add assertion here?	*/
+			break;
+	}
+}
+
+/*
+		Gets block head with given offset
+		Params: block, offset type, block offset
+		Return: offset block head
+*/
+static BlockHead* raw_move_head(BlockHead* head, HeadType head_type, ldv_block_type offset)
+{
+	if (head_type == NextHead)
+		return (BlockHead*)(RAW_MEMORY(head) + offset);
+	return (BlockHead*)(RAW_MEMORY(head) - offset);
+}
+
+/*
+		Gets index of highest set bit
+		Params: value (not zero)
+		Return: bit index
+*/
+static unsigned int highest_bit(ldv_block_type value)
+{
+	LDV_ASSERT(value != 0)
+#if defined(__GNUC__)
+	return sizeof(unsigned int) * 8 - 1 - __builtin_clz(value);
+#else
+	unsigned int index = 0;
+	while (value >>= 1)
+		++index;
+	return index;
+#endif
+}
+
+/*
+		Gets index of lowest set bit
+		Params: value (not zero)
+		Return: bit index
+*/
+static unsigned int lowest_bit(ldv_block_type value)
+{
+	LDV_ASSERT(value != 0)
+#if defined(__GNUC__)
+	return __builtin_ctz(value);
+#else
+	unsigned int index = 0;
+	while ((value & 1) == 0)
+	{
+		value >>= 1;
+		++index;
+	}
+	return index;
+#endif
+}
+
+/*
+		Gets size of block in words (head included)
+		Params: block head
+		Return: size of block in words
+*/
+static ldv_block_type block_words(BlockHead* bhead)
+{
+	return get_head_offset(bhead, NextHead);
+}
+
+/*
+		Computes size of block (in words), which is able to hold data of given size
+		Params: size of data in bytes
+		Return: size of block in words
+*/
+static ldv_block_type fit_words(size_t nsize)
+{
+	const size_t words = 2 + nsize / sizeof(ldv_block_type) + (nsize % sizeof(ldv_block_type) == 0 ? 0 : 1);
+	return words < MIN_BLOCK_WORDS ? MIN_BLOCK_WORDS : (ldv_block_type)words;
+}
+
+/*
+		Gets bin of free block with given size. Power of two range of large sizes is split into
+		2^LARGE_SPLIT_BITS bins by the bits, which follow the highest bit of size
+		Params: size of block in words
+		Return: bin index
+*/
+static unsigned int bin_index(ldv_block_type words)
+{
+	LDV_ASSERT(words >= MIN_BLOCK_WORDS)
+	if (words < SMALL_BIN_LIMIT)
+		return words - MIN_BLOCK_WORDS;
+	const unsigned int high_bit = highest_bit(words);
+	const unsigned int range = high_bit - highest_bit(SMALL_BIN_LIMIT);
+	if (range >= LARGE_RANGE_COUNT)
+		return BIN_COUNT - 1;
+	const unsigned int part = (words >> (high_bit - LARGE_SPLIT_BITS)) & ((1u << LARGE_SPLIT_BITS) - 1);
+	return SMALL_BIN_COUNT + (range << LARGE_SPLIT_BITS) + part;
+}
+
+/*
+		Gets block head by index in heap region
+		Params: heap region, block index
+		Return: block head
+*/
+static BlockHead* index_head(const HeapRegion* region, ldv_block_type index)
+{
+	return (BlockHead*)(region->mem + index);
+}
+
+/*
+		Gets index of block head in heap region
+		Params: heap region, block head
+		Return: block index
+*/
+static ldv_block_type head_index(const HeapRegion* region, BlockHead* bhead)
+{
+	return (ldv_block_type)(RAW_MEMORY(bhead) - region->mem);
+}
+
+/*
+		Computes size of bitmap of gem block heads
+		Params: heap region
+		Return: size of bitmap in bytes
+*/
+static size_t live_map_size(const HeapRegion* region)
+{
+	return ((size_t)region->size + 31) / 32 * sizeof(ldv_block_type);
+}
+
+/*
+		Marks head of block in bitmap of gem block heads
+		Params: heap region, block head, flag, whether block is gem
+		Return: none
+*/
+static void set_block_live(const HeapRegion* region, BlockHead* bhead, const int live)
+{
+	const ldv_block_type index = head_index(region, bhead);
+	const ldv_block_type bit = (ldv_block_type)1 << (index % 32);
+	if (live)
+		region->live_map[index / 32] |= bit;
+	else
+		region->live_map[index / 32] &= ~bit;
+}
+
+/*
+		Checks, whether word of region is head of gem block
+		Params: heap region, index of word
+		Return: check result
+*/
+static int block_live(const HeapRegion* region, const ldv_block_type index)
+{
+	return (region->live_map[index / 32] & ((ldv_block_type)1 << (index % 32))) != 0;
+}
+
+/*
+		Checks data, pointed with "sized" ptr
+		Params: heap, pointer to raw data, min size of data
+		Return: check result
+*/
+static int check_sized_ptr(const ldv_heap* heap, const void* ptr, const size_t min_size)
+{
+	const SlabPage* page = find_slab_page(heap, ptr);
+	if (page != 0)
+	{
+		const int check_slot = slab_slot_used(page, ptr) && page->slot_size >= min_size;
+		LDV_ASSERT(check_slot)
+		return check_slot;
+	}
+	/*	Pointer has to be payload of gem block: its head is looked up in bitmap of gem block heads	*/
+	const HeapRegion* region = find_region(heap, ptr);
+	const size_t offset = region != 0 ? (size_t)((const unsigned char*)ptr - (const unsigned char*)region->mem) : 0;
+	const int check_location = region != 0 && offset % sizeof(ldv_block_type) == 0 && offset >= 2 * sizeof(ldv_block_type)
+		&& block_live(region, (ldv_block_type)(offset / sizeof(ldv_block_type) - 2));
+	LDV_ASSERT(check_location)
+	if (!check_location)
+		return 0;
+	ldv_block_type* raw_data = RAW_MEMORY(ptr) - 2;
+	const ldv_block_type next = get_head_offset((BlockHead*)raw_data, NextHead);
+	const int check_size = next * sizeof(ldv_block_type) >= min_size + sizeof(ldv_block_type) * 2;
+	LDV_ASSERT(check_size)
+	return check_size;
+}
+
+/*
+		Gets free list links of garbage block
+		Params: block head
+		Return: free list links
+*/
+static FreeLinks* free_links(BlockHead* bhead)
+{
+	return (FreeLinks*)(RAW_MEMORY(bhead) + 2);
+}
+
+/*
+		Copies size of the largest garbage block of region to tree of regions of its heap
+		Params: heap region
+		Return: none
+*/
+static void region_tree_update(const HeapRegion* region)
+{
+	ldv_heap* heap = region->heap;
+	if (heap == 0 || region->rank >= heap->region_leaves)
+		return;
+	unsigned int node = heap->region_leaves + region->rank;
+	heap->region_largest[node] = region->largest_free;
+	for (node /= 2; node != 0; node /= 2)
+	{
+		const ldv_block_type left = heap->region_largest[node * 2];
+		const ldv_block_type right = heap->region_largest[node * 2 + 1];
+		heap->region_largest[node] = left > right ? left : right;
+	}
+}
+
+/*
+		Marks bin as empty/non empty in bins bitmap
+		Params: heap region, bin index
+		Return: none
+*/
+static void update_bin_map(HeapRegion* region, unsigned int bin)
+{
+	const ldv_block_type bit = (ldv_block_type)1 << (bin % 32);
+	if (region->bin_heads[bin] == NO_BLOCK)
+		region->bin_map[bin / 32] &= ~bit;
+	else
+		region->bin_map[bin / 32] |= bit;
+}
+
+/*
+		Inserts garbage block at the head of its free list (constant time)
+		Params: heap region, block head
+		Return: none
+*/
+static void bin_insert(HeapRegion* region, BlockHead* bhead)
+{
+	const ldv_block_type words = block_words(bhead);
+	const unsigned int bin = bin_index(words);
+	const ldv_block_type index = head_index(region, bhead);
+	const ldv_block_type next = region->bin_heads[bin];
+	FreeLinks* links = free_links(bhead);
+	links->prev_free = NO_BLOCK;
+	links->next_free = next;
+	region->bin_heads[bin] = index;
+	if (next == NO_BLOCK)
+		region->bin_tails[bin] = index;
+	else
+		free_links(index_head(region, next))->prev_free = index;
+	update_bin_map(region, bin);
+	++region->free_blocks;
+	region->free_words += words;
+	/*	Size, which is stale, stays upper bound of sizes of blocks	*/
+	if (words > region->largest_free)
+	{
+		region->largest_free = words;
+		region_tree_update(region);
+	}
+}
+
+/*
+		Removes garbage block from its free list (constant time)
+		Params: heap region, block head
+		Return: none
+*/
+static void bin_remove(HeapRegion* region, BlockHead* bhead)
+{
+	const ldv_block_type words = block_words(bhead);
+	const unsigned int bin = bin_index(words);
+	FreeLinks* links = free_links(bhead);
+	if (links->prev_free == NO_BLOCK)
+		region->bin_heads[bin] = links->next_free;
+	else
+		free_links(index_head(region, links->prev_free))->next_free = links->next_free;
+	if (links->next_free == NO_BLOCK)
+		region->bin_tails[bin] = links->prev_free;
+	else
+		free_links(index_head(region, links->next_free))->prev_free = links->prev_free;
+	update_bin_map(region, bin);
+	--region->free_blocks;
+	region->free_words -= words;
+	if (words == region->largest_free)
+		region->largest_stale = 1;
+}
+
+/*
+		Rebuilds free lists from heap region layout
+		Params: heap region
+		Return: none
+*/
+static void rebuild_bins(HeapRegion* region)
+{
+	for (unsigned int i = 0; i < BIN_COUNT; ++i)
+	{
+		region->bin_heads[i] = NO_BLOCK;
+		region->bin_tails[i] = NO_BLOCK;
+	}
+	for (unsigned int i = 0; i < BIN_MAP_SIZE; ++i)
+		region->bin_map[i] = 0;
+	region->free_blocks = 0;
+	region->free_words = 0;
+	region->largest_free = 0;
+	region->largest_stale = 0;
+	BlockHead* start_head = (BlockHead*)region->mem;
+	for (;;)
+	{
+		if (status(start_head, DataState) == Garbage)
+			bin_insert(region, start_head);
+		if (status(start_head, NextHeadState) == MarginHead)
+			break;
+		start_head = raw_move_head(start_head, NextHead, get_head_offset(start_head, NextHead));
+	}
+	region->bins_ready = 1;
+	region_tree_update(region);
+}
+
+/*
+		Gets size of the largest garbage block of heap region. Size is kept by free lists, it is rescanned only,
+		when the largest block was taken from free lists since last call. Rescanned size is copied to tree of regions
+		Params: heap region
+		Return: size of block in words (0 - no garbage blocks)
+*/
+static ldv_block_type largest_free_words(HeapRegion* region)
+{
+	if (!region->largest_stale)
+		return region->largest_free;
+	region->largest_stale = 0;
+	region->largest_free = 0;
+	for (unsigned int map_index = BIN_MAP_SIZE; map_index-- > 0; )
+	{
+		if (region->bin_map[map_index] == 0)
+			continue;
+		const unsigned int bin = map_index * 32 + highest_bit(region->bin_map[map_index]);
+		if (bin < SMALL_BIN_COUNT)
+		{
+			region->largest_free = bin + MIN_BLOCK_WORDS;
+			break;
+		}
+		/*	Large bins are not sorted, so the largest block is searched in the highest bin only	*/
+		for (ldv_block_type index = region->bin_heads[bin]; index != NO_BLOCK; index = free_links(index_head(region, index))->next_free)
+		{
+			if (block_words(index_head(region, index)) > region->largest_free)
+				region->largest_free = block_words(index_head(region, index));
+		}
+		break;
+	}
+	region_tree_update(region);
+	return region->largest_free;
+}
+
+/*
+		Resets heap region to single garbage block
+		Params: heap region
+		Return: none
+*/
+static void reset_region(HeapRegion* region)
+{
+	memset(region->live_map, 0, live_map_size(region));
+	region->quarantine_blocks = 0;
+	BlockHead* bhead = (BlockHead*)region->mem;
+	bhead->prev_index = 0;
+	set_head(region, bhead, NextHead, region->size);
+	rebuild_bins(region);
+}
+
+/*
+		Reserves memory for heap region from system
+		Params: size of memory in words
+		Return: reserved memory (0 on failure)
+*/
+static ldv_block_type* reserve_memory(ldv_block_type words)
+{
+	const size_t bytes = (size_t)words * sizeof(ldv_block_type);
+#if defined(_WIN32)
+	return (ldv_block_type*)VirtualAlloc(NULL, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+	void* mem = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return mem == MAP_FAILED ? 0 : (ldv_block_type*)mem;
+#endif
+}
+
+/*
+		Releases memory of heap region to system
+		Params: memory, size of memory in words
+		Return: none
+*/
+static void release_memory(ldv_block_type* mem, ldv_block_type words)
+{
+#if defined(_WIN32)
+	LDV_UNUSED(words)
+	VirtualFree(mem, 0, MEM_RELEASE);
+#else
+	munmap(mem, (size_t)words * sizeof(ldv_block_type));
+#endif
+}
+
+/*
+		Computes size of all heap regions
+		Params: heap
+		Return: size of heap in bytes
+*/
+static size_t heap_size(const ldv_heap* heap)
+{
+	size_t size = 0;
+	for (HeapRegion* region = heap->regions; region != 0; region = region->next)
+		size += (size_t)region->size * sizeof(ldv_block_type);
+	return size;
+}
+
+/*
+		Attaches region to the end of heap regions and resets its layout
+		Params: heap, heap region
+		Return: error code (0 - success)
+*/
+static int attach_region(ldv_heap* heap, HeapRegion* region)
+{
+	region->live_map = (ldv_block_type*)malloc(live_map_size(region));
+	HeapRegion** table = (HeapRegion**)malloc((heap->region_count + 1) * sizeof(HeapRegion*));
+	/*	Tree of the largest garbage blocks grows by doubling of leaves	*/
+	unsigned int leaves = heap->region_leaves != 0 ? heap->region_leaves : 1;
+	while (leaves < heap->region_count + 1)
+		leaves *= 2;
+	const int grown = leaves != heap->region_leaves;
+	ldv_block_type* largest = grown ? (ldv_block_type*)calloc((size_t)leaves * 2, sizeof(ldv_block_type)) : heap->region_largest;
+	HeapRegion** ranks = grown ? (HeapRegion**)calloc(leaves, sizeof(HeapRegion*)) : heap->region_ranks;
+	if (table == 0 || region->live_map == 0 || largest == 0 || ranks == 0)
+	{
+		free(table);
+		free(region->live_map);
+		region->live_map = 0;
+		if (grown)
+		{
+			free(largest);
+			free(ranks);
+		}
+		return 1;
+	}
+	if (grown)
+	{
+		for (unsigned int i = 0; i < heap->region_count; ++i)
+		{
+			largest[leaves + i] = heap->region_largest[heap->region_leaves + i];
+			ranks[i] = heap->region_ranks[i];
+		}
+		for (unsigned int node = leaves; node-- > 1; )
+			largest[node] = largest[node * 2] > largest[node * 2 + 1] ? largest[node * 2] : largest[node * 2 + 1];
+		free(heap->region_largest);
+		free(heap->region_ranks);
+		heap->region_largest = largest;
+		heap->region_ranks = ranks;
+		heap->region_leaves = leaves;
+	}
+	region->rank = heap->region_count;
+	ranks[region->rank] = region;
+	unsigned int position = 0;
+	while (position < heap->region_count && heap->region_table[position]->mem < region->mem)
+		++position;
+	for (unsigned int i = 0; i < position; ++i)
+		table[i] = heap->region_table[i];
+	table[position] = region;
+	for (unsigned int i = position; i < heap->region_count; ++i)
+		table[i + 1] = heap->region_table[i];
+	free(heap->region_table);
+	heap->region_table = table;
+	++heap->region_count;
+	region->heap = heap;
+	region->next = 0;
+	HeapRegion** last = &heap->regions;
+	while (*last != 0)
+		last = &(*last)->next;
+	*last = region;
+	reset_region(region);
+	return 0;
+}
+
+/*
+		Adds new region to the end of heap regions
+		Params: heap, size of region in bytes
+		Return: added region (0 on failure)
+*/
+static HeapRegion* add_region(ldv_heap* heap, size_t bytes)
+{
+	size_t words = (bytes + sizeof(ldv_block_type) - 1) / sizeof(ldv_block_type);
+	if (words < MIN_BLOCK_WORDS)
+		words = MIN_BLOCK_WORDS;
+	if (words > MAX_REGION_SIZE)
+		return 0;
+	if (heap->limit != 0 && heap_size(heap) + words * sizeof(ldv_block_type) > heap->limit)
+		return 0;
+	HeapRegion* region = (HeapRegion*)calloc(1, sizeof(HeapRegion));
+	if (region == 0)
+		return 0;
+	region->mem = reserve_memory((ldv_block_type)words);
+	region->size = (ldv_block_type)words;
+	region->reserved = 1;
+	if (region->mem == 0 || attach_region(heap, region) != 0)
+	{
+		if (region->mem != 0)
+			release_memory(region->mem, region->size);
+		free(region);
+		return 0;
+	}
+	return region;
+}
+
+/*
+		Forgets all slab pages of heap (memory of pages is supposed to be released or reset)
+		Params: heap
+		Return: none
+*/
+static void slab_reset(ldv_heap* heap)
+{
+	free(heap->slab_pages);
+	heap->slab_pages = 0;
+	heap->slab_page_count = 0;
+	heap->slab_page_capacity = 0;
+	for (unsigned int i = 0; i < SLAB_CLASS_COUNT; ++i)
+		heap->slab_partial[i] = 0;
+}
+
+/*
+		Forgets quarantined blocks (blocks of heap are supposed to be released)
+		Params: heap
+		Return: none
+*/
+static void quarantine_reset(ldv_heap* heap)
+{
+	heap->quarantine.first = 0;
+	heap->quarantine.count = 0;
+	heap->quarantine.bytes = 0;
+}
+
+/*
+		Releases all regions of heap
+		Params: heap
+		Return: none
+*/
+static void release_regions(ldv_heap* heap)
+{
+	while (heap->regions != 0)
+	{
+		HeapRegion* region = heap->regions;
+		heap->regions = region->next;
+		free(region->live_map);
+		region->live_map = 0;
+		if (region->reserved)
+		{
+			release_memory(region->mem, region->size);
+			free(region);
+		}
+	}
+	free(heap->region_table);
+	heap->region_table = 0;
+	heap->region_count = 0;
+	free(heap->region_largest);
+	free(heap->region_ranks);
+	heap->region_largest = 0;
+	heap->region_ranks = 0;
+	heap->region_leaves = 0;
+	slab_reset(heap);
+	quarantine_reset(heap);
+}
+
+/*
+		Merges block with next block. Next block is supposed to be removed from free lists
+		Params: heap region, block head
+		Return: none
+*/
+static void merge_next_head(const HeapRegion* region, BlockHead* bhead)
+{
+	const ldv_block_type next_offset = get_head_offset(bhead, NextHead);
+	BlockHead* next_head = raw_move_head(bhead, NextHead, next_offset);
+	const ldv_block_type next_next_offset = get_head_offset(next_head, NextHead);
+	set_head(region, bhead, NextHead, next_offset + next_next_offset);
+	if (status(next_head, NextHeadState) == MiddleHead)
+	{
+		set_head(region, raw_move_head(bhead, NextHead, next_offset + next_next_offset), PrevHead, next_offset + next_next_offset);
+	}
+}
+
+/*
+		Merges garbage block with garbage neighbours. Only heads and free list links
+		of merged neighbours are marked, their payload is already marked as free
+		Params: heap region, garbage block head (not in free lists)
+		Return: head of merged block
+*/
+static BlockHead* coalesce_block(HeapRegion* region, BlockHead* bhead)
+{
+	if (status(bhead, NextHeadState) == MiddleHead)
+	{
+		const ldv_block_type words = block_words(bhead);
+		BlockHead* next_head = raw_move_head(bhead, NextHead, words);
+		if (status(next_head, DataState) == Garbage)
+		{
+			bin_remove(region, next_head);
+			merge_next_head(region, bhead);
+			mark_words(region, bhead, words, words + MIN_BLOCK_WORDS, Free);
+		}
+	}
+	if (status(bhead, PrevHeadState) == MiddleHead)
+	{
+		BlockHead* prev_head = raw_move_head(bhead, PrevHead, get_head_offset(bhead, PrevHead));
+		if (status(prev_head, DataState) == Garbage)
+		{
+			const ldv_block_type prev_words = block_words(prev_head);
+			bin_remove(region, prev_head);
+			merge_next_head(region, prev_head);
+			mark_words(region, prev_head, prev_words, prev_words + 2, Free);
+			bhead = prev_head;
+		}
+	}
+	return bhead;
+}
+
+/*
+		Frees memory allocated via ldv_malloc
+		Params: heap, pointer to memory
+		Return: none
+*/
+static void ldv_free(ldv_heap* heap, void* ptr)
+{
+	if (ptr == NULL)
+		return;
+	HeapRegion* region = find_region(heap, ptr);
+	LDV_ASSERT(region != 0)
+	BlockHead* b_info = (BlockHead*)(RAW_MEMORY(ptr) - 2);
+	set_status(b_info, Garbage);
+	set_block_live(region, b_info, 0);
+	mark_block(region, b_info, Free);
+	bin_insert(region, coalesce_block(region, b_info));
+}
+
+/*
+		Finds fitted memory to alloc within heap region. Small bins give exact fit. Large bins give good fit: the head
+		of bin of size is tried, then the first block of the next non empty bin (found by bitmap). Block of the next
+		non empty bin is not bounded by needed size, it is split by take_block. Both steps take constant time,
+		bin of size is walked only, when no larger block is left
+		Params: heap region, fit size
+		Return: pointer to free memory
+*/
+static BlockHead* find_fit_head(HeapRegion* region, size_t nsize)
+{
+	if (!region->bins_ready)
+		rebuild_bins(region);
+	const ldv_block_type words = fit_words(nsize);
+	const unsigned int bin = bin_index(words);
+	const ldv_block_type first = region->bin_heads[bin];
+	if (first != NO_BLOCK && block_words(index_head(region, first)) >= words)
+		return index_head(region, first);
+	const unsigned int next_bin = bin + 1;
+	for (unsigned int map_index = next_bin / 32; map_index < BIN_MAP_SIZE; ++map_index)
+	{
+		ldv_block_type map = region->bin_map[map_index];
+		if (map_index == next_bin / 32)
+			map &= ~(((ldv_block_type)1 << (next_bin % 32)) - 1);
+		if (map != 0)
+			return index_head(region, region->bin_heads[map_index * 32 + lowest_bit(map)]);
+	}
+	for (ldv_block_type index = first; index != NO_BLOCK; index = free_links(index_head(region, index))->next_free)
+	{
+		if (block_words(index_head(region, index)) >= words)
+			return index_head(region, index);
+	}
+	return 0;
+}
+
+/*
+		Cuts tail of block to new garbage block
+		Params: heap region, block head, new size of block in words
+		Return: cut tail (0 if block was not split)
+*/
+static BlockHead* split_block(const HeapRegion* region, BlockHead* bhead, const ldv_block_type words)
+{
+	const ldv_block_type block_size = block_words(bhead);
+	/*	Tail, which is not able to hold free list links, stays within block	*/
+	if (block_size < words + MIN_BLOCK_WORDS)
+		return 0;
+	BlockHead* tail = raw_move_head(bhead, NextHead, words);
+	set_status(tail, Garbage);
+	set_head(region, tail, NextHead, block_size - words);
+	if (status(tail, NextHeadState) == MiddleHead)
+	{
+		set_head(region, raw_move_head(bhead, NextHead, block_size), PrevHead, block_size - words);
+	}
+	set_head(region, bhead, NextHead, words);
+	set_head(region, tail, PrevHead, words);
+	return tail;
+}
+
+/*
+		Turns fitted garbage block to gem block. Tail of block, which is not needed, stays garbage
+		Params: heap region, fitted garbage block, size of needed memory
+		Return: pointer to memory
+*/
+static void* take_block(HeapRegion* region, BlockHead* fit_head, size_t nsize)
+{
+	bin_remove(region, fit_head);
+	set_status(fit_head, Gem);
+	set_block_live(region, fit_head, 1);
+	BlockHead* tail = split_block(region, fit_head, fit_words(nsize));
+	if (tail != 0)
+		bin_insert(region, tail);
+	mark_block(region, fit_head, Allocated);
+	return RAW_MEMORY(fit_head) + 2;
+}
+
+/*
+		Finds the first region in heap order, which largest garbage block may fit size (tree of regions is descended)
+		Params: heap, size in words
+		Return: heap region (0 - no region fits)
+*/
+static HeapRegion* first_fit_region(const ldv_heap* heap, ldv_block_type words)
+{
+	if (heap->region_leaves == 0 || heap->region_largest[1] < words)
+		return 0;
+	unsigned int node = 1;
+	while (node < heap->region_leaves)
+		node = heap->region_largest[node * 2] >= words ? node * 2 : node * 2 + 1;
+	return heap->region_ranks[node - heap->region_leaves];
+}
+
+/*
+		Finds fitted memory to alloc within heap region, which is found by tree of regions. Stale size of
+		the largest block of region is rescanned, so region, which does not fit, is not found again
+		Params: heap region, fit size
+		Return: pointer to free memory (0 - region has no fitted block)
+*/
+static BlockHead* region_fit_head(HeapRegion* region, size_t nsize)
+{
+	if (!region->bins_ready)
+		rebuild_bins(region);
+	if (largest_free_words(region) < fit_words(nsize))
+		return 0;
+	return find_fit_head(region, nsize);
+}
+
+/*
+		Allocates memory with size. The first region in heap order, which is able to hold memory, is found
+		by tree of the largest garbage blocks of regions. Heap grows by new region, if no region is able to hold memory
+		Params: heap, size of needed memory
+		Return: none
+*/
+static void* ldv_malloc(ldv_heap* heap, size_t nsize)
+{
+	if ((size_t)MAX_REGION_SIZE * sizeof(ldv_block_type) <= nsize)
+		return 0;
+	const ldv_block_type words = fit_words(nsize);
+	HeapRegion* region = 0;
+	BlockHead* fit_head = 0;
+	while (fit_head == 0 && (region = first_fit_region(heap, words)) != 0)
+		fit_head = region_fit_head(region, nsize);
+	if (fit_head == 0)
+	{
+		const size_t need_bytes = (size_t)fit_words(nsize) * sizeof(ldv_block_type);
+		region = add_region(heap, need_bytes > heap->region_bytes ? need_bytes : heap->region_bytes);
+		if (region == 0)
+			return 0;
+		fit_head = find_fit_head(region, nsize);
+	}
+	return take_block(region, fit_head, nsize);
+}
+
+/*
+		Resizes block in place: shrinking cuts tail, growing absorbs next garbage block
+		Params: heap, pointer to memory, new size
+		Return: resize result (zero means block has to be moved)
+*/
+static int ldv_resize(ldv_heap* heap, void* ptr, size_t nsize)
+{
+	HeapRegion* region = find_region(heap, ptr);
+	LDV_ASSERT(region != 0)
+	if ((size_t)MAX_REGION_SIZE * sizeof(ldv_block_type) <= nsize)
+		return 0;
+	BlockHead* b_info = (BlockHead*)(RAW_MEMORY(ptr) - 2);
+	const ldv_block_type words = block_words(b_info);
+	const ldv_block_type need_words = fit_words(nsize);
+	if (need_words > words)
+	{
+		if (status(b_info, NextHeadState) == MarginHead)
+			return 0;
+		BlockHead* next_head = raw_move_head(b_info, NextHead, words);
+		if (status(next_head, DataState) != Garbage || words + block_words(next_head) < need_words)
+			return 0;
+		bin_remove(region, next_head);
+		merge_next_head(region, b_info);
+	}
+	BlockHead* tail = split_block(region, b_info, need_words);
+	if (tail != 0)
+	{
+		mark_words(region, tail, 2, words > need_words ? words - need_words : 0, Free);
+		bin_insert(region, coalesce_block(region, tail));
+	}
+	if (need_words > words)
+		mark_words(region, b_info, words, block_words(b_info), Allocated);
+	return 1;
+}
+
+/*
+		Gets end of payload of heap block
+		Params: pointer to memory
+		Return: end of block
+*/
+static unsigned char* block_end(void* ptr)
+{
+	BlockHead* bhead = (BlockHead*)(RAW_MEMORY(ptr) - 2);
+	return (unsigned char*)(RAW_MEMORY(bhead) + block_words(bhead));
+}
+
+/*
+		Finds the first byte of memory, which differs from fill pattern. Aligned memory is compared by words
+		Params: first byte, end of memory, pattern (same byte in every position)
+		Return: first damaged byte (NULL - memory holds pattern)
+*/
+static const unsigned char* find_damage(const unsigned char* first, const unsigned char* end, const ldv_block_type mask)
+{
+	const unsigned char mask_byte = (unsigned char)mask;
+	for (; first < end && (uintptr_t)first % sizeof(ldv_block_type) != 0; ++first)
+	{
+		if (*first != mask_byte)
+			return first;
+	}
+	for (; first + sizeof(ldv_block_type) <= end && *(const ldv_block_type*)first == mask; first += sizeof(ldv_block_type))
+		;
+	/*	Damaged word and tail are compared by bytes	*/
+	for (; first < end; ++first)
+	{
+		if (*first != mask_byte)
+			return first;
+	}
+	return NULL;
+}
+
+/*
+		Fills redzone of heap block: memory from end of object to end of block
+		Params: heap, pointer to memory, size of object
+		Return: none
+*/
+static void fill_redzone(const ldv_heap* heap, void* ptr, size_t size)
+{
+	if (heap->redzone_bytes != 0)
+		memset((unsigned char*)ptr + size, (unsigned char)REDZONE_MASK, (size_t)(block_end(ptr) - (unsigned char*)ptr) - size);
+}
+
+/*
+		Checks block before free or reallocation: block has to be allocated and its redzone has to be intact.
+		Failures are reported and counted
+		Params: heap, slab page of block (0 - heap block), pointer to memory, size of object, name of operation
+		Return: check result (zero means block is not allocated and must not be touched)
+*/
+static int guard_block(ldv_heap* heap, const SlabPage* page, void* ptr, size_t size, const char* operation)
+{
+	const HeapRegion* region = page == 0 ? find_region(heap, ptr) : 0;
+	const size_t offset = region != 0 ? (size_t)((const unsigned char*)ptr - (const unsigned char*)region->mem) : 0;
+	const int allocated = page != 0 ? slab_slot_used(page, ptr) : region != 0 && offset % sizeof(ldv_block_type) == 0
+		&& offset >= 2 * sizeof(ldv_block_type) && block_live(region, (ldv_block_type)(offset / sizeof(ldv_block_type) - 2));
+	if (!allocated)
+	{
+		++heap->stats.invalid_frees;
+		ldv_log(0, "LDV %s of %p, which is not allocated (double free or invalid pointer)\n", operation, ptr);
+		ldv_log_flush();
+		return 0;
+	}
+	if (page == 0 && heap->redzone_bytes != 0)
+	{
+		const unsigned char* damage = find_damage((const unsigned char*)ptr + size, block_end(ptr), REDZONE_MASK);
+		if (damage != NULL)
+		{
+			++heap->stats.overflows;
+			ldv_log(0, "LDV %s of %p (%" LDV_SIZE_FORMAT " bytes): redzone is overwritten at byte %" LDV_SIZE_FORMAT "\n", operation, ptr, size, (size_t)(damage - (const unsigned char*)ptr));
+			ldv_log_flush();
+		}
+	}
+	return 1;
+}
+
+/*
+		Frees the oldest quarantined block. Block, which pattern is damaged, is reported and counted
+		Params: heap (quarantine is not empty)
+		Return: none
+*/
+static void quarantine_release(ldv_heap* heap)
+{
+	Quarantine* quarantine = &heap->quarantine;
+	const QuarantinedBlock block = quarantine->blocks[quarantine->first];
+	quarantine->first = (quarantine->first + 1) % quarantine->capacity;
+	--quarantine->count;
+	quarantine->bytes -= block.size;
+	const unsigned char* damage = find_damage((const unsigned char*)block.ptr, block_end(block.ptr), QUARANTINE_MASK);
+	if (damage != NULL)
+	{
+		++heap->stats.freed_writes;
+		ldv_log(0, "LDV block %p (%" LDV_SIZE_FORMAT " bytes) is written after free at byte %" LDV_SIZE_FORMAT "\n", block.ptr, block.size, (size_t)(damage - (const unsigned char*)block.ptr));
+		ldv_log_flush();
+	}
+	--find_region(heap, block.ptr)->quarantine_blocks;
+	ldv_free(heap, block.ptr);
+}
+
+/*
+		Puts freed heap block to quarantine. Block stays gem block, but it leaves bitmap of gem blocks,
+		so it is seen as freed one. Blocks, which are pushed out of quarantine, are freed
+		Params: heap, pointer to memory, size of object
+		Return: none
+*/
+static void quarantine_block(ldv_heap* heap, void* ptr, size_t size)
+{
+	Quarantine* quarantine = &heap->quarantine;
+	if (quarantine->count == quarantine->capacity)
+	{
+		const size_t capacity = quarantine->capacity != 0 ? quarantine->capacity * 2 : QUARANTINE_QUEUE_SIZE;
+		QuarantinedBlock* blocks = (QuarantinedBlock*)malloc(capacity * sizeof(QuarantinedBlock));
+		if (blocks == 0)
+		{
+			ldv_free(heap, ptr);
+			return;
+		}
+		for (size_t i = 0; i < quarantine->count; ++i)
+			blocks[i] = quarantine->blocks[(quarantine->first + i) % quarantine->capacity];
+		free(quarantine->blocks);
+		quarantine->blocks = blocks;
+		quarantine->capacity = capacity;
+		quarantine->first = 0;
+	}
+	HeapRegion* region = find_region(heap, ptr);
+	set_block_live(region, (BlockHead*)(RAW_MEMORY(ptr) - 2), 0);
+	++region->quarantine_blocks;
+	memset(ptr, (unsigned char)QUARANTINE_MASK, (size_t)(block_end(ptr) - (unsigned char*)ptr));
+	QuarantinedBlock* block = &quarantine->blocks[(quarantine->first + quarantine->count++) % quarantine->capacity];
+	block->ptr = ptr;
+	block->size = size;
+	quarantine->bytes += size;
+	while (quarantine->count != 0 && quarantine->bytes > quarantine->limit)
+		quarantine_release(heap);
+}
+
+/*
+		Sets size of garbage block in tree of compaction index
+		Params: compaction index, position of block, size of block in words (0 - block is taken)
+		Return: none
+*/
+static void compact_set_size(CompactIndex* index, size_t position, ldv_block_type words)
+{
+	size_t node = index->leaf_count + position;
+	index->sizes[node] = words;
+	for (node /= 2; node != 0; node /= 2)
+	{
+		const ldv_block_type left = index->sizes[node * 2];
+		const ldv_block_type right = index->sizes[node * 2 + 1];
+		index->sizes[node] = left > right ? left : right;
+	}
+}
+
+/*
+		Finds the first garbage block in subtree of compaction index, which lies before bound and fits size
+		Params: compaction index, node of tree, range of positions of node, bound of positions, size in words
+		Return: position of block (count of blocks - no fitted block)
+*/
+static size_t compact_find(const CompactIndex* index, size_t node, size_t low, size_t high, size_t bound, ldv_block_type words)
+{
+	if (low >= bound || index->sizes[node] < words)
+		return index->count;
+	if (high - low == 1)
+		return low;
+	const size_t middle = (low + high) / 2;
+	const size_t found = compact_find(index, node * 2, low, middle, bound, words);
+	return found != index->count ? found : compact_find(index, node * 2 + 1, middle, high, bound, words);
+}
+
+/*
+		Releases compaction index
+		Params: compaction index
+		Return: none
+*/
+static void compact_index_release(CompactIndex* index)
+{
+	free(index->holes);
+	free(index->regions);
+	free(index->sizes);
+	memset(index, 0, sizeof(CompactIndex));
+}
+
+/*
+		Builds compaction index of garbage blocks: each region is swept once in address order
+		Params: heap, compaction index (out)
+		Return: error code (0 - success, 1 - out of memory)
+*/
+static int compact_index_build(const ldv_heap* heap, CompactIndex* index)
+{
+	memset(index, 0, sizeof(CompactIndex));
+	index->regions = (CompactRegion*)calloc(heap->region_count != 0 ? heap->region_count : 1, sizeof(CompactRegion));
+	if (index->regions == 0)
+		return 1;
+	unsigned int rank = 0;
+	for (HeapRegion* region = heap->regions; region != 0; region = region->next, ++rank)
+	{
+		if (!region->bins_ready)
+			rebuild_bins(region);
+		CompactRegion* entry = &index->regions[region_slot(heap, region->mem)];
+		entry->rank = rank;
+		entry->first = index->count;
+		BlockHead* start_head = (BlockHead*)region->mem;
+		for (;;)
+		{
+			if (status(start_head, DataState) == Garbage)
+			{
+				if (index->count == index->capacity)
+				{
+					const size_t capacity = index->capacity != 0 ? index->capacity * 2 : VISITED_SET_SIZE;
+					CompactHole* holes = (CompactHole*)realloc(index->holes, capacity * sizeof(CompactHole));
+					if (holes == 0)
+					{
+						compact_index_release(index);
+						return 1;
+					}
+					index->holes = holes;
+					index->capacity = capacity;
+				}
+				index->holes[index->count].region = region;
+				index->holes[index->count].head = start_head;
+				++index->count;
+			}
+			if (status(start_head, NextHeadState) == MarginHead)
+				break;
+			start_head = raw_move_head(start_head, NextHead, get_head_offset(start_head, NextHead));
+		}
+		entry->end = index->count;
+	}
+	index->leaf_count = 1;
+	while (index->leaf_count < index->count)
+		index->leaf_count *= 2;
+	index->sizes = (ldv_block_type*)calloc(index->leaf_count * 2, sizeof(ldv_block_type));
+	if (index->sizes == 0)
+	{
+		compact_index_release(index);
+		return 1;
+	}
+	for (size_t i = 0; i < index->count; ++i)
+		index->sizes[index->leaf_count + i] = block_words(index->holes[i].head);
+	for (size_t node = index->leaf_count; node-- > 1; )
+	{
+		const ldv_block_type left = index->sizes[node * 2];
+		const ldv_block_type right = index->sizes[node * 2 + 1];
+		index->sizes[node] = left > right ? left : right;
+	}
+	return 0;
+}
+
+/*
+		Gets size of memory, which is allocated for object. Small objects of thread safe heap are rounded up to slot size,
+		so blocks cached by threads fit any object of their size class
+		Params: heap, size of object
+		Return: size of memory
+*/
+static size_t block_capacity(const ldv_heap* heap, size_t size)
+{
+	if (heap->thread_safe && size != 0 && size <= SLAB_MAX_SIZE)
+		return slab_sizes[slab_classes[(size + 7) / 8]];
+	return size;
+}
+
+/*
+		Moves part to the lowest fitted garbage block below it: block of earlier region of heap or lower block
+		of its region. Heap is not grown. Parts are moved from the last one in heap order, so freed blocks of parts
+		and blocks, they are merged with, lie above all parts, which are left, and their stale entries of index are not used
+		Params: heap, compaction index, part, size of memory
+		Return: new pointer to memory (0 - no fitted block below)
+*/
+static void* relocate_block(ldv_heap* heap, CompactIndex* index, const RelocatedPart* part, size_t size)
+{
+	const size_t need = block_capacity(heap, size) + heap->redzone_bytes;
+	const CompactRegion* entry = &index->regions[part->slot];
+	/*	Blocks of index before bound lie below part	*/
+	size_t low = entry->first;
+	size_t high = entry->end;
+	while (low < high)
+	{
+		const size_t middle = (low + high) / 2;
+		if ((uintptr_t)index->holes[middle].head < (uintptr_t)part->mem)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	const size_t found = compact_find(index, 1, 0, index->leaf_count, low, fit_words(need));
+	if (found == index->count)
+		return 0;
+	CompactHole* hole = &index->holes[found];
+	const ldv_block_type hole_words = block_words(hole->head);
+	void* mem = take_block(hole->region, hole->head, need);
+	/*	Tail of split block keeps place of block in index	*/
+	const ldv_block_type taken_words = block_words(hole->head);
+	if (taken_words < hole_words)
+		hole->head = raw_move_head(hole->head, NextHead, taken_words);
+	compact_set_size(index, found, taken_words < hole_words ? hole_words - taken_words : 0);
+	memcpy(mem, part->mem, size);
+	fill_redzone(heap, mem, size);
+	ldv_free(heap, part->mem);
+	return mem;
+}
+
+/*
+		Marks slot of slab page with specific label according to poisoning policy of heap
+		Params: heap, slot, size of slot in bytes, label type
+		Return: none
+*/
+static void mark_slot(const ldv_heap* heap, void* slot, size_t size, const UserDataLabel label)
+{
+	if (heap->poison_mode == LDV_POISON_OFF)
+		return;
+	if (heap->poison_mode == LDV_POISON_HEADER && size > POISON_HEADER_WORDS * sizeof(ldv_block_type))
+		size = POISON_HEADER_WORDS * sizeof(ldv_block_type);
+	memset(slot, (unsigned char)(label == Allocated ? ALLOC_MASK : FREE_MASK), size);
+}
+
+/*
+		Inserts slab page into list of pages with free slots
+		Params: heap, slab page
+		Return: none
+*/
+static void slab_partial_insert(ldv_heap* heap, SlabPage* page)
+{
+	SlabPage** head = &heap->slab_partial[page->size_class];
+	page->prev_partial = 0;
+	page->next_partial = *head;
+	if (*head != 0)
+		(*head)->prev_partial = page;
+	*head = page;
+}
+
+/*
+		Removes slab page from list of pages with free slots
+		Params: heap, slab page
+		Return: none
+*/
+static void slab_partial_remove(ldv_heap* heap, SlabPage* page)
+{
+	if (page->prev_partial == 0)
+		heap->slab_partial[page->size_class] = page->next_partial;
+	else
+		page->prev_partial->next_partial = page->next_partial;
+	if (page->next_partial != 0)
+		page->next_partial->prev_partial = page->prev_partial;
+	page->next_partial = 0;
+	page->prev_partial = 0;
+}
+
+/*
+		Inserts slab page into table of slab pages (table is kept sorted by address)
+		Params: heap, slab page
+		Return: error code (0 - success)
+*/
+static int slab_register_page(ldv_heap* heap, SlabPage* page)
+{
+	if (heap->slab_page_count == heap->slab_page_capacity)
+	{
+		const unsigned int capacity = heap->slab_page_capacity != 0 ? heap->slab_page_capacity * 2 : 16;
+		SlabPage** pages = (SlabPage**)realloc(heap->slab_pages, capacity * sizeof(SlabPage*));
+		if (pages == 0)
+			return 1;
+		heap->slab_pages = pages;
+		heap->slab_page_capacity = capacity;
+	}
+	unsigned int position = heap->slab_page_count;
+	while (position > 0 && heap->slab_pages[position - 1] > page)
+	{
+		heap->slab_pages[position] = heap->slab_pages[position - 1];
+		--position;
+	}
+	heap->slab_pages[position] = page;
+	++heap->slab_page_count;
+	return 0;
+}
+
+/*
+		Removes slab page from table of slab pages
+		Params: heap, slab page
+		Return: none
+*/
+static void slab_unregister_page(ldv_heap* heap, SlabPage* page)
+{
+	unsigned int position = 0;
+	while (heap->slab_pages[position] != page)
+		++position;
+	--heap->slab_page_count;
+	for (; position < heap->slab_page_count; ++position)
+		heap->slab_pages[position] = heap->slab_pages[position + 1];
+}
+
+/*
+		Creates slab page of size class in new heap block
+		Params: heap, size class
+		Return: slab page (0 on failure)
+*/
+static SlabPage* slab_create_page(ldv_heap* heap, const unsigned int size_class)
+{
+	void* block = ldv_malloc(heap, SLAB_PAGE_BYTES + SLAB_ALIGN - sizeof(ldv_block_type));
+	if (block == 0)
+		return 0;
+	SlabPage* page = (SlabPage*)(((uintptr_t)block + SLAB_ALIGN - 1) & ~(uintptr_t)(SLAB_ALIGN - 1));
+	memset(page, 0, sizeof(SlabPage));
+	page->magic = SLAB_MAGIC;
+	page->size_class = (unsigned short)size_class;
+	page->slot_size = slab_sizes[size_class];
+	page->slot_count = (unsigned short)((SLAB_PAGE_BYTES - (slab_slots(page) - (unsigned char*)page)) / page->slot_size);
+	page->free_count = page->slot_count;
+	page->block = block;
+	for (unsigned int slot = page->slot_count; slot < SLAB_MAP_SIZE * 32; ++slot)
+		page->slot_map[slot / 32] |= (ldv_block_type)1 << (slot % 32);
+	if (slab_register_page(heap, page) != 0)
+	{
+		ldv_free(heap, block);
+		return 0;
+	}
+	slab_partial_insert(heap, page);
+	return page;
+}
+
+/*
+		Allocates slot of slab page, which is able to hold memory with size
+		Params: heap, size of needed memory (not greater than SLAB_MAX_SIZE)
+		Return: allocated slot (0 on failure)
+*/
+static void* slab_malloc(ldv_heap* heap, size_t nsize)
+{
+	LDV_ASSERT(nsize <= SLAB_MAX_SIZE)
+	const unsigned int size_class = slab_classes[(nsize + 7) / 8];
+	SlabPage* page = heap->slab_partial[size_class];
+	if (page == 0 && (page = slab_create_page(heap, size_class)) == 0)
+		return 0;
+	unsigned int map_index = 0;
+	while (page->slot_map[map_index] == (ldv_block_type)-1)
+		++map_index;
+	const unsigned int slot = map_index * 32 + lowest_bit(~page->slot_map[map_index]);
+	LDV_ASSERT(slot < page->slot_count)
+	page->slot_map[map_index] |= (ldv_block_type)1 << (slot % 32);
+	if (--page->free_count == 0)
+		slab_partial_remove(heap, page);
+	void* mem = slab_slots(page) + slot * page->slot_size;
+	mark_slot(heap, mem, page->slot_size, Allocated);
+	return mem;
+}
+
+/*
+		Frees slot of slab page. Empty page is returned to heap, unless it is the last page with free slots of its class
+		Params: heap, slab page, pointer to slot
+		Return: none
+*/
+static void slab_free(ldv_heap* heap, SlabPage* page, void* ptr)
+{
+	LDV_ASSERT(slab_slot_used(page, ptr))
+	const unsigned int slot = (unsigned int)(((unsigned char*)ptr - slab_slots(page)) / page->slot_size);
+	page->slot_map[slot / 32] &= ~((ldv_block_type)1 << (slot % 32));
+	mark_slot(heap, ptr, page->slot_size, Free);
+	if (page->free_count++ == 0)
+		slab_partial_insert(heap, page);
+	if (page->free_count == page->slot_count && (page->next_partial != 0 || page->prev_partial != 0))
+	{
+		slab_partial_remove(heap, page);
+		slab_unregister_page(heap, page);
+		ldv_free(heap, page->block);
+	}
+}
+
+/*
+		Releases memory of freed object: slot of slab page is freed, heap block is quarantined or freed
+		Params: heap, slab page of object (0 - heap block), pointer to memory, size of object
+		Return: none
+*/
+static void release_block(ldv_heap* heap, SlabPage* page, void* ptr, size_t size)
+{
+	if (page != 0)
+		slab_free(heap, page, ptr);
+	else if (heap->quarantine.limit != 0)
+		quarantine_block(heap, ptr, size);
+	else
+		ldv_free(heap, ptr);
+}
+
+/*
+		Allocates memory with size. Small objects are served by slab pages, others by heap blocks
+		Params: heap, size of needed memory
+		Return: allocated memory (0 on failure)
+*/
+static void* heap_malloc(ldv_heap* heap, size_t nsize)
+{
+	/*	Slots of slab pages have no redzones and they are not quarantined	*/
+	if (heap->slab_enabled && heap->redzone_bytes == 0 && heap->quarantine.limit == 0 && nsize <= SLAB_MAX_SIZE)
+	{
+		void* mem = slab_malloc(heap, nsize);
+		if (mem != 0)
+			return mem;
+	}
+	return ldv_malloc(heap, nsize);
+}
+
+/*
+		Takes lock of registry of live heaps
+		Params: none
+		Return: none
+*/
+static void registry_lock(void)
+{
+	for (unsigned int spin = 0; LDV_LOCKED(&live_heaps_lock) || !LDV_TRY_LOCK(&live_heaps_lock); ++spin)
+	{
+		if (spin >= LOCK_SPIN_COUNT)
+			LDV_YIELD();
+	}
+}
+
+/*
+		Releases lock of registry of live heaps
+		Params: none
+		Return: none
+*/
+static void registry_unlock(void)
+{
+	LDV_UNLOCK(&live_heaps_lock);
+}
+
+/*
+		Finds heap in registry of live heaps. Registry is locked by caller
+		Params: heap
+		Return: entry of heap (NULL - heap is not registered)
+*/
+static LiveHeap* registry_find(const ldv_heap* heap)
+{
+	for (size_t i = 0; i < live_heap_count; ++i)
+	{
+		if (live_heaps[i].heap == heap)
+			return &live_heaps[i];
+	}
+	return NULL;
+}
+
+/*
+		Starts new epoch of heap memory and registers heap at it, so blocks cached at previous epoch are dropped
+		Params: heap
+		Return: none
+
+		NOTE: Heap, which is not registered for lack of memory, works, but caches of other heaps are not flushed to it.
+*/
+static void registry_renew(ldv_heap* heap)
+{
+	registry_lock();
+	heap->cache_epoch = ++cache_epochs;
+	LiveHeap* entry = registry_find(heap);
+	if (entry == NULL && live_heap_count == live_heap_capacity)
+	{
+		const size_t capacity = live_heap_capacity != 0 ? live_heap_capacity * 2 : 8;
+		LiveHeap* heaps = (LiveHeap*)realloc(live_heaps, capacity * sizeof(LiveHeap));
+		if (heaps != NULL)
+		{
+			live_heaps = heaps;
+			live_heap_capacity = capacity;
+		}
+	}
+	if (entry == NULL && live_heap_count < live_heap_capacity)
+	{
+		entry = &live_heaps[live_heap_count++];
+		entry->heap = heap;
+	}
+	if (entry != NULL)
+		entry->epoch = heap->cache_epoch;
+	registry_unlock();
+}
+
+/*
+		Removes heap from registry of live heaps
+		Params: heap
+		Return: none
+*/
+static void registry_remove(const ldv_heap* heap)
+{
+	registry_lock();
+	LiveHeap* entry = registry_find(heap);
+	if (entry != NULL)
+		*entry = live_heaps[--live_heap_count];
+	registry_unlock();
+}
+
+/*
+		Takes lock of thread safe heap. Waits for lock are counted as contentions
+		Params: heap
+		Return: none
+*/
+static void heap_lock(ldv_heap* heap)
+{
+	if (!heap->thread_safe || LDV_TRY_LOCK(&heap->lock))
+		return;
+	for (unsigned int spin = 0; LDV_LOCKED(&heap->lock) || !LDV_TRY_LOCK(&heap->lock); ++spin)
+	{
+		if (spin >= LOCK_SPIN_COUNT)
+			LDV_YIELD();
+	}
+	++heap->stats.lock_contentions;
+}
+
+/*
+		Releases lock of thread safe heap
+		Params: heap
+		Return: none
+*/
+static void heap_unlock(ldv_heap* heap)
+{
+	if (heap->thread_safe)
+		LDV_UNLOCK(&heap->lock);
+}
+
+/*
+		Performs checks on slab page
+		Params: heap, slab page
+		Return: error code (0 - success)
+*/
+static int check_slab_page(const ldv_heap* heap, const SlabPage* page)
+{
+	if (page->magic != SLAB_MAGIC || page->size_class >= SLAB_CLASS_COUNT || page->slot_size != slab_sizes[page->size_class])
+	{
+		ldv_log(0, "Corrupted header of slab page %p\n", page);
+		return 1;
+	}
+	unsigned int free_count = 0;
+	for (unsigned int slot = 0; slot < SLAB_MAP_SIZE * 32; ++slot)
+	{
+		const int used = (page->slot_map[slot / 32] & ((ldv_block_type)1 << (slot % 32))) != 0;
+		if (!used && slot >= page->slot_count)
+		{
+			ldv_log(0, "Slab page %p marks missing slot %i as free\n", page, slot);
+			return 1;
+		}
+		free_count += used ? 0 : 1;
+	}
+	int code = 0;
+	if (free_count != page->free_count)
+	{
+		ldv_log(0, "Slab page %p has %i free slots, header holds %i\n", page, free_count, page->free_count);
+		code = 1;
+	}
+	const SlabPage* partial = heap->slab_partial[page->size_class];
+	while (partial != 0 && partial != page)
+		partial = partial->next_partial;
+	if ((partial != 0) != (page->free_count != 0))
+	{
+		ldv_log(0, "Slab page %p is inconsistent with list of pages with free slots\n", page);
+		code = 1;
+	}
+	HeapRegion* region = find_region(heap, page->block);
+	BlockHead* bhead = (BlockHead*)(RAW_MEMORY(page->block) - 2);
+	if (region == 0 || status(bhead, DataState) != Gem || (unsigned char*)page + SLAB_PAGE_BYTES > (unsigned char*)(RAW_MEMORY(bhead) + block_words(bhead)))
+	{
+		ldv_log(0, "Slab page %p is not held by gem block\n", page);
+		code = 1;
+	}
+	return code;
+}
+
+/*
+		Performs local checks on heads and free lists of heap region
+		Params: heap region
+		Return: error code (0 - success)
+*/
+static int check_region(HeapRegion* region)
+{
+	int code = 0;
+	const ldv_heap* heap = region->heap;
+	const ldv_block_type redzone_words = (ldv_block_type)(heap->redzone_bytes / sizeof(ldv_block_type));
+	unsigned int garbage_count = 0;
+	unsigned int gem_count = 0;
+	size_t quarantined_count = 0;
+	BlockHead* start_head = (BlockHead*)region->mem;
+	for (unsigned int heads_count = 0; ; ++heads_count)
+	{
+		const int live = block_live(region, head_index(region, start_head));
+		if (status(start_head, DataState) == Garbage)
+			++garbage_count;
+		else if (live)
+			++gem_count;
+		else
+			++quarantined_count;
+		if (live && status(start_head, DataState) != Gem)
+		{
+			ldv_log(0, "Bitmap of gem blocks is inconsistent with block %p %i\n", start_head, heads_count);
+			code = 1;
+		}
+		/*	The last words of gem block are always in redzone (slab pages have no redzones)	*/
+		ldv_block_type* payload = RAW_MEMORY(start_head) + 2;
+		const unsigned char* block_finish = (const unsigned char*)(RAW_MEMORY(start_head) + block_words(start_head));
+		if (live && redzone_words != 0 && block_words(start_head) >= redzone_words + 2)
+		{
+			const SlabPage* page = find_slab_page(heap, (unsigned char*)payload + SLAB_PAGE_BYTES - 1);
+			if ((page == 0 || page->block != payload) && find_damage(block_finish - redzone_words * sizeof(ldv_block_type), block_finish, REDZONE_MASK) != NULL)
+			{
+				ldv_log(0, "Redzone of block %p %i is overwritten\n", start_head, heads_count);
+				code = 1;
+			}
+		}
+		if (!live && status(start_head, DataState) == Gem && find_damage((const unsigned char*)payload, block_finish, QUARANTINE_MASK) != NULL)
+		{
+			ldv_log(0, "Quarantined block %p %i is written after free\n", start_head, heads_count);
+			code = 1;
+		}
+		const ldv_block_type prev = get_head_offset(start_head, PrevHead);
+		const ldv_block_type next = get_head_offset(start_head, NextHead);
+		if (prev > head_index(region, start_head))
+		{
+			ldv_log(0, "Corrupted prev index of block %p %i %i\n", start_head, heads_count, prev);
+			code = 1;
+		}
+		if (next > region->size - head_index(region, start_head) || next < MIN_BLOCK_WORDS)
+		{
+			ldv_log(0, "Corrupted next index of block %p %i %i\n", start_head, heads_count, next);
+			return 1;
+		}
+		if (status(start_head, NextHeadState) == MarginHead)
+			break;
+		start_head = raw_move_head(start_head, NextHead, next);
+		const ldv_block_type next_prev = get_head_offset(start_head, PrevHead);
+		if (next != next_prev)
+		{
+			ldv_log(0, "Inconsistent prev/next %i %i links (next head %p %i)", next, next_prev, start_head, heads_count);
+			code = 1;
+		}
+		if (status(start_head, DataState) == Garbage && status(raw_move_head(start_head, PrevHead, next), DataState) == Garbage)
+		{
+			ldv_log(0, "Not coalesced garbage blocks %p %i\n", start_head, heads_count);
+			code = 1;
+		}
+	}
+	/*	Performs check of free lists	*/
+	if (!region->bins_ready)
+		rebuild_bins(region);
+	unsigned int listed_count = 0;
+	for (unsigned int bin = 0; bin < BIN_COUNT; ++bin)
+	{
+		ldv_block_type prev = NO_BLOCK;
+		for (ldv_block_type index = region->bin_heads[bin]; index != NO_BLOCK; index = free_links(index_head(region, index))->next_free)
+		{
+			BlockHead* bhead = index_head(region, index);
+			if (index >= region->size || status(bhead, DataState) != Garbage || bin_index(block_words(bhead)) != bin)
+			{
+				ldv_log(0, "Corrupted free list %i at block %p\n", bin, bhead);
+				code = 1;
+				break;
+			}
+			if (free_links(bhead)->prev_free != prev)
+			{
+				ldv_log(0, "Inconsistent free list %i links at block %p\n", bin, bhead);
+				code = 1;
+			}
+			prev = index;
+			++listed_count;
+		}
+		if (region->bin_tails[bin] != prev)
+		{
+			ldv_log(0, "Inconsistent tail of free list %i\n", bin);
+			code = 1;
+		}
+	}
+	if (listed_count != garbage_count)
+	{
+		ldv_log(0, "Free lists hold %i blocks, heap region has %i garbage blocks\n", listed_count, garbage_count);
+		code = 1;
+	}
+	if (quarantined_count != region->quarantine_blocks)
+	{
+		ldv_log(0, "Quarantine holds %" LDV_SIZE_FORMAT " blocks of heap region, heap region has %" LDV_SIZE_FORMAT " quarantined blocks\n", region->quarantine_blocks, quarantined_count);
+		code = 1;
+	}
+	/*	Bits, which are set out of block heads, are not met by walk over heads	*/
+	unsigned int live_count = 0;
+	for (size_t i = 0; i < live_map_size(region) / sizeof(ldv_block_type); ++i)
+	{
+		for (ldv_block_type map = region->live_map[i]; map != 0; map &= map - 1)
+			++live_count;
+	}
+	if (live_count != gem_count)
+	{
+		ldv_log(0, "Bitmap of gem blocks marks %i blocks, heap region has %i gem blocks\n", live_count, gem_count);
+		code = 1;
+	}
+	return code;
+}
+
+/*
+		Gets cell of object in set of expanded objects
+		Params: set, object address
+		Return: index of cell, which holds object or empty cell for it
+*/
+static size_t visited_cell(const VisitedSet* set, const void* obj)
+{
+	const size_t mask = set->capacity - 1;
+	size_t cell = (size_t)(((uintptr_t)obj >> 3) * 0x9E3779B97F4A7C15ull) & mask;
+	while (set->keys[cell] != 0 && set->keys[cell] != obj)
+		cell = (cell + 1) & mask;
+	return cell;
+}
+
+/*
+		Adds object to set of expanded objects. Set grows twice, when it is half full
+		Params: set, object address
+		Return: dump id of object (0 on failure)
+*/
+static unsigned int visited_insert(VisitedSet* set, const void* obj)
+{
+	if ((set->count + 1) * 2 > set->capacity)
+	{
+		VisitedSet grown = *set;
+		grown.capacity = set->capacity != 0 ? set->capacity * 2 : VISITED_SET_SIZE;
+		grown.keys = (const void**)calloc(grown.capacity, sizeof(const void*));
+		grown.ids = (unsigned int*)malloc(grown.capacity * sizeof(unsigned int));
+		if (grown.keys == 0 || grown.ids == 0)
+		{
+			free(grown.keys);
+			free(grown.ids);
+			return 0;
+		}
+		for (size_t i = 0; i < set->capacity; ++i)
+		{
+			if (set->keys[i] == 0)
+				continue;
+			const size_t cell = visited_cell(&grown, set->keys[i]);
+			grown.keys[cell] = set->keys[i];
+			grown.ids[cell] = set->ids[i];
+		}
+		free(set->keys);
+		free(set->ids);
+		*set = grown;
+	}
+	const size_t cell = visited_cell(set, obj);
+	set->keys[cell] = obj;
+	set->ids[cell] = (unsigned int)++set->count;
+	return set->ids[cell];
+}
+
+/*
+		Begins dump, which shares set of expanded objects with nested dumps
+		Params: none
+		Return: none
+*/
+static void dump_session_begin(void)
+{
+	++dump_visited.sessions;
+}
+
+/*
+		Ends dump. Set of expanded objects is released and output is flushed at the end of outermost dump
+		Params: none
+		Return: none
+*/
+static void dump_session_end(void)
+{
+	if (--dump_visited.sessions != 0)
+		return;
+	free(dump_visited.keys);
+	free(dump_visited.ids);
+	memset(&dump_visited, 0, sizeof(VisitedSet));
+	if (log_sink.batch_depth == 0)
+		ldv_log_flush();
+}
+
+/*
+		Marks object as expanded by dump. Object, which is already expanded, is dumped as back reference
+		Params: object address
+		Return: flag, whether object is already expanded
+*/
+static int dump_visit(const void* obj)
+{
+	if (dump_visited.capacity != 0)
+	{
+		const size_t cell = visited_cell(&dump_visited, obj);
+		if (dump_visited.keys[cell] != 0)
+		{
+			ldv_log(0, "<ref #%u>", dump_visited.ids[cell]);
+			return 1;
+		}
+	}
+	const unsigned int id = visited_insert(&dump_visited, obj);
+	if (id != 0)
+		ldv_log(0, "#%u", id);
+	return 0;
+}
+
+/*
+	Loads ldv library
+	Params: lua state
+	Return: returns count
+*/
+static int ldv_load_libf(lua_State* L)
+{
+	luaL_newlib(L, ldv_tab_funcs);
+  	return 1;
+}
+
+/*			PRIVATE FUNCS				*/
+/*
+		Checks, whether collectable value points to object of value type
+		Params: lua state, value
+		Return: valid state
+*/
+int check_value(lua_State* L, const TValue* value)
+{
+	if (!iscollectable(value))
+		return 1;
+	const GCObject* gcobj = gcvalue(value);
+	if (!check_ptr(ldv_state_heap(L), gcobj))
+		return 0;
+	const int check_tag = gcobj->tt == ttype(value);
+	LDV_ASSERT(check_tag)
+	return check_tag;
+}
+
+/*
+		Checks validity of table 
+		Params: lua state, table
+		Return: valid state
+*/
+int check_table(lua_State* L, const Table* table)
+{
+	const ldv_heap* heap = ldv_state_heap(L);
+	if (table->sizearray != 0 && !check_sized_ptr(heap, table->array, table->sizearray * sizeof(TValue)))
+		return 0;
+	for (unsigned int i = 0; i < table->sizearray; ++i)
+	{
+		if (!check_value(L, table->array + i))
+			return 0;
+	}
+	/*	Empty node part is static dummy node, it is out of heap	*/
+	if (!isdummy(table))
+	{
+		if (!check_sized_ptr(heap, table->node, sizenode(table) * sizeof(Node)))
+			return 0;
+		const int check_lastfree = table->node <= table->lastfree && table->lastfree <= table->node + sizenode(table);
+		LDV_ASSERT(check_lastfree)
+		if (!check_lastfree)
+			return 0;
+		for (int i = 0; i < sizenode(table); ++i)
+		{
+			if (!check_value(L, gval(table->node + i)))
+				return 0;
+		}
+	}
+	/*	Metatable is checked by object walker	*/
+	return table->metatable == NULL || check_sized_ptr(heap, table->metatable, sizeof(Table));
+}
+
+/*
+		Checks upvalue and upvalues, which follow it in list of open upvalues
+		Params: lua state, upvalue
+		Return: valid state
+*/
+int check_upvalue(lua_State* L, const UpVal* upval)
+{
+	const ldv_heap* heap = ldv_state_heap(L);
+	const UpVal* val = upval;
+	while (val != NULL)
+	{
+		if (!check_sized_ptr(heap, val, sizeof(UpVal)) || !check_ptr(heap, val->v))
+			return 0;
+		val = upisopen(val) ? val->u.open.next : NULL;
+	}
+	return 1;
+}
+
+/*
+		Checks validity of cclosure 
+		Params: lua state, cclosure
+		Return: valid state
+*/
+int check_cclosure(lua_State* L, const CClosure* cclosure)
+{
+	if (!check_sized_ptr(ldv_state_heap(L), cclosure, sizeCclosure(cclosure->nupvalues)))
+		return 0;
+	for (unsigned int i = 0; i < cclosure->nupvalues; ++i)
+	{
+		if (!check_value(L, cclosure->upvalue + i))
+			return 0;
+	}
+	return 1;
+}
+
+/*
+		Checks validity of string. String with terminator has to fit block
+		Params: lua state, string
+		Return: valid state
+*/
+int check_string(lua_State* L, const TString* str)
+{
+	const ldv_heap* heap = ldv_state_heap(L);
+	if (str->tt == LUA_TSHRSTR)
+	{
+		const int check_length = str->shrlen <= LUAI_MAXSHORTLEN;
+		LDV_ASSERT(check_length)
+		if (!check_length)
+			return 0;
+		/*	Next string of string table bucket	*/
+		if (str->u.hnext != NULL && !check_sized_ptr(heap, str->u.hnext, sizeof(TString)))
+			return 0;
+	}
+	if (!check_sized_ptr(heap, str, sizelstring(tsslen(str))))
+		return 0;
+	const int check_terminator = getstr(str)[tsslen(str)] == '\0';
+	LDV_ASSERT(check_terminator)
+	return check_terminator;
+}
+
+/*
+		Checks validity of userdata
+		Params: lua state, userdata
+		Return: valid state
+*/
+int check_userdata(lua_State* L, const Udata* udata)
+{
+	const ldv_heap* heap = ldv_state_heap(L);
+	if (!check_sized_ptr(heap, udata, sizeludata(udata->len)))
+		return 0;
+	if (udata->metatable != NULL && !check_sized_ptr(heap, udata->metatable, sizeof(Table)))
+		return 0;
+	TValue user_value;
+	getuservalue(L, udata, &user_value);
+	return check_value(L, &user_value);
+}
+
+/*
+		Checks validity of thread: stack, list of call infos and list of open upvalues
+		Params: lua state, thread
+		Return: valid state
+*/
+int check_thread(lua_State* L, const lua_State* thread)
+{
+	const ldv_heap* heap = ldv_state_heap(L);
+	/*	Thread is kept after extra space of its block	*/
+	if (!check_sized_ptr(heap, (const char*)thread - LUA_EXTRASPACE, LUA_EXTRASPACE + sizeof(lua_State)))
+		return 0;
+	/*	Stack is not created yet	*/
+	if (thread->stack == NULL)
+		return 1;
+	const StkId stack_end = thread->stack + thread->stacksize;
+	const int check_stack = check_sized_ptr(heap, thread->stack, thread->stacksize * sizeof(TValue))
+		&& thread->stack_last == stack_end - EXTRA_STACK && thread->stack <= thread->top && thread->top <= stack_end;
+	LDV_ASSERT(check_stack)
+	if (!check_stack)
+		return 0;
+	/*	Slots above top are not cleared, so they are able to hold dead objects	*/
+	for (StkId slot = thread->stack; slot < thread->top; ++slot)
+	{
+		if (!check_value(L, slot))
+			return 0;
+	}
+	unsigned int ci_count = 0;
+	int current_found = 0;
+	for (const CallInfo* ci = &thread->base_ci; ci != NULL; ci = ci->next)
+	{
+		if (ci != &thread->base_ci && (!check_sized_ptr(heap, ci, sizeof(CallInfo)) || ++ci_count > thread->nci))
+			return 0;
+		const int check_ci = (ci->next == NULL || ci->next->previous == ci)
+			&& (ci->func == NULL || (thread->stack <= ci->func && ci->func < stack_end))
+			&& (ci->top == NULL || (thread->stack <= ci->top && ci->top <= stack_end));
+		LDV_ASSERT(check_ci)
+		if (!check_ci)
+			return 0;
+		current_found = current_found || ci == thread->ci;
+	}
+	const int check_ci_list = current_found && ci_count == thread->nci;
+	LDV_ASSERT(check_ci_list)
+	return check_ci_list && check_upvalue(L, thread->openupval);
+}
+
+/*
+		Checks validity of proto 
+		Params: lua state, proto
+		Return: valid state
+*/
+int check_proto(lua_State* L, const Proto* proto)
+{
+	const ldv_heap* heap = ldv_state_heap(L);
+	if (proto->source && !check_sized_ptr(heap, proto->source, sizeof(TString)))
+		return 0;
+	if (proto->cache && !check_ptr(heap, proto->cache))
+		return 0;
+	if (proto->sizek > 0 && !check_sized_ptr(heap, proto->k, proto->sizek * sizeof(TValue)))
+		return 0;
+	for (int i = 0; i < proto->sizek; ++i)
+	{
+		if (!check_value(L, proto->k + i))
+			return 0;
+	}
+	if (proto->sizep > 0 && !check_sized_ptr(heap, proto->p, proto->sizep * sizeof(Proto*)))
+		return 0;
+	for (int i = 0; i < proto->sizep; ++i)
+	{
+		if (proto->p[i] && !check_sized_ptr(heap, proto->p[i], sizeof(Proto)))
+			return 0;
+	}
+	if (proto->sizecode > 0 && !check_sized_ptr(heap, proto->code, proto->sizecode * sizeof(Instruction)))
+		return 0;
+	if (proto->sizelineinfo > 0 && !check_sized_ptr(heap, proto->lineinfo, proto->sizelineinfo * sizeof(int)))
+		return 0;
+	if (proto->sizelocvars > 0 && !check_sized_ptr(heap, proto->locvars, proto->sizelocvars * sizeof(LocVar)))
+		return 0;
+	return proto->sizeupvalues <= 0 || check_sized_ptr(heap, proto->upvalues, proto->sizeupvalues * sizeof(Upvaldesc));
+}
+
+/*
+		Checks validity of lua closure
+		Params: lua state, lua closure
+		Return: valid state
+*/
+int check_lclosure(lua_State* L, const LClosure* lclosure)
+{
+	const ldv_heap* heap = ldv_state_heap(L);
+	if (!check_sized_ptr(heap, lclosure, sizeLclosure(lclosure->nupvalues)))
+		return 0;
+	for (unsigned int i = 0; i < lclosure->nupvalues; ++i)
+	{
+		if (lclosure->upvals[i] != NULL && !check_upvalue(L, lclosure->upvals[i]))
+			return 0;
+	}
+	/*	Proto is checked by object walker	*/
+	return lclosure->p == NULL || check_sized_ptr(heap, lclosure->p, sizeof(Proto));
+}
+
+/*
+		Check gc object on validness. Each object has to be payload of gem block, which is large enough to hold it
+		Params: lua state, gc object
+		Return: valid state
+*/
+int check_gcobject(lua_State* L, const GCObject* gcobj)
+{
+	const ldv_heap* heap = ldv_state_heap(L);
+	/*	Header is checked before size of object is taken from it	*/
+	if (gcobj->tt != LUA_TTHREAD && !check_sized_ptr(heap, gcobj, sizeof(GCObject)))
+		return 0;
+	switch (gcobj->tt)
+	{
+		case LUA_TTABLE:
+		{
+			const Table* table = gco2t(gcobj);
+			return check_sized_ptr(heap, table, sizeof(Table)) ? check_table(L, table) : 0;
+		}
+		case LUA_TLCL:
+			return check_lclosure(L, gco2lcl(gcobj));
+		case LUA_TCCL:
+			return check_cclosure(L, gco2ccl(gcobj));
+		case LUA_TUSERDATA:
+			return check_userdata(L, gco2u(gcobj));
+		case LUA_TTHREAD:
+			return check_thread(L, gco2th(gcobj));
+		case LUA_TSHRSTR:
+		case LUA_TLNGSTR:
+			return check_string(L, gco2ts(gcobj));
+		case LUA_TPROTO:
+		{
+			const Proto* proto = gco2p(gcobj);
+			return check_sized_ptr(heap, proto, sizeof(Proto)) ? check_proto(L, proto) : 0;
+		}
+		case LUA_TLCF:
+			/*	Light C function is kept in value, so object with its tag is corrupted	*/
+			ldv_log(0, "(check_gcobject func). Light C function is not collectable: %p \n", gcobj);
+			LDV_ASSERT(0)
+			return 0;
+		default:
+			ldv_log(0, "(check_gcobject func). Not recognized type: %i \n", gcobj->tt);
+			return 0;
+	}
+}
+
+/*
+		Creates walked item of lua value
+		Params: value
+		Return: walked item
+*/
+static WalkItem value_item(const TValue* value)
+{
+	WalkItem item = { ttype(value), value, iscollectable(value) ? gcvalue(value) : NULL };
+	return item;
+}
+
+/*
+		Creates walked item of object, which is not kept in lua value
+		Params: type of object, object (NULL - nil item)
+		Return: walked item
+*/
+static WalkItem object_item(const int type, const void* obj)
+{
+	WalkItem item = { obj != NULL ? type : LUA_TNIL, NULL, obj };
+	return item;
+}
+
+/*
+		Gets next child of walked item. Cursor of frame is advanced
+		Params: frame of walked item, edge to child (out), index of edge (out), child (out)
+		Return: flag, whether child exists
+*/
+static int walk_next_child(WalkFrame* frame, WalkEdge* edge, size_t* index, WalkItem* child)
+{
+	switch (frame->item.type)
+	{
+		case LUA_TTABLE:
+		{
+			const Table* table = (const Table*)frame->item.obj;
+			const size_t node_end = table->sizearray + (isdummy(table) ? 0 : 2 * (size_t)sizenode(table));
+			if (frame->cursor < table->sizearray)
+			{
+				*edge = WalkArrayItem;
+				*index = frame->cursor;
+				*child = value_item(&table->array[frame->cursor++]);
+				return 1;
+			}
+			/*	Node gives two children (key and value), empty nodes are skipped	*/
+			while (frame->cursor < node_end)
+			{
+				const size_t node_cursor = frame->cursor - table->sizearray;
+				const Node* node = &table->node[node_cursor / 2];
+				if (node_cursor % 2 == 0 && (ttisnil(gkey(node)) || ttisnil(gval(node))))
+				{
+					frame->cursor += 2;
+					continue;
+				}
+				++frame->cursor;
+				*edge = node_cursor % 2 == 0 ? WalkNodeKey : WalkNodeValue;
+				*index = node_cursor / 2;
+				*child = value_item(node_cursor % 2 == 0 ? gkey(node) : gval(node));
+				return 1;
+			}
+			if (frame->cursor++ == node_end && table->metatable != NULL)
+			{
+				*edge = WalkMetatable;
+				*index = 0;
+				*child = object_item(LUA_TTABLE, table->metatable);
+				return 1;
+			}
+			return 0;
+		}
+		case LUA_TLCL:
+		{
+			const LClosure* lclosure = (const LClosure*)frame->item.obj;
+			if (frame->cursor < lclosure->nupvalues)
+			{
+				const UpVal* upval = lclosure->upvals[frame->cursor];
+				*edge = WalkUpvalue;
+				*index = frame->cursor++;
+				*child = upval != NULL ? value_item(upval->v) : object_item(LUA_TNIL, NULL);
+				return 1;
+			}
+			if (frame->cursor++ == lclosure->nupvalues)
+			{
+				*edge = WalkProto;
+				*index = 0;
+				*child = object_item(LUA_TPROTO, lclosure->p);
+				return 1;
+			}
+			return 0;
+		}
+		case LUA_TCCL:
+		{
+			const CClosure* cclosure = (const CClosure*)frame->item.obj;
+			if (frame->cursor >= cclosure->nupvalues)
+				return 0;
+			*edge = WalkUpvalue;
+			*index = frame->cursor;
+			*child = value_item(&cclosure->upvalue[frame->cursor++]);
+			return 1;
+		}
+		case LUA_TPROTO:
+		{
+			const Proto* proto = (const Proto*)frame->item.obj;
+			size_t cursor = frame->cursor++;
+			if (cursor < (size_t)proto->sizeupvalues)
+			{
+				const TString* name = proto->upvalues[cursor].name;
+				*edge = WalkUpvalueName;
+				*index = cursor;
+				*child = object_item(name != NULL ? name->tt : LUA_TNIL, name);
+				return 1;
+			}
+			cursor -= proto->sizeupvalues;
+			if (cursor < (size_t)proto->sizek)
+			{
+				*edge = WalkConstant;
+				*index = cursor;
+				*child = value_item(&proto->k[cursor]);
+				return 1;
+			}
+			cursor -= proto->sizek;
+			if (cursor < (size_t)proto->sizep)
+			{
+				*edge = WalkChildProto;
+				*index = cursor;
+				*child = object_item(LUA_TPROTO, proto->p[cursor]);
+				return 1;
+			}
+			return 0;
+		}
+		case LUA_TUSERDATA:
+		{
+			const Udata* udata = (const Udata*)frame->item.obj;
+			if (frame->cursor == 0 && udata->metatable != NULL)
+			{
+				++frame->cursor;
+				*edge = WalkMetatable;
+				*index = 0;
+				*child = object_item(LUA_TTABLE, udata->metatable);
+				return 1;
+			}
+			/*	User value is kept out of value, so only its object is walked	*/
+			if (frame->cursor > 1 || (udata->ttuv_ & BIT_ISCOLLECTABLE) == 0)
+				return 0;
+			frame->cursor = 2;
+			*edge = WalkUserValue;
+			*index = 0;
+			*child = object_item(udata->user_.gc->tt, udata->user_.gc);
+			return 1;
+		}
+		case LUA_TTHREAD:
+		{
+			/*	Slots above top are not cleared, so they are not walked	*/
+			const lua_State* thread = (const lua_State*)frame->item.obj;
+			if (thread->stack == NULL || frame->cursor >= (size_t)(thread->top - thread->stack))
+				return 0;
+			*edge = WalkStackSlot;
+			*index = frame->cursor;
+			*child = value_item(thread->stack + frame->cursor++);
+			return 1;
+		}
+		default:
+			return 0;
+	}
+}
+
+/*
+		Pushes walked item to work stack of walker
+		Params: walker, item, remaining depth of item
+		Return: push result (zero means out of memory)
+*/
+static int walk_push(ObjectWalker* walker, const WalkItem* item, const int depth)
+{
+	if (walker->count == walker->capacity)
+	{
+		const size_t capacity = walker->capacity != 0 ? walker->capacity * 2 : WALK_STACK_SIZE;
+		WalkFrame* frames = (WalkFrame*)realloc(walker->frames, capacity * sizeof(WalkFrame));
+		if (frames == 0)
+			return 0;
+		walker->frames = frames;
+		walker->capacity = capacity;
+	}
+	WalkFrame* frame = &walker->frames[walker->count++];
+	frame->item = *item;
+	frame->depth = depth;
+	frame->cursor = 0;
+	frame->followed = 0;
+	return 1;
+}
+
+/*
+		Initializes object walker
+		Params: walker, visitor, lua state, user data of visitor
+		Return: none
+*/
+static void walker_init(ObjectWalker* walker, const WalkVisitor* visitor, lua_State* L, void* ud)
+{
+	memset(walker, 0, sizeof(ObjectWalker));
+	walker->visitor = visitor;
+	walker->L = L;
+	walker->ud = ud;
+}
+
+/*
+		Releases memory of object walker
+		Params: walker
+		Return: none
+*/
+static void walker_release(ObjectWalker* walker)
+{
+	free(walker->frames);
+	free(walker->visited.keys);
+	free(walker->visited.ids);
+	memset(walker, 0, sizeof(ObjectWalker));
+}
+
+/*
+		Walks graph of objects from root item. Walk uses explicit work stack, so native stack is bounded
+		Params: walker, root item, depth of root item
+		Return: walk result (zero means walk is stopped by visitor or out of memory)
+*/
+static int walk(ObjectWalker* walker, const WalkItem* root, const int depth)
+{
+	const WalkVisitor* visitor = walker->visitor;
+	if (visitor->enter(walker, root, depth) && !walk_push(walker, root, depth))
+		walker->stopped = 1;
+	while (walker->count > 0 && !walker->stopped)
+	{
+		WalkFrame* frame = &walker->frames[walker->count - 1];
+		WalkEdge edge;
+		size_t index = 0;
+		WalkItem child;
+		if (!walk_next_child(frame, &edge, &index, &child))
+		{
+			if (visitor->leave != NULL)
+				visitor->leave(walker, &frame->item, frame->followed);
+			--walker->count;
+			continue;
+		}
+		if (visitor->edge != NULL && !visitor->edge(walker, &frame->item, edge, index, frame->followed))
+			continue;
+		++frame->followed;
+		const int child_depth = frame->depth - 1;
+		if (visitor->enter(walker, &child, child_depth) && !walk_push(walker, &child, child_depth))
+		{
+			ldv_log(0, "Object walker is out of memory\n");
+			walker->stopped = 1;
+		}
+	}
+	walker->count = 0;
+	return !walker->stopped;
+}
+
+/*
+		Checks walked object (enter callback of pointer checker)
+		Params: walker, item, remaining depth
+		Return: flag, whether children of object are walked
+*/
+static int check_enter(ObjectWalker* walker, const WalkItem* item, const int depth)
+{
+	LDV_UNUSED(depth)
+	if (item->obj == NULL || item->type == LUA_TLCF || item->type == LUA_TLIGHTUSERDATA)
+		return 0;
+	const size_t cell = walker->visited.capacity != 0 ? visited_cell(&walker->visited, item->obj) : 0;
+	if (walker->visited.capacity != 0 && walker->visited.keys[cell] != 0)
+		return 0;
+	visited_insert(&walker->visited, item->obj);
+	const GCObject* gcobj = (const GCObject*)item->obj;
+	if (!check_ptr(ldv_state_heap(walker->L), gcobj) || !check_gcobject(walker->L, gcobj))
+	{
+		walker->stopped = 1;
+		return 0;
+	}
+	return 1;
+}
+
+/*
+		Enters walked value (enter callback of dumper)
+		Params: walker, item, remaining depth
+		Return: flag, whether children of value are walked
+*/
+static int dump_enter(ObjectWalker* walker, const WalkItem* item, const int depth)
+{
+	lua_State* L = walker->L;
+	if (depth <= 0)
+	{
+		ldv_log(0, "....");
+		return 0;
+	}
+	switch (item->type)
+	{
+		case LUA_TTABLE:
+			if (dump_visit(item->obj))
+				return 0;
+			ldv_log(0, "{");
+			return 1;
+		case LUA_TLCL:
+			if (dump_visit(item->obj))
+				return 0;
+			ldv_log(0, "LuaClosure (");
+			return 1;
+		case LUA_TPROTO:
+		{
+			const Proto* proto = (const Proto*)item->obj;
+			if (dump_visit(proto))
+				return 0;
+			ldv_log(0, "Proto(up %i, csize %i, ksize %i) (", proto->sizeupvalues, proto->sizecode, proto->sizek);
+			return 1;
+		}
+		case LUA_TNIL:			 ldv_dump_nil(depth, L, item->value);										return 0;
+		case LUA_TBOOLEAN:		 ldv_dump_boolean(depth, L, bvalue(item->value));							return 0;
+		case LUA_TCCL:			 ldv_dump_c_closure(depth, L, (const CClosure*)item->obj);					return 0;
+		case LUA_TLCF:			 ldv_dump_c_light_func(depth, L, fvalue(item->value));						return 0;
+		case LUA_TNUMFLT:		 ldv_dump_float_number(depth, L, fltvalue(item->value));					return 0;
+		case LUA_TNUMINT:		 ldv_dump_int_number(depth, L, ivalue(item->value));						return 0;
+		case LUA_TTHREAD:		 ldv_dump_thread(depth, L, (lua_State*)item->obj);							return 0;
+		case LUA_TUSERDATA:		 ldv_dump_user_data(depth, L, getudatamem((const Udata*)item->obj));		return 0;
+		case LUA_TLIGHTUSERDATA: ldv_dump_light_user_data(depth, L, pvalue(item->value));					return 0;
+		case LUA_TSHRSTR:		 ldv_dump_short_string(depth, L, (const TString*)item->obj);				return 0;
+		case LUA_TLNGSTR:		 ldv_dump_long_string(depth, L, (const TString*)item->obj);				return 0;
+		default:
+			ldv_log(0, "(ldv_dump_value func). Not recognized type: %s \n", ttypename(novariant(item->type)));
+			return 0;
+	}
+}
+
+/*
+		Prints separators before child of dumped value (edge callback of dumper)
+		Params: walker, parent item, edge, index of edge, count of dumped children
+		Return: flag, whether child is dumped
+*/
+static int dump_edge(ObjectWalker* walker, const WalkItem* parent, const WalkEdge edge, const size_t index, const size_t followed)
+{
+	LDV_UNUSED(walker)
+	switch (edge)
+	{
+		case WalkArrayItem:
+			ldv_log(0, followed != 0 ? ",[%i]=" : "[%i]=", (int)index);
+			return 1;
+		case WalkNodeKey:
+			ldv_log(0, followed != 0 ? ",[" : "[");
+			return 1;
+		case WalkNodeValue:
+			ldv_log(0, "]=");
+			return 1;
+		case WalkUpvalue:
+		{
+			if (parent->type != LUA_TLCL)
+				return 0;
+			const UpVal* upval = ((const LClosure*)parent->obj)->upvals[index];
+			if (upval != NULL)
+				ldv_log(0, "%sUpval(%i, %i) ", index != 0 ? "," : "", (int)upval->refcount, upisopen(upval));
+			return 1;
+		}
+		case WalkProto:
+			ldv_log(0, "%s) ", ((const LClosure*)parent->obj)->nupvalues != 0 ? "," : "");
+			return 1;
+		case WalkUpvalueName:
+			ldv_log(0, index != 0 ? "," : "");
+			return 1;
+		default:
+			return 0;
+	}
+}
+
+/*
+		Closes dumped value (leave callback of dumper)
+		Params: walker, item, count of dumped children
+		Return: none
+*/
+static void dump_leave(ObjectWalker* walker, const WalkItem* item, const size_t followed)
+{
+	LDV_UNUSED(walker)
+	if (item->type == LUA_TTABLE)
+		ldv_log(0, "}");
+	else if (item->type == LUA_TPROTO)
+		ldv_log(0, "%s)", followed != 0 ? "," : "");
+}
+
+//		Visitor of pointer checker
+static const WalkVisitor check_visitor = { check_enter, NULL, NULL };
+//		Visitor of dumper
+static const WalkVisitor dump_visitor = { dump_enter, dump_edge, dump_leave };
+
+/*
+		Dumps walked item
+		Params: dump depth, lua state, item
+		Return: none
+*/
+static void dump_item(const int depth, lua_State* L, const WalkItem* item)
+{
+	dump_session_begin();
+	ObjectWalker walker;
+	walker_init(&walker, &dump_visitor, L, NULL);
+	walk(&walker, item, depth);
+	walker_release(&walker);
+	dump_session_end();
+}
+/*			PRIVATE FUNCS END			*/	
+
+/*
+		Gets cell of block in table of block tags
+		Params: block tags, block address
+		Return: index of cell, which holds tag of block or empty cell for it
+*/
+static size_t tag_cell(const BlockTags* tags, const void* ptr)
+{
+	const size_t mask = tags->capacity - 1;
+	size_t cell = (size_t)(((uintptr_t)ptr >> 3) * 0x9E3779B97F4A7C15ull) & mask;
+	while (tags->cells[cell].ptr != 0 && tags->cells[cell].ptr != ptr)
+		cell = (cell + 1) & mask;
+	return cell;
+}
+
+/*
+		Adds tag of block. Table grows twice, when it is half full
+		Params: block tags, tag
+		Return: error code (0 - success)
+*/
+static int tag_insert(BlockTags* tags, const BlockTag* tag)
+{
+	if ((tags->count + 1) * 2 > tags->capacity)
+	{
+		BlockTags grown = *tags;
+		grown.capacity = tags->capacity != 0 ? tags->capacity * 2 : TAG_SET_SIZE;
+		grown.cells = (BlockTag*)calloc(grown.capacity, sizeof(BlockTag));
+		if (grown.cells == 0)
+			return 1;
+		for (size_t i = 0; i < tags->capacity; ++i)
+		{
+			if (tags->cells[i].ptr != 0)
+				grown.cells[tag_cell(&grown, tags->cells[i].ptr)] = tags->cells[i];
+		}
+		free(tags->cells);
+		tags->cells = grown.cells;
+		tags->capacity = grown.capacity;
+	}
+	tags->cells[tag_cell(tags, tag->ptr)] = *tag;
+	++tags->count;
+	return 0;
+}
+
+/*
+		Removes tag of block. Cells of probe chain are shifted back, so table needs no marks of removed tags
+		Params: block tags, block address, removed tag (out)
+		Return: flag, whether block was tagged
+*/
+static int tag_remove(BlockTags* tags, const void* ptr, BlockTag* tag)
+{
+	if (tags->count == 0)
+		return 0;
+	const size_t mask = tags->capacity - 1;
+	size_t cell = tag_cell(tags, ptr);
+	if (tags->cells[cell].ptr == 0)
+		return 0;
+	*tag = tags->cells[cell];
+	for (size_t next = (cell + 1) & mask; tags->cells[next].ptr != 0; next = (next + 1) & mask)
+	{
+		const size_t home = (size_t)(((uintptr_t)tags->cells[next].ptr >> 3) * 0x9E3779B97F4A7C15ull) & mask;
+		if (((next - home) & mask) >= ((next - cell) & mask))
+		{
+			tags->cells[cell] = tags->cells[next];
+			cell = next;
+		}
+	}
+	tags->cells[cell].ptr = 0;
+	--tags->count;
+	return 1;
+}
+
+/*
+		Adds allocation site to index of sites. Index grows twice, when it is half full
+		Params: block tags, index of site
+		Return: error code (0 - success)
+*/
+static int tag_index_site(BlockTags* tags, const unsigned int site)
+{
+	if ((size_t)(tags->site_count + 1) * 2 > tags->site_cell_capacity)
+	{
+		const size_t capacity = tags->site_cell_capacity != 0 ? tags->site_cell_capacity * 2 : TAG_SITE_COUNT * 2;
+		unsigned int* cells = (unsigned int*)calloc(capacity, sizeof(unsigned int));
+		if (cells == 0)
+			return 1;
+		free(tags->site_cells);
+		tags->site_cells = cells;
+		tags->site_cell_capacity = capacity;
+		/*	Unknown site is not indexed	*/
+		for (unsigned int i = 1; i < tags->site_count; ++i)
+		{
+			if (i != site)
+				tag_index_site(tags, i);
+		}
+	}
+	const size_t mask = tags->site_cell_capacity - 1;
+	size_t cell = tags->sites[site].hash & mask;
+	while (tags->site_cells[cell] != 0)
+		cell = (cell + 1) & mask;
+	tags->site_cells[cell] = site + 1;
+	return 0;
+}
+
+/*
+		Finds allocation site of running lua function. C functions are skipped, so their memory is
+		attributed to lua line, which calls them
+		Params: block tags, running coroutine (NULL - state of tags is running)
+		Return: index of site (0 - unknown site)
+*/
+static unsigned int tag_site(BlockTags* tags, const lua_State* running)
+{
+	if (tags->L == NULL)
+		return 0;
+	const CallInfo* ci = running != NULL ? running->ci : tags->L->ci;
+	while (ci != NULL && !isLua(ci))
+		ci = ci->previous;
+	if (ci == NULL)
+		return 0;
+	const Proto* proto = ci_func(ci)->p;
+	const int pc = pcRel(ci->u.l.savedpc, proto);
+	const int line = 0 <= pc && pc < proto->sizelineinfo ? getfuncline(proto, pc) : -1;
+	const char* source = proto->source != NULL ? getstr(proto->source) : "?";
+	size_t hash = 0xCBF29CE484222325ull ^ (size_t)line;
+	for (const char* c = source; *c != '\0'; ++c)
+		hash = (hash ^ (unsigned char)*c) * 0x100000001B3ull;
+	const size_t mask = tags->site_cell_capacity - 1;
+	for (size_t cell = hash & mask; tags->site_cell_capacity != 0 && tags->site_cells[cell] != 0; cell = (cell + 1) & mask)
+	{
+		const TagSite* site = &tags->sites[tags->site_cells[cell] - 1];
+		if (site->hash == hash && site->line == line && strcmp(site->source, source) == 0)
+			return tags->site_cells[cell] - 1;
+	}
+	if (tags->site_count == tags->site_capacity)
+	{
+		const unsigned int capacity = tags->site_capacity * 2;
+		TagSite* sites = (TagSite*)realloc(tags->sites, capacity * sizeof(TagSite));
+		if (sites == 0)
+			return 0;
+		tags->sites = sites;
+		tags->site_capacity = capacity;
+	}
+	TagSite* site = &tags->sites[tags->site_count];
+	memset(site, 0, sizeof(TagSite));
+	site->source = (char*)malloc(strlen(source) + 1);
+	if (site->source == 0)
+		return 0;
+	strcpy(site->source, source);
+	site->line = line;
+	site->hash = hash;
+	if (tag_index_site(tags, tags->site_count) != 0)
+	{
+		free(site->source);
+		return 0;
+	}
+	return tags->site_count++;
+}
+
+/*
+		Updates tags with (re)allocation or free of block. Blocks, which were allocated before tagging, stay untagged
+		Params: heap, old block (NULL - new object), new block (NULL - block is freed), old size (lua type of new object), new size
+		Return: none
+*/
+static void tag_block(ldv_heap* heap, const void* ptr, const void* mem, size_t osize, size_t nsize)
+{
+	BlockTags* tags = &heap->tags;
+	BlockTag tag;
+	if (ptr == NULL)
+	{
+		if (!tags->enabled)
+			return;
+		/*	Lua passes type of new object as old size (0 - memory, which is not lua object)	*/
+		tag.type = (unsigned char)(osize < TAG_TYPE_COUNT ? osize : LUA_TNIL);
+		tag.site = tag_site(tags, heap->running);
+	}
+	else
+	{
+		if (!tag_remove(tags, ptr, &tag))
+			return;
+		tags->types[tag.type].live_bytes -= osize;
+		--tags->types[tag.type].live_blocks;
+		tags->sites[tag.site].counter.live_bytes -= osize;
+		--tags->sites[tag.site].counter.live_blocks;
+	}
+	if (mem == NULL)
+		return;
+	tag.ptr = mem;
+	if (tag_insert(tags, &tag) != 0)
+		return;
+	tags->types[tag.type].live_bytes += nsize;
+	++tags->types[tag.type].live_blocks;
+	tags->sites[tag.site].counter.live_bytes += nsize;
+	++tags->sites[tag.site].counter.live_blocks;
+}
+
+/*
+		Forgets tags of all blocks (blocks of heap are supposed to be released). Allocation sites are kept
+		Params: block tags
+		Return: none
+*/
+static void tag_clear(BlockTags* tags)
+{
+	free(tags->cells);
+	tags->cells = 0;
+	tags->capacity = 0;
+	tags->count = 0;
+	memset(tags->types, 0, sizeof(tags->types));
+	for (unsigned int i = 0; i < tags->site_count; ++i)
+		memset(&tags->sites[i].counter, 0, sizeof(TagCounter));
+}
+
+/*
+		Gets name of lua type variant, which is kept in block tag
+		Params: type variant
+		Return: name of type
+*/
+static const char* tag_type_name(const int type)
+{
+	switch (type)
+	{
+		case LUA_TSHRSTR:		return "short string";
+		case LUA_TLNGSTR:		return "long string";
+		case LUA_TTABLE:		return "table";
+		case LUA_TLCL:			return "lua closure";
+		case LUA_TCCL:			return "c closure";
+		case LUA_TUSERDATA:		return "userdata";
+		case LUA_TTHREAD:		return "thread";
+		case LUA_TPROTO:		return "proto";
+		case LUA_TNIL:			return "memory";
+		default:				return "unknown";
+	}
+}
+
+/*
+		Compares report entries by live bytes (descending order)
+		Params: entries
+		Return: comparison result
+*/
+static int tag_entry_compare(const void* left, const void* right)
+{
+	const size_t left_bytes = ((const ldv_tag_entry*)left)->live_bytes;
+	const size_t right_bytes = ((const ldv_tag_entry*)right)->live_bytes;
+	return left_bytes < right_bytes ? 1 : left_bytes > right_bytes ? -1 : 0;
+}
+
+/*
+		Gets count of bytes till next sample. Interval is exponentially distributed with mean bytes of sampler
+		Params: sampler
+		Return: count of bytes
+*/
+static size_t sample_interval(AllocSampler* sampler)
+{
+	/*	xorshift64* generator	*/
+	sampler->random ^= sampler->random >> 12;
+	sampler->random ^= sampler->random << 25;
+	sampler->random ^= sampler->random >> 27;
+	const uint64_t value = sampler->random * 0x2545F4914F6CDD1Dull;
+	const double uniform = ((double)(value >> 11) + 1.0) / 9007199254740992.0;
+	return (size_t)(-log(uniform) * (double)sampler->mean_bytes) + 1;
+}
+
+/*
+		Writes name of frame of sampled stack. Separators of folded stacks are replaced in name
+		Params: output (SAMPLE_NAME_SIZE + 1 bytes), call info of frame
+		Return: length of name
+*/
+static size_t sample_frame(char* out, const CallInfo* ci)
+{
+	int length = 0;
+	if (isLua(ci))
+	{
+		const Proto* proto = ci_func(ci)->p;
+		const int pc = pcRel(ci->u.l.savedpc, proto);
+		const int line = 0 <= pc && pc < proto->sizelineinfo ? getfuncline(proto, pc) : -1;
+		const char* source = proto->source != NULL ? getstr(proto->source) : "?";
+		length = snprintf(out, SAMPLE_NAME_SIZE + 1, "%.*s:%i", SAMPLE_NAME_SIZE - 12, source, line);
+	}
+	else
+	{
+		const TValue* func = ci->func;
+		const lua_CFunction c_func = ttislcf(func) ? fvalue(func) : ttisCclosure(func) ? clCvalue(func)->f : NULL;
+		length = snprintf(out, SAMPLE_NAME_SIZE + 1, "C:%p", (void*)(uintptr_t)c_func);
+	}
+	if (length < 0)
+		length = 0;
+	if (length > SAMPLE_NAME_SIZE)
+		length = SAMPLE_NAME_SIZE;
+	for (int i = 0; i < length; ++i)
+	{
+		if (out[i] == ';' || out[i] == '\n' || out[i] == '\r')
+			out[i] = ' ';
+	}
+	return (size_t)length;
+}
+
+/*
+		Gets cell of folded stack in table of sampled stacks
+		Params: sampler, folded stack, hash of stack
+		Return: index of cell, which holds stack or empty cell for it
+*/
+static size_t sample_cell(const AllocSampler* sampler, const char* frames, const size_t hash)
+{
+	const size_t mask = sampler->capacity - 1;
+	size_t cell = hash & mask;
+	while (sampler->stacks[cell].frames != 0 && (sampler->stacks[cell].hash != hash || strcmp(sampler->stacks[cell].frames, frames) != 0))
+		cell = (cell + 1) & mask;
+	return cell;
+}
+
+/*
+		Counts allocated bytes in sampler. When interval is over, stack of lua state and native frames, which called
+		lua memory manager, are sampled. Sample is weighted by estimation of bytes, which it represents
+		Params: heap, count of allocated bytes, return address of allocator (frame of lua memory manager)
+		Return: none
+*/
+static void sample_allocation(ldv_heap* heap, size_t size, const void* caller)
+{
+	AllocSampler* sampler = &heap->sampler;
+	if (sampler->mean_bytes == 0)
+		return;
+	if (size < sampler->countdown)
+	{
+		sampler->countdown -= size;
+		return;
+	}
+	sampler->countdown = sample_interval(sampler);
+	const CallInfo* frames[SAMPLE_MAX_DEPTH];
+	int depth = 0;
+	if (sampler->L != NULL)
+	{
+		const lua_State* thread = heap->running != NULL ? heap->running : sampler->L;
+		for (const CallInfo* ci = thread->ci; ci != NULL && ci != &thread->base_ci && depth < SAMPLE_MAX_DEPTH; ci = ci->previous)
+			frames[depth++] = ci;
+	}
+	/*	Frames till return address of allocator are frames of ldv, frame of that address is lua memory manager,
+		which every allocation passes, so native stack starts after it (no native frames, when it is not captured)	*/
+	void* native[SAMPLE_CAPTURE_DEPTH];
+	const int captured = LDV_BACKTRACE(native, SAMPLE_CAPTURE_DEPTH);
+	int first = 0;
+	while (first < captured && native[first] != caller)
+		++first;
+	first = first < captured ? first + 1 : captured;
+	const int native_depth = captured - first < SAMPLE_NATIVE_DEPTH ? captured - first : SAMPLE_NATIVE_DEPTH;
+	/*	Stack is folded from the outermost frame, native frames are the innermost ones	*/
+	char folded[(SAMPLE_MAX_DEPTH + SAMPLE_NATIVE_DEPTH) * (SAMPLE_NAME_SIZE + 1) + 1];
+	size_t length = 0;
+	while (depth-- > 0)
+	{
+		length += sample_frame(folded + length, frames[depth]);
+		folded[length++] = ';';
+	}
+	for (int i = native_depth; i-- > 0;)
+	{
+		const int written = snprintf(folded + length, SAMPLE_NAME_SIZE + 1, "native:%p;", native[first + i]);
+		length += written > 0 ? (size_t)written : 0;
+	}
+	/*	Separator after the innermost frame is dropped, stack without frames is unknown one	*/
+	if (length != 0)
+		folded[length - 1] = '\0';
+	else
+		strcpy(folded, "?");
+	size_t hash = 0xCBF29CE484222325ull;
+	for (const char* c = folded; *c != '\0'; ++c)
+		hash = (hash ^ (unsigned char)*c) * 0x100000001B3ull;
+	if ((sampler->count + 1) * 2 > sampler->capacity)
+	{
+		AllocSampler grown = *sampler;
+		grown.capacity = sampler->capacity != 0 ? sampler->capacity * 2 : SAMPLE_SET_SIZE;
+		grown.stacks = (SampledStack*)calloc(grown.capacity, sizeof(SampledStack));
+		if (grown.stacks == 0)
+			return;
+		for (size_t i = 0; i < sampler->capacity; ++i)
+		{
+			if (sampler->stacks[i].frames != 0)
+				grown.stacks[sample_cell(&grown, sampler->stacks[i].frames, sampler->stacks[i].hash)] = sampler->stacks[i];
+		}
+		free(sampler->stacks);
+		sampler->stacks = grown.stacks;
+		sampler->capacity = grown.capacity;
+	}
+	SampledStack* stack = &sampler->stacks[sample_cell(sampler, folded, hash)];
+	if (stack->frames == 0)
+	{
+		stack->frames = (char*)malloc(strlen(folded) + 1);
+		if (stack->frames == 0)
+			return;
+		strcpy(stack->frames, folded);
+		stack->hash = hash;
+		++sampler->count;
+	}
+	++stack->count;
+	stack->bytes += (double)size / (1.0 - exp(-(double)size / (double)sampler->mean_bytes));
+}
+
+/*
+		Gets monotonic time of allocation trace
+		Params: none
+		Return: time in nanoseconds
+*/
+static uint64_t trace_time(void)
+{
+#ifdef _WIN32
+	LARGE_INTEGER counter, frequency;
+	QueryPerformanceCounter(&counter);
+	QueryPerformanceFrequency(&frequency);
+	return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/*
+		Gets cell of block in table of trace ids
+		Params: trace, block address
+		Return: index of cell, which holds id of block or empty cell for it
+*/
+static size_t trace_cell(const AllocTrace* trace, const void* ptr)
+{
+	const size_t mask = trace->capacity - 1;
+	size_t cell = (size_t)(((uintptr_t)ptr >> 3) * 0x9E3779B97F4A7C15ull) & mask;
+	while (trace->cells[cell].ptr != 0 && trace->cells[cell].ptr != ptr)
+		cell = (cell + 1) & mask;
+	return cell;
+}
+
+/*
+		Sets id of block. Table grows twice, when it is half full
+		Params: trace, block address, id
+		Return: error code (0 - success)
+*/
+static int trace_insert(AllocTrace* trace, const void* ptr, uint32_t id)
+{
+	if ((trace->count + 1) * 2 > trace->capacity)
+	{
+		AllocTrace grown = *trace;
+		grown.capacity = trace->capacity != 0 ? trace->capacity * 2 : TRACE_SET_SIZE;
+		grown.cells = (TraceCell*)calloc(grown.capacity, sizeof(TraceCell));
+		if (grown.cells == 0)
+			return 1;
+		for (size_t i = 0; i < trace->capacity; ++i)
+		{
+			if (trace->cells[i].ptr != 0)
+				grown.cells[trace_cell(&grown, trace->cells[i].ptr)] = trace->cells[i];
+		}
+		free(trace->cells);
+		trace->cells = grown.cells;
+		trace->capacity = grown.capacity;
+	}
+	TraceCell* cell = &trace->cells[trace_cell(trace, ptr)];
+	if (cell->ptr == 0)
+		++trace->count;
+	cell->ptr = ptr;
+	cell->id = id;
+	return 0;
+}
+
+/*
+		Removes id of block. Cells of probe chain are shifted back, so table needs no marks of removed ids
+		Params: trace, block address, removed id (out)
+		Return: flag, whether block has id
+*/
+static int trace_remove(AllocTrace* trace, const void* ptr, uint32_t* id)
+{
+	if (trace->count == 0)
+		return 0;
+	const size_t mask = trace->capacity - 1;
+	size_t cell = trace_cell(trace, ptr);
+	if (trace->cells[cell].ptr == 0)
+		return 0;
+	*id = trace->cells[cell].id;
+	for (size_t next = (cell + 1) & mask; trace->cells[next].ptr != 0; next = (next + 1) & mask)
+	{
+		const size_t home = (size_t)(((uintptr_t)trace->cells[next].ptr >> 3) * 0x9E3779B97F4A7C15ull) & mask;
+		if (((next - home) & mask) >= ((next - cell) & mask))
+		{
+			trace->cells[cell] = trace->cells[next];
+			cell = next;
+		}
+	}
+	trace->cells[cell].ptr = 0;
+	--trace->count;
+	return 1;
+}
+
+/*
+		Writes buffered records to trace file
+		Params: trace
+		Return: none
+*/
+static void trace_flush(AllocTrace* trace)
+{
+	if (!trace->failed && trace->size != 0 && fwrite(trace->buf, 1, trace->size, trace->file) != trace->size)
+		trace->failed = 1;
+	trace->size = 0;
+}
+
+/*
+		Appends unsigned LEB128 number to buffered record
+		Params: trace, number
+		Return: none
+*/
+static void trace_number(AllocTrace* trace, uint64_t value)
+{
+	while (value >= 0x80)
+	{
+		trace->buf[trace->size++] = (unsigned char)(value | 0x80);
+		value >>= 7;
+	}
+	trace->buf[trace->size++] = (unsigned char)value;
+}
+
+/*
+		Records successful (re)allocation or free of block
+		Params: trace, old block (NULL - new object), old size (lua type of new object), new size, new block
+		Return: none
+*/
+static void trace_record(AllocTrace* trace, const void* ptr, size_t osize, size_t nsize, const void* mem)
+{
+	if (trace->failed || (nsize != 0 && mem == NULL))
+		return;
+	uint32_t id = 0;
+	ldv_trace_op op = LDV_TRACE_REALLOC;
+	if (ptr == NULL || !trace_remove(trace, ptr, &id))
+	{
+		/*	Block, which was allocated before recording, is seen, when it is reallocated	*/
+		if (nsize == 0)
+			return;
+		op = LDV_TRACE_MALLOC;
+		if (ptr != NULL)
+			osize = 0;
+		id = trace->free_count != 0 ? trace->free_ids[--trace->free_count] : trace->id_count++;
+	}
+	else if (nsize == 0)
+	{
+		op = LDV_TRACE_FREE;
+		if (trace->free_count == trace->free_capacity)
+		{
+			const size_t capacity = trace->free_capacity != 0 ? trace->free_capacity * 2 : TRACE_SET_SIZE;
+			uint32_t* free_ids = (uint32_t*)realloc(trace->free_ids, capacity * sizeof(uint32_t));
+			if (free_ids == 0)
+			{
+				trace->failed = 1;
+				return;
+			}
+			trace->free_ids = free_ids;
+			trace->free_capacity = capacity;
+		}
+		trace->free_ids[trace->free_count++] = id;
+	}
+	if (mem != NULL && trace_insert(trace, mem, id) != 0)
+	{
+		trace->failed = 1;
+		return;
+	}
+	if (trace->size + LDV_TRACE_RECORD_SIZE > TRACE_BUFF_SIZE)
+		trace_flush(trace);
+	const uint64_t now = trace_time();
+	trace->buf[trace->size++] = (unsigned char)op;
+	trace_number(trace, id);
+	trace_number(trace, osize);
+	if (op != LDV_TRACE_FREE)
+		trace_number(trace, nsize);
+	trace_number(trace, now - trace->last_time);
+	trace->last_time = now;
+	++trace->header.record_count;
+}
+
+/*
+		Writes data to snapshot file through buffer of writer
+		Params: writer, data, size of data
+		Return: none
+*/
+static void snapshot_write(SnapshotWriter* writer, const void* data, size_t size)
+{
+	if (writer->failed)
+		return;
+	if (writer->size + size > SNAPSHOT_BUFF_SIZE)
+	{
+		if (writer->size != 0 && fwrite(writer->buf, 1, writer->size, writer->file) != writer->size)
+			writer->failed = 1;
+		writer->size = 0;
+		/*	Large data skips buffer	*/
+		if (size > SNAPSHOT_BUFF_SIZE)
+		{
+			if (!writer->failed && fwrite(data, 1, size, writer->file) != size)
+				writer->failed = 1;
+			writer->written += size;
+			return;
+		}
+	}
+	memcpy(writer->buf + writer->size, data, size);
+	writer->size += size;
+	writer->written += size;
+}
+
+/*
+		Adds name of object to names of snapshot
+		Params: writer, format of name
+		Return: offset of name (0 - empty name)
+*/
+static uint64_t snapshot_name(SnapshotWriter* writer, const char* format, ...)
+{
+	if (writer->name_bytes + LDV_SNAPSHOT_NAME_SIZE + 1 > writer->name_capacity)
+	{
+		const size_t capacity = writer->name_capacity * 2 + LDV_SNAPSHOT_NAME_SIZE + 1;
+		char* names = (char*)realloc(writer->names, capacity);
+		if (names == 0)
+			return 0;
+		writer->names = names;
+		writer->name_capacity = capacity;
+	}
+	va_list args;
+	va_start(args, format);
+	int length = vsnprintf(writer->names + writer->name_bytes, LDV_SNAPSHOT_NAME_SIZE + 1, format, args);
+	va_end(args);
+	if (length <= 0)
+		return 0;
+	const uint64_t name = writer->name_bytes;
+	writer->name_bytes += strlen(writer->names + writer->name_bytes) + 1;
+	return name;
+}
+
+/*
+		Gets size of gc object with its own arrays
+		Params: gc object
+		Return: size in bytes
+*/
+static size_t object_size(const GCObject* gcobj)
+{
+	switch (gcobj->tt)
+	{
+		case LUA_TSHRSTR:
+		case LUA_TLNGSTR:
+			return sizelstring(tsslen(gco2ts(gcobj)));
+		case LUA_TTABLE:
+		{
+			const Table* table = gco2t(gcobj);
+			return sizeof(Table) + table->sizearray * sizeof(TValue) + (isdummy(table) ? 0 : sizenode(table) * sizeof(Node));
+		}
+		case LUA_TLCL:
+			return sizeLclosure(gco2lcl(gcobj)->nupvalues);
+		case LUA_TCCL:
+			return sizeCclosure(gco2ccl(gcobj)->nupvalues);
+		case LUA_TUSERDATA:
+			return sizeludata(gco2u(gcobj)->len);
+		case LUA_TTHREAD:
+		{
+			const lua_State* thread = gco2th(gcobj);
+			return LUA_EXTRASPACE + sizeof(lua_State) + thread->stacksize * sizeof(TValue) + thread->nci * sizeof(CallInfo);
+		}
+		case LUA_TPROTO:
+		{
+			const Proto* proto = gco2p(gcobj);
+			return sizeof(Proto) + proto->sizek * sizeof(TValue) + proto->sizecode * sizeof(Instruction) + proto->sizep * sizeof(Proto*)
+				+ proto->sizelineinfo * sizeof(int) + proto->sizelocvars * sizeof(LocVar) + proto->sizeupvalues * sizeof(Upvaldesc);
+		}
+		default:
+			return 0;
+	}
+}
+
+/*
+		Gets short name of gc object: contents of string, source of function or address of C function
+		Params: gc object, name buffer (out), size of buffer
+		Return: none (empty name for other objects)
+*/
+static void object_name(const GCObject* gcobj, char* name, const size_t size)
+{
+	name[0] = '\0';
+	switch (gcobj->tt)
+	{
+		case LUA_TSHRSTR:
+		case LUA_TLNGSTR:
+		{
+			const TString* str = gco2ts(gcobj);
+			snprintf(name, size, "%.*s", (int)(tsslen(str) < size ? tsslen(str) : size), getstr(str));
+			break;
+		}
+		case LUA_TLCL:
+		{
+			const Proto* proto = gco2lcl(gcobj)->p;
+			if (proto != NULL)
+				snprintf(name, size, "%s:%i", proto->source != NULL ? getstr(proto->source) : "?", proto->linedefined);
+			break;
+		}
+		case LUA_TCCL:
+			snprintf(name, size, "C:%p", (void*)(uintptr_t)gco2ccl(gcobj)->f);
+			break;
+		case LUA_TPROTO:
+		{
+			const Proto* proto = gco2p(gcobj);
+			snprintf(name, size, "%s:%i", proto->source != NULL ? getstr(proto->source) : "?", proto->linedefined);
+			break;
+		}
+		default:
+			break;
+	}
+}
+
+/*
+		Fills snapshot record of gc object: type, size with own arrays and name
+		Params: writer, gc object, record (out)
+		Return: none
+*/
+static void snapshot_object(SnapshotWriter* writer, const GCObject* gcobj, ldv_snapshot_object* record)
+{
+	memset(record, 0, sizeof(ldv_snapshot_object));
+	record->address = (uint64_t)(uintptr_t)gcobj;
+	record->size = object_size(gcobj);
+	switch (gcobj->tt)
+	{
+		case LUA_TSHRSTR:
+		case LUA_TLNGSTR:	record->type = LDV_SNAPSHOT_STRING;		break;
+		case LUA_TTABLE:	record->type = LDV_SNAPSHOT_TABLE;		break;
+		case LUA_TLCL:		record->type = LDV_SNAPSHOT_LCLOSURE;	break;
+		case LUA_TCCL:		record->type = LDV_SNAPSHOT_CCLOSURE;	break;
+		case LUA_TUSERDATA:	record->type = LDV_SNAPSHOT_USERDATA;	break;
+		case LUA_TTHREAD:	record->type = LDV_SNAPSHOT_THREAD;		break;
+		case LUA_TPROTO:	record->type = LDV_SNAPSHOT_PROTO;		break;
+		default:			break;
+	}
+	char name[LDV_SNAPSHOT_NAME_SIZE + 1];
+	object_name(gcobj, name, sizeof(name));
+	if (name[0] != '\0')
+		record->name = snapshot_name(writer, "%s", name);
+}
+
+/*
+		Writes references of gc object. Only references to objects of snapshot are written
+		Params: writer, ids of objects (id is index of object + 1), gc object
+		Return: none
+*/
+static void snapshot_edges(SnapshotWriter* writer, const VisitedSet* ids, const GCObject* gcobj)
+{
+	/*	Edge kinds of walker and snapshot follow same order	*/
+	static const uint32_t edge_kinds[] = { LDV_SNAPSHOT_ARRAY_ITEM, LDV_SNAPSHOT_NODE_KEY, LDV_SNAPSHOT_NODE_VALUE, LDV_SNAPSHOT_METATABLE,
+		LDV_SNAPSHOT_UPVALUE, LDV_SNAPSHOT_PROTO_REF, LDV_SNAPSHOT_UPVALUE_NAME, LDV_SNAPSHOT_CONSTANT, LDV_SNAPSHOT_CHILD_PROTO,
+		LDV_SNAPSHOT_USER_VALUE, LDV_SNAPSHOT_STACK_SLOT };
+	WalkFrame frame;
+	memset(&frame, 0, sizeof(WalkFrame));
+	frame.item = object_item(gcobj->tt, gcobj);
+	const size_t from = ids->ids[visited_cell(ids, gcobj)] - 1;
+	WalkEdge edge;
+	size_t index = 0;
+	WalkItem child;
+	while (walk_next_child(&frame, &edge, &index, &child))
+	{
+		if (child.obj == NULL || child.type == LUA_TLCF || child.type == LUA_TLIGHTUSERDATA)
+			continue;
+		const size_t cell = visited_cell(ids, child.obj);
+		if (ids->keys[cell] == 0)
+			continue;
+		ldv_snapshot_edge record;
+		record.from = (uint32_t)from;
+		record.to = ids->ids[cell] - 1;
+		record.kind = edge_kinds[edge];
+		record.key = LDV_SNAPSHOT_NO_OBJECT;
+		record.index = (int64_t)index;
+		if (edge == WalkNodeValue)
+		{
+			const TValue* key = gkey(gco2t(gcobj)->node + index);
+			if (iscollectable(key))
+			{
+				const size_t key_cell = visited_cell(ids, gcvalue(key));
+				if (ids->keys[key_cell] != 0)
+					record.key = ids->ids[key_cell] - 1;
+			}
+			else if (ttisinteger(key))
+			{
+				record.index = (int64_t)ivalue(key);
+			}
+		}
+		snapshot_write(writer, &record, sizeof(record));
+		++writer->edge_count;
+	}
+}
+
+/*
+		Gets vertex of gc object in object graph
+		Params: graph, gc object
+		Return: vertex (0 - object is not in graph)
+*/
+static unsigned int graph_vertex(const ObjectGraph* graph, const void* obj)
+{
+	const size_t cell = visited_cell(&graph->ids, obj);
+	return graph->ids.keys[cell] != 0 ? graph->ids.ids[cell] : 0;
+}
+
+/*
+		Adds reference to the last vertex of object graph. Targets grow twice, when they are full
+		Params: graph, referenced vertex (0 - reference is skipped)
+		Return: result (zero means out of memory)
+*/
+static int graph_add_edge(ObjectGraph* graph, const unsigned int target)
+{
+	if (target == 0)
+		return 1;
+	if (graph->edge_count == graph->edge_capacity)
+	{
+		const size_t capacity = graph->edge_capacity != 0 ? graph->edge_capacity * 2 : VISITED_SET_SIZE;
+		unsigned int* targets = (unsigned int*)realloc(graph->targets, capacity * sizeof(unsigned int));
+		if (targets == 0)
+			return 0;
+		graph->targets = targets;
+		graph->edge_capacity = capacity;
+	}
+	graph->targets[graph->edge_count++] = target;
+	return 1;
+}
+
+/*
+		Releases object graph
+		Params: graph
+		Return: none
+*/
+static void graph_release(ObjectGraph* graph)
+{
+	free(graph->ids.keys);
+	free(graph->ids.ids);
+	free(graph->objects);
+	free(graph->first_edge);
+	free(graph->targets);
+	memset(graph, 0, sizeof(ObjectGraph));
+}
+
+/*
+		Builds reference graph of all gc objects of lua state. Virtual root refers to registry, main thread,
+		metatables of basic types, fixed objects and objects waiting for finalization
+		Params: lua state, graph (out, released by graph_release in any case)
+		Return: result (zero means out of memory)
+*/
+static int graph_build(lua_State* L, ObjectGraph* graph)
+{
+	global_State* g = G(L);
+	memset(graph, 0, sizeof(ObjectGraph));
+	/*	Main thread is not kept in lists	*/
+	GCObject* const gclists[] = { obj2gco(g->mainthread), g->allgc, g->finobj, g->tobefnz, g->fixedgc };
+	const unsigned int list_count = sizeof(gclists) / sizeof(gclists[0]);
+	size_t count = 1;
+	for (unsigned int list = 0; list < list_count; ++list)
+	{
+		for (const GCObject* gcobj = gclists[list]; gcobj != NULL; gcobj = list != 0 ? gcobj->next : NULL)
+			++count;
+	}
+	graph->objects = (const GCObject**)malloc(count * sizeof(const GCObject*));
+	graph->first_edge = (unsigned int*)malloc((count + 1) * sizeof(unsigned int));
+	if (graph->objects == 0 || graph->first_edge == 0)
+		return 0;
+	graph->objects[0] = NULL;
+	graph->count = 1;
+	for (unsigned int list = 0; list < list_count; ++list)
+	{
+		for (const GCObject* gcobj = gclists[list]; gcobj != NULL; gcobj = list != 0 ? gcobj->next : NULL)
+		{
+			if (graph->ids.capacity != 0 && graph_vertex(graph, gcobj) != 0)
+				continue;
+			if (visited_insert(&graph->ids, gcobj) == 0)
+				return 0;
+			graph->objects[graph->count++] = gcobj;
+		}
+	}
+	/*	References of virtual root	*/
+	graph->first_edge[0] = 0;
+	int added = graph_add_edge(graph, graph_vertex(graph, g->mainthread));
+	if (iscollectable(&g->l_registry))
+		added = added && graph_add_edge(graph, graph_vertex(graph, gcvalue(&g->l_registry)));
+	for (int i = 0; i < LUA_NUMTAGS; ++i)
+	{
+		if (g->mt[i] != NULL)
+			added = added && graph_add_edge(graph, graph_vertex(graph, g->mt[i]));
+	}
+	for (const GCObject* gcobj = g->tobefnz; gcobj != NULL; gcobj = gcobj->next)
+		added = added && graph_add_edge(graph, graph_vertex(graph, gcobj));
+	for (const GCObject* gcobj = g->fixedgc; gcobj != NULL; gcobj = gcobj->next)
+		added = added && graph_add_edge(graph, graph_vertex(graph, gcobj));
+	/*	References of objects	*/
+	for (size_t vertex = 1; vertex < graph->count && added; ++vertex)
+	{
+		graph->first_edge[vertex] = (unsigned int)graph->edge_count;
+		WalkFrame frame;
+		memset(&frame, 0, sizeof(WalkFrame));
+		frame.item = object_item(graph->objects[vertex]->tt, graph->objects[vertex]);
+		WalkEdge edge;
+		size_t index = 0;
+		WalkItem child;
+		while (added && walk_next_child(&frame, &edge, &index, &child))
+		{
+			if (child.obj != NULL && child.type != LUA_TLCF && child.type != LUA_TLIGHTUSERDATA)
+				added = graph_add_edge(graph, graph_vertex(graph, child.obj));
+		}
+	}
+	graph->first_edge[graph->count] = (unsigned int)graph->edge_count;
+	return added;
+}
+
+/*
+		Finds ancestor of vertex with the lowest semidominator in forest of processed vertices.
+		Path to root of the tree is compressed (Lengauer-Tarjan EVAL)
+		Params: ancestors in forest (0 - root of tree), best vertices of paths, semidominators, path buffer, linked vertex
+		Return: ancestor with the lowest semidominator
+*/
+static unsigned int dominator_eval(unsigned int* ancestor, unsigned int* best, const unsigned int* semi, unsigned int* path, const unsigned int vertex)
+{
+	size_t length = 0;
+	unsigned int top = vertex;
+	while (ancestor[ancestor[top]] != 0)
+	{
+		path[length++] = top;
+		top = ancestor[top];
+	}
+	/*	Vertices are compressed from the nearest to root, so each one takes already compressed ancestor	*/
+	while (length-- > 0)
+	{
+		const unsigned int current = path[length];
+		const unsigned int parent = ancestor[current];
+		if (semi[best[parent]] < semi[best[current]])
+			best[current] = best[parent];
+		ancestor[current] = ancestor[parent];
+	}
+	return best[vertex];
+}
+
+/*
+		Computes immediate dominators of vertices, which are reachable from virtual root (Lengauer-Tarjan algorithm).
+		Reachable vertices are numbered in depth first order from 1 (virtual root), dominators are given by these numbers
+		Params: graph, vertices by numbers (out, count of vertices + 1 items), immediate dominators by numbers
+				(out, count of vertices + 1 items, 0 for virtual root)
+		Return: count of reachable vertices (0 on out of memory)
+*/
+static size_t graph_dominators(const ObjectGraph* graph, unsigned int* order, unsigned int* idom)
+{
+	/*	Work arrays share one allocation	*/
+	const size_t count = graph->count;
+	unsigned int* work = (unsigned int*)calloc(11 * (count + 2) + graph->edge_count, sizeof(unsigned int));
+	if (work == 0)
+		return 0;
+	unsigned int* number = work;
+	unsigned int* cursor = number + (count + 2);
+	unsigned int* stack = cursor + (count + 2);
+	unsigned int* parent = stack + (count + 2);
+	unsigned int* semi = parent + (count + 2);
+	unsigned int* ancestor = semi + (count + 2);
+	unsigned int* best = ancestor + (count + 2);
+	unsigned int* samedom = best + (count + 2);
+	unsigned int* bucket = samedom + (count + 2);
+	unsigned int* bucket_next = bucket + (count + 2);
+	unsigned int* first_pred = bucket_next + (count + 2);
+	unsigned int* preds = first_pred + (count + 2);
+	/*	Depth first numbering	*/
+	size_t reached = 1;
+	size_t depth = 1;
+	stack[0] = 0;
+	number[0] = 1;
+	order[1] = 0;
+	cursor[0] = graph->first_edge[0];
+	while (depth != 0)
+	{
+		const unsigned int vertex = stack[depth - 1];
+		if (cursor[vertex] == graph->first_edge[vertex + 1])
+		{
+			--depth;
+			continue;
+		}
+		const unsigned int target = graph->targets[cursor[vertex]++];
+		if (number[target] != 0)
+			continue;
+		number[target] = (unsigned int)++reached;
+		order[reached] = target;
+		parent[reached] = number[vertex];
+		cursor[target] = graph->first_edge[target];
+		stack[depth++] = target;
+	}
+	/*	Predecessors by numbers	*/
+	for (size_t vertex = 0; vertex < count; ++vertex)
+	{
+		if (number[vertex] == 0)
+			continue;
+		for (unsigned int edge = graph->first_edge[vertex]; edge < graph->first_edge[vertex + 1]; ++edge)
+			++first_pred[number[graph->targets[edge]] + 1];
+	}
+	for (size_t i = 1; i <= reached; ++i)
+		first_pred[i + 1] += first_pred[i];
+	for (size_t vertex = 0; vertex < count; ++vertex)
+	{
+		if (number[vertex] == 0)
+			continue;
+		for (unsigned int edge = graph->first_edge[vertex]; edge < graph->first_edge[vertex + 1]; ++edge)
+			preds[first_pred[number[graph->targets[edge]]]++] = number[vertex];
+	}
+	for (size_t i = reached + 1; i > 1; --i)
+		first_pred[i] = first_pred[i - 1];
+	first_pred[1] = 0;
+	/*	Semidominators in reverse order, dominators are deferred through buckets	*/
+	for (size_t i = 1; i <= reached; ++i)
+		semi[i] = (unsigned int)i;
+	unsigned int* path = stack;
+	for (unsigned int i = (unsigned int)reached; i > 1; --i)
+	{
+		const unsigned int tree_parent = parent[i];
+		unsigned int semidominator = tree_parent;
+		for (unsigned int pred = first_pred[i]; pred < first_pred[i + 1]; ++pred)
+		{
+			const unsigned int from = preds[pred];
+			const unsigned int candidate = from <= i ? from : semi[dominator_eval(ancestor, best, semi, path, from)];
+			if (candidate < semidominator)
+				semidominator = candidate;
+		}
+		semi[i] = semidominator;
+		bucket_next[i] = bucket[semidominator];
+		bucket[semidominator] = i;
+		ancestor[i] = tree_parent;
+		best[i] = i;
+		for (unsigned int vertex = bucket[tree_parent]; vertex != 0; vertex = bucket_next[vertex])
+		{
+			const unsigned int lowest = dominator_eval(ancestor, best, semi, path, vertex);
+			if (semi[lowest] == semi[vertex])
+				idom[vertex] = tree_parent;
+			else
+				samedom[vertex] = lowest;
+		}
+		bucket[tree_parent] = 0;
+	}
+	idom[1] = 0;
+	for (size_t i = 2; i <= reached; ++i)
+	{
+		if (samedom[i] != 0)
+			idom[i] = idom[samedom[i]];
+	}
+	free(work);
+	return reached;
+}
+
+/*
+		Compares objects by retained size (descending order)
+		Params: objects
+		Return: comparison result
+*/
+static int retained_compare(const void* left, const void* right)
+{
+	const size_t left_bytes = ((const RetainedObject*)left)->retained;
+	const size_t right_bytes = ((const RetainedObject*)right)->retained;
+	return left_bytes < right_bytes ? 1 : left_bytes > right_bytes ? -1 : 0;
+}
+
+/*
+		Compares groups of long strings by wasted memory (descending order)
+		Params: groups
+		Return: comparison result
+*/
+static int group_compare(const void* left, const void* right)
+{
+	const size_t left_bytes = ((const StringGroup*)left)->wasted;
+	const size_t right_bytes = ((const StringGroup*)right)->wasted;
+	return left_bytes < right_bytes ? 1 : left_bytes > right_bytes ? -1 : 0;
+}
+
+/*
+		Compares shapes of tables by wasted memory (descending order)
+		Params: shapes
+		Return: comparison result
+*/
+static int shape_compare(const void* left, const void* right)
+{
+	const size_t left_bytes = ((const ldv_table_shape*)left)->wasted;
+	const size_t right_bytes = ((const ldv_table_shape*)right)->wasted;
+	return left_bytes < right_bytes ? 1 : left_bytes > right_bytes ? -1 : 0;
+}
+
+/*
+		Measures shape of table. Heads of chains are nodes with keys, which are not targets of next offsets
+		Params: table, marks of linked nodes (zeroed, count of nodes at least, they are zeroed back on return), shape (out)
+		Return: none
+*/
+static void measure_table(const Table* table, unsigned char* linked, ldv_table_shape* shape)
+{
+	memset(shape, 0, sizeof(ldv_table_shape));
+	shape->object = table;
+	shape->array_size = table->sizearray;
+	for (unsigned int i = 0; i < table->sizearray; ++i)
+		shape->array_used += !ttisnil(&table->array[i]);
+	if (!isdummy(table))
+	{
+		const int node_count = sizenode(table);
+		shape->node_size = (size_t)node_count;
+		for (int i = 0; i < node_count; ++i)
+		{
+			const Node* node = gnode(table, i);
+			if (ttisnil(gkey(node)))
+				continue;
+			if (ttisnil(gval(node)))
+				++shape->dead_keys;
+			else
+				++shape->node_used;
+			shape->integer_keys += ttisinteger(gkey(node)) && !ttisnil(gval(node));
+			if (gnext(node) != 0)
+				linked[i + gnext(node)] = 1;
+		}
+		for (int i = 0; i < node_count; ++i)
+		{
+			if (linked[i] || ttisnil(gkey(gnode(table, i))))
+				continue;
+			size_t length = 1;
+			for (const Node* node = gnode(table, i); gnext(node) != 0; node += gnext(node))
+				++length;
+			++shape->chains;
+			if (length > shape->max_chain)
+				shape->max_chain = length;
+		}
+		memset(linked, 0, (size_t)node_count);
+		if (shape->chains != 0)
+			shape->average_chain = (double)(shape->node_used + shape->dead_keys) / (double)shape->chains;
+	}
+	shape->wasted = (shape->array_size - shape->array_used) * sizeof(TValue) + (shape->node_size - shape->node_used) * sizeof(Node);
+}
+
+/*
+		Hashes contents of string. Contents are read by 8 byte words into four independent lanes, so iterations
+		do not wait for each other and compilers vectorize the loop
+		Params: contents, length of contents
+		Return: hash
+*/
+static uint64_t content_hash(const char* data, size_t length)
+{
+	uint64_t lanes[4] = { 0x9E3779B97F4A7C15ull, 0xC2B2AE3D27D4EB4Full, 0x165667B19E3779F9ull, 0x27D4EB2F165667C5ull };
+	uint64_t words[4];
+	size_t pos = 0;
+	for (; pos + sizeof(words) <= length; pos += sizeof(words))
+	{
+		memcpy(words, data + pos, sizeof(words));
+		for (int i = 0; i < 4; ++i)
+		{
+			lanes[i] = (lanes[i] ^ words[i]) * 0xFF51AFD7ED558CCDull;
+			lanes[i] ^= lanes[i] >> 29;
+		}
+	}
+	/*	Tail is padded by zeros, length is mixed in, so padding does not collide with zero bytes	*/
+	memset(words, 0, sizeof(words));
+	memcpy(words, data + pos, length - pos);
+	uint64_t hash = (uint64_t)length;
+	for (int i = 0; i < 4; ++i)
+	{
+		lanes[i] = (lanes[i] ^ words[i]) * 0xFF51AFD7ED558CCDull;
+		hash = (hash ^ lanes[i] ^ (lanes[i] >> 32)) * 0xC4CEB9FE1A85EC53ull;
+	}
+	return hash ^ (hash >> 33);
+}
+
+/*
+		Compares relocated parts by heap order: by regions in order of heap list, by address within region (descending order)
+		Params: parts
+		Return: comparison result
+*/
+static int relocated_compare(const void* left, const void* right)
+{
+	const RelocatedPart* left_part = (const RelocatedPart*)left;
+	const RelocatedPart* right_part = (const RelocatedPart*)right;
+	if (left_part->rank != right_part->rank)
+		return left_part->rank < right_part->rank ? 1 : -1;
+	const uintptr_t left_mem = (uintptr_t)left_part->mem;
+	const uintptr_t right_mem = (uintptr_t)right_part->mem;
+	return left_mem < right_mem ? 1 : left_mem > right_mem ? -1 : 0;
+}
+
+//	Public API implementation
+void ldv_load_lib(lua_State* L)
+{
+	luaL_requiref (L, "ldv", ldv_load_libf, 1);
+	lua_pop(L, 1);  /* remove lib */
+}
+
+ldv_heap* ldv_default_heap()
+{
+	if (!default_heap_ready)
+	{
+		default_heap_ready = 1;
+		default_heap.poison_mode = LDV_POISON_FULL;
+		default_heap.slab_enabled = 1;
+		ldv_init_heap(&default_heap, 0, 0);
+	}
+	return &default_heap;
+}
+
+ldv_heap* ldv_heap_create(size_t size, size_t max_size)
+{
+	ldv_heap* heap = (ldv_heap*)calloc(1, sizeof(ldv_heap));
+	if (heap == 0)
+		return 0;
+	heap->poison_mode = LDV_POISON_FULL;
+	heap->slab_enabled = 1;
+	if (ldv_init_heap(heap, size, max_size) != 0)
+	{
+		ldv_heap_destroy(heap);
+		return 0;
+	}
+	return heap;
+}
+
+void ldv_heap_destroy(ldv_heap* heap)
+{
+	/*	Caches of other threads are dropped, when they find heap unregistered	*/
+	registry_remove(heap);
+	if (thread_cache.heap == heap)
+		memset(&thread_cache, 0, sizeof(ThreadCache));
+	ldv_trace_stop(heap);
+	release_regions(heap);
+	ldv_set_tagging(heap, 0, NULL);
+	ldv_set_sampling(heap, 0, NULL);
+	free(heap->quarantine.blocks);
+	memset(&heap->quarantine, 0, sizeof(Quarantine));
+	if (heap != &default_heap)
+		free(heap);
+	else
+		default_heap_ready = 0;
+}
+
+ldv_heap* ldv_state_heap(lua_State* L)
+{
+	void* ud = 0;
+	if (lua_getallocf(L, &ud) != ldv_frealloc || ud == 0)
+		return ldv_default_heap();
+	return (ldv_heap*)ud;
+}
+
+int ldv_init_heap(ldv_heap* heap, size_t size, size_t max_size)
+{
+	ldv_trace_stop(heap);
+	release_regions(heap);
+	memset(&heap->stats, 0, sizeof(ldv_stats));
+	registry_renew(heap);
+	heap->check_active = 0;
+	heap->check_object = NULL;
+	heap->running = NULL;
+	tag_clear(&heap->tags);
+	heap->region_bytes = size != 0 ? size : MEM_BUFF_SIZE * sizeof(ldv_block_type);
+	heap->limit = max_size;
+	if (size == 0 && heap == &default_heap)
+		return attach_region(heap, &static_region);
+	return add_region(heap, heap->region_bytes) != 0 ? 0 : 1;
+}
+
+void ldv_clear_heap(ldv_heap* heap)
+{
+	/*	Blocks of trace are gone, so trace ends here	*/
+	ldv_trace_stop(heap);
+	for (HeapRegion* region = heap->regions; region != 0; region = region->next)
+	{
+		memset(region->mem, 0, (size_t)region->size * sizeof(ldv_block_type));
+		reset_region(region);
+	}
+	slab_reset(heap);
+	quarantine_reset(heap);
+	registry_renew(heap);
+	heap->check_active = 0;
+	heap->check_object = NULL;
+	heap->running = NULL;
+	tag_clear(&heap->tags);
+	heap->stats.live_bytes = 0;
+	heap->stats.live_blocks = 0;
+}
+
+int ldv_check_heap(ldv_heap* heap)
+{
+	heap_lock(heap);
+	log_batch_begin();
+	int code = 0;
+	/*	Performs local check on valid heads	*/
+	ldv_log(0, "======	 Checking LDV HEADS  ============\n");
+	for (HeapRegion* region = heap->regions; region != 0; region = region->next)
+	{
+		if (check_region(region) != 0)
+			code = 1;
+	}
+	for (unsigned int i = 0; i < heap->slab_page_count; ++i)
+	{
+		if (i > 0 && heap->slab_pages[i - 1] >= heap->slab_pages[i])
+		{
+			ldv_log(0, "Table of slab pages is not sorted at %i\n", i);
+			code = 1;
+		}
+		if (check_slab_page(heap, heap->slab_pages[i]) != 0)
+			code = 1;
+	}
+	ldv_log(0, "=======================================\n");
+	log_batch_end();
+	heap_unlock(heap);
+	return code;
+}
+
+int ldv_check_ptrs(lua_State* L)
+{
+	const ldv_heap* heap = ldv_state_heap(L);
+	if (!check_ptr(heap, L))
+		return 0;
+	global_State* g = G(L);
+	if (!check_ptr(heap, g))
+		return 0;
+	GCObject* gobjects[10] = { g->allgc, g->sweepgc == NULL ? NULL : *(g->sweepgc), g->finobj, 
+							   g->gray, g->grayagain, g->weak, g->ephemeron, 
+							   g->allweak, g->tobefnz, g->fixedgc};
+	/*	Objects are walked from each object of gc lists, walker enters each object once	*/
+	ObjectWalker walker;
+	walker_init(&walker, &check_visitor, L, NULL);
+	int valid = 1;
+	for (int i = 0; i < 10 && valid; ++i)
+	{
+		GCObject* gcobj = gobjects[i];
+		while (gcobj != NULL && valid)
+		{
+			const WalkItem item = object_item(gcobj->tt, gcobj);
+			valid = walk(&walker, &item, MAX_DUMP_DEPTH);
+			gcobj = gcobj->next;
+		}
+	}
+	walker_release(&walker);
+	return valid;
+}
+
+/*
+		Updates live counters of heap. Counters of thread safe heap are updated atomically, because thread caches
+		update them without heap lock, so they are exact at any time and peak is raised by live size of the moment
+		Params: heap, change of live size, change of live count (decrements are passed as wrapped unsigned values)
+		Return: none
+*/
+static void count_live(ldv_heap* heap, size_t bytes, size_t blocks)
+{
+	ldv_stats* stats = &heap->stats;
+	if (!heap->thread_safe)
+	{
+		stats->live_blocks += blocks;
+		stats->live_bytes += bytes;
+		if (stats->live_bytes > stats->peak_bytes)
+			stats->peak_bytes = stats->live_bytes;
+		return;
+	}
+	LDV_ATOMIC_ADD(&stats->live_blocks, blocks);
+	const size_t live_bytes = LDV_ATOMIC_ADD(&stats->live_bytes, bytes);
+	/*	Wrapped size (free, which is counted before its allocation) does not raise peak	*/
+	if (live_bytes > PTRDIFF_MAX)
+		return;
+	size_t peak_bytes = LDV_ATOMIC_LOAD(&stats->peak_bytes);
+	while (live_bytes > peak_bytes && !LDV_ATOMIC_CAS(&stats->peak_bytes, peak_bytes, live_bytes))
+		peak_bytes = LDV_ATOMIC_LOAD(&stats->peak_bytes);
+}
+
+/*
+		Updates operation counters with successful (re)allocation. Live counters are updated by count_live
+		Params: counters, old size (0 - new object), new size
+		Return: none
+*/
+static void count_alloc(ldv_stats* stats, size_t osize, size_t nsize)
+{
+	if (osize == 0)
+		++stats->alloc_count;
+	else
+		++stats->realloc_count;
+	if (nsize > (size_t)1 << (LDV_HISTOGRAM_SIZE - 1))
+		++stats->histogram[LDV_HISTOGRAM_SIZE - 1];
+	else
+		++stats->histogram[nsize > 1 ? highest_bit((ldv_block_type)(nsize - 1)) + 1 : 0];
+}
+
+/*
+		Updates operation counters with free. Live counters are updated by count_live
+		Params: counters
+		Return: none
+*/
+static void count_free(ldv_stats* stats)
+{
+	++stats->free_count;
+}
+
+ldv_check_status ldv_check_ptrs_step(lua_State* L, size_t budget)
+{
+	ldv_heap* heap = ldv_state_heap(L);
+	global_State* g = G(L);
+	/*	Lists linked by "next" field (gray lists are linked by "gclist" and hold objects of these lists)	*/
+	GCObject* const* gclists[] = { &g->allgc, &g->finobj, &g->tobefnz, &g->fixedgc };
+	const int list_count = (int)(sizeof(gclists) / sizeof(gclists[0]));
+	/*	Walk is restarted for other lua state or when objects moved between lists since last step: object, which gets
+		finalizer, moves from allgc to head of finobj, object, which is finalized, moves from head of tobefnz to allgc.
+		Objects, which are separated for finalization, are appended to tobefnz, so cursor, which follows them, checks
+		tobefnz twice at most. New objects are prepended to allgc, freed objects advance cursor, so they keep walk valid	*/
+	if (heap->check_active && (heap->check_state != g || heap->check_finobj != g->finobj || heap->check_tobefnz != g->tobefnz))
+		heap->check_active = 0;
+	if (!heap->check_active)
+	{
+		if (!check_ptr(heap, L) || !check_ptr(heap, g))
+			return LDV_CHECK_FAILED;
+		heap->check_active = 1;
+		heap->check_list = 0;
+		heap->check_object = g->allgc;
+		heap->check_state = g;
+	}
+	for (; budget > 0; --budget)
+	{
+		while (heap->check_object == NULL)
+		{
+			if (++heap->check_list == list_count)
+			{
+				heap->check_active = 0;
+				return LDV_CHECK_DONE;
+			}
+			heap->check_object = *gclists[heap->check_list];
+		}
+		const GCObject* gcobj = heap->check_object;
+		if (!check_ptr(heap, gcobj) || !check_gcobject(L, gcobj))
+		{
+			heap->check_active = 0;
+			heap->check_object = NULL;
+			return LDV_CHECK_FAILED;
+		}
+		heap->check_object = gcobj->next;
+	}
+	heap->check_finobj = g->finobj;
+	heap->check_tobefnz = g->tobefnz;
+	return LDV_CHECK_RUNNING;
+}
+
+/*
+		Reallocates memory of lua object (see ldv_frealloc). Heap in thread safe mode is locked by caller
+		Params: heap, pointer to memory, old size, new size, return address of allocator (native stack of samples starts after it)
+		Return: pointer to memory (0 - memory is freed or allocation failed)
+*/
+static void* heap_frealloc(ldv_heap* heap, void* ptr, size_t osize, size_t nsize, const void* caller)
+{
+	const size_t old_size = ptr != 0 ? osize : 0;
+	/*	Objects of slab pages are small, so large objects skip lookup of slab page	*/
+	SlabPage* page = ptr != 0 && osize <= SLAB_MAX_SIZE ? find_slab_page(heap, ptr) : 0;
+	/*	Block, which is not allocated, is left untouched	*/
+	if (ptr != 0 && !guard_block(heap, page, ptr, osize, nsize == 0 ? "free" : "realloc"))
+		return 0;
+	if (nsize == 0)
+	{
+		/*	Freed object is unlinked from gc list already, but it still points to next object	*/
+		if (ptr != 0 && ptr == heap->check_object)
+			heap->check_object = heap->check_object->next;
+		/*	Lua state, which objects are checked, is closed	*/
+		if (heap->check_active && heap->check_state->mainthread != NULL && (const char*)ptr == (const char*)heap->check_state->mainthread - LUA_EXTRASPACE)
+			heap->check_active = 0;
+		/*	Lua state, which gives allocation sites or sampled stacks, is closed	*/
+		if (heap->tags.L != NULL && (const char*)ptr == (const char*)heap->tags.L - LUA_EXTRASPACE)
+			heap->tags.L = NULL;
+		if (heap->sampler.L != NULL && (const char*)ptr == (const char*)heap->sampler.L - LUA_EXTRASPACE)
+			heap->sampler.L = NULL;
+		if (heap->running != NULL && (const char*)ptr == (const char*)heap->running - LUA_EXTRASPACE)
+			heap->running = NULL;
+		if (ptr != 0)
+		{
+			count_free(&heap->stats);
+			count_live(heap, 0 - osize, (size_t)0 - 1);
+			tag_block(heap, ptr, NULL, osize, 0);
+			release_block(heap, page, ptr, osize);
+		}
+		return 0;
+	}
+	if (nsize > old_size)
+		sample_allocation(heap, nsize - old_size, caller);
+	const size_t capacity = block_capacity(heap, nsize);
+	const int in_place = page != 0 ? nsize <= SLAB_MAX_SIZE && slab_classes[(nsize + 7) / 8] == page->size_class : ptr != 0 && ldv_resize(heap, ptr, capacity + heap->redzone_bytes);
+	void* all_mem = in_place ? 0 : heap_malloc(heap, capacity + heap->redzone_bytes);
+	/*	Quarantined blocks are freed, before allocation fails	*/
+	if (!in_place && all_mem == 0 && heap->quarantine.count != 0)
+	{
+		while (heap->quarantine.count != 0)
+			quarantine_release(heap);
+		all_mem = heap_malloc(heap, capacity + heap->redzone_bytes);
+	}
+	/*	Lua assumes, that shrinking never fails, so object, which has no memory to move to smaller slot, keeps its block	*/
+	if (in_place || (all_mem == 0 && ptr != 0 && nsize <= osize))
+	{
+		if (page == 0)
+			fill_redzone(heap, ptr, nsize);
+		++heap->stats.realloc_in_place_count;
+		count_alloc(&heap->stats, old_size, nsize);
+		count_live(heap, nsize - old_size, old_size == 0);
+		tag_block(heap, ptr, ptr, osize, nsize);
+		return ptr;
+	}
+	if (all_mem == 0)
+		return 0;
+	LDV_ASSERT(check_ptr(heap, all_mem))
+	/*	Redzones turn slab pages off, so new block is heap block, when it needs redzone	*/
+	fill_redzone(heap, all_mem, nsize);
+	count_alloc(&heap->stats, old_size, nsize);
+	count_live(heap, nsize - old_size, old_size == 0);
+	tag_block(heap, ptr, all_mem, osize, nsize);
+	if (ptr != 0 && osize != 0)
+	{
+		LDV_ASSERT(check_ptr(heap, ptr))
+		++heap->stats.realloc_moved_count;
+		memcpy(all_mem, ptr, osize < nsize ? osize : nsize);
+		release_block(heap, page, ptr, osize);
+	}
+	return all_mem;
+}
+
+/*
+		Merges operation counters of thread cache to heap. Heap is locked by caller
+		Params: heap, thread cache
+		Return: none
+*/
+static void cache_merge(ldv_heap* heap, ThreadCache* cache)
+{
+	ldv_stats* stats = &heap->stats;
+	const ldv_stats* delta = &cache->delta;
+	stats->alloc_count += delta->alloc_count;
+	stats->free_count += delta->free_count;
+	stats->invalid_frees += delta->invalid_frees;
+	for (unsigned int i = 0; i < LDV_HISTOGRAM_SIZE; ++i)
+		stats->histogram[i] += delta->histogram[i];
+	memset(&cache->delta, 0, sizeof(ldv_stats));
+}
+
+/*
+		Returns all blocks of thread cache to heap and merges its counters. Heap is locked by caller
+		Params: thread cache
+		Return: none
+*/
+static void cache_flush(ThreadCache* cache)
+{
+	ldv_heap* heap = cache->heap;
+	for (unsigned int size_class = 0; size_class < SLAB_CLASS_COUNT; ++size_class)
+	{
+		while (cache->blocks[size_class] != NULL)
+		{
+			void* ptr = cache->blocks[size_class];
+			cache->blocks[size_class] = *(void**)ptr;
+			/*	Block, which was freed by two threads, is not allocated, when the second thread flushes it	*/
+			SlabPage* page = find_slab_page(heap, ptr);
+			if (guard_block(heap, page, ptr, slab_sizes[size_class], "free"))
+				release_block(heap, page, ptr, slab_sizes[size_class]);
+		}
+	}
+	cache->bytes = 0;
+	cache_merge(heap, cache);
+}
+
+/*
+		Returns blocks of thread cache to their heap and empties cache. Blocks are dropped, when heap is destroyed
+		or its memory was released since they were cached: heap is looked up in registry of live heaps,
+		so heap of cache is not touched, unless it is registered at epoch of cache
+		Params: thread cache
+		Return: none
+*/
+static void cache_release(ThreadCache* cache)
+{
+	if (cache->heap == NULL)
+		return;
+	registry_lock();
+	const LiveHeap* entry = registry_find(cache->heap);
+	/*	Registry is kept locked, so heap is not destroyed, while it is flushed	*/
+	if (entry != NULL && entry->epoch == cache->epoch)
+	{
+		heap_lock(cache->heap);
+		cache_flush(cache);
+		heap_unlock(cache->heap);
+	}
+	registry_unlock();
+	memset(cache, 0, sizeof(ThreadCache));
+}
+
+/*
+		Flushes cache of exiting thread
+		Params: thread cache
+		Return: none
+*/
+static void LDV_EXIT_CALLBACK cache_exit(void* cache)
+{
+	if (cache != NULL)
+		cache_release((ThreadCache*)cache);
+}
+
+/*
+		Registers thread exit callback, which flushes cache of current thread. Key of callback is created once
+		Params: thread cache
+		Return: none
+
+		NOTE: Cache of thread, which exits without callback (key is not created), is flushed by ldv_thread_flush only.
+*/
+static void cache_watch_exit(ThreadCache* cache)
+{
+	registry_lock();
+	if (cache_exit_state == 0)
+		cache_exit_state = LDV_EXIT_KEY_CREATE(&cache_exit_key, cache_exit) ? 1 : -1;
+	const int ready = cache_exit_state == 1;
+	registry_unlock();
+	if (ready)
+		LDV_EXIT_KEY_SET(cache_exit_key, cache);
+}
+
+/*
+		Gets cache of current thread for heap. Blocks cached for other heap are returned to it,
+		blocks cached before heap memory was released are dropped
+		Params: heap
+		Return: thread cache
+*/
+static ThreadCache* cache_bind(ldv_heap* heap)
+{
+	ThreadCache* cache = &thread_cache;
+	if (cache->heap == heap && cache->epoch == heap->cache_epoch)
+		return cache;
+	if (cache->heap != heap)
+		cache_release(cache);
+	const int watched = cache->heap != NULL;
+	memset(cache, 0, sizeof(ThreadCache));
+	cache->heap = heap;
+	cache->epoch = heap->cache_epoch;
+	/*	Callback is registered, when cache gets heap: cache, which is released, keeps no blocks	*/
+	if (!watched)
+		cache_watch_exit(cache);
+	return cache;
+}
+
+/*
+		Checks, whether small objects of thread safe heap are served by thread caches. Debugging features
+		and trace recording, which need to see each operation, make all operations go through locked heap
+		Params: heap
+		Return: 1 - objects are cached, 0 - otherwise
+*/
+static int cache_enabled(const ldv_heap* heap)
+{
+	return !heap->tags.enabled && heap->sampler.mean_bytes == 0 && heap->redzone_bytes == 0 && heap->quarantine.limit == 0 && !heap->check_active && heap->trace.file == NULL;
+}
+
+/*
+		Frees small object to cache of current thread. Cache is flushed to heap, when it grows too large
+		Params: heap, pointer to memory, size of object
+		Return: none
+*/
+static void cache_free(ldv_heap* heap, void* ptr, size_t osize)
+{
+	ThreadCache* cache = cache_bind(heap);
+	const unsigned int size_class = slab_classes[(osize + 7) / 8];
+	void** links = (void**)ptr;
+	/*	Magic is written by cache, but user data could look like it, so double free is confirmed by cached list	*/
+	if ((uintptr_t)links[1] == CACHE_MAGIC)
+	{
+		for (void* block = cache->blocks[size_class]; block != NULL; block = *(void**)block)
+		{
+			if (block == ptr)
+			{
+				++cache->delta.invalid_frees;
+				ldv_log(0, "LDV free of block %p, which is not allocated (double free)\n", ptr);
+				return;
+			}
+		}
+	}
+	count_free(&cache->delta);
+	count_live(heap, 0 - osize, (size_t)0 - 1);
+	mark_slot(heap, ptr, slab_sizes[size_class], Free);
+	links[0] = cache->blocks[size_class];
+	links[1] = (void*)CACHE_MAGIC;
+	cache->blocks[size_class] = ptr;
+	cache->bytes += slab_sizes[size_class];
+	if (cache->bytes > THREAD_CACHE_BYTES)
+	{
+		heap_lock(heap);
+		cache_flush(cache);
+		heap_unlock(heap);
+	}
+}
+
+/*
+		Allocates small object from cache of current thread. Empty list of cache is refilled by batch of heap blocks
+		Params: heap, size of object
+		Return: allocated memory (0 on failure)
+*/
+static void* cache_malloc(ldv_heap* heap, size_t nsize)
+{
+	ThreadCache* cache = cache_bind(heap);
+	const unsigned int size_class = slab_classes[(nsize + 7) / 8];
+	if (cache->blocks[size_class] == NULL)
+	{
+		heap_lock(heap);
+		cache_merge(heap, cache);
+		for (unsigned int i = 0; i < THREAD_CACHE_BATCH; ++i)
+		{
+			void** links = (void**)heap_malloc(heap, slab_sizes[size_class]);
+			/*	Blocks of other size classes are returned to heap, before refill fails	*/
+			if (links == 0 && i == 0 && cache->bytes != 0)
+			{
+				cache_flush(cache);
+				links = (void**)heap_malloc(heap, slab_sizes[size_class]);
+			}
+			if (links == 0)
+				break;
+			links[0] = cache->blocks[size_class];
+			links[1] = (void*)CACHE_MAGIC;
+			cache->blocks[size_class] = links;
+			cache->bytes += slab_sizes[size_class];
+		}
+		heap_unlock(heap);
+		if (cache->blocks[size_class] == NULL)
+			return 0;
+	}
+	void** links = (void**)cache->blocks[size_class];
+	cache->blocks[size_class] = links[0];
+	cache->bytes -= slab_sizes[size_class];
+	links[1] = NULL;
+	mark_slot(heap, links, slab_sizes[size_class], Allocated);
+	count_alloc(&cache->delta, 0, nsize);
+	count_live(heap, nsize, 1);
+	return links;
+}
+
+void* ldv_frealloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	ldv_heap* heap = ud != 0 ? (ldv_heap*)ud : ldv_default_heap();
+	if (!heap->thread_safe)
+	{
+		void* mem = heap_frealloc(heap, ptr, osize, nsize, LDV_RETURN_ADDRESS());
+		if (heap->trace.file != NULL)
+			trace_record(&heap->trace, ptr, osize, nsize, mem);
+		return mem;
+	}
+	/*	New and freed small objects skip heap lock, other operations are serialized	*/
+	if (cache_enabled(heap))
+	{
+		if (ptr != 0 && nsize == 0 && osize != 0 && osize <= SLAB_MAX_SIZE)
+		{
+			cache_free(heap, ptr, osize);
+			return 0;
+		}
+		if (ptr == 0 && nsize != 0 && nsize <= SLAB_MAX_SIZE)
+		{
+			void* mem = cache_malloc(heap, nsize);
+			if (mem != 0)
+				return mem;
+		}
+	}
+	heap_lock(heap);
+	void* mem = heap_frealloc(heap, ptr, osize, nsize, LDV_RETURN_ADDRESS());
+	if (heap->trace.file != NULL)
+		trace_record(&heap->trace, ptr, osize, nsize, mem);
+	heap_unlock(heap);
+	return mem;
+}
+
+ldv_sink ldv_set_sink(const ldv_sink* sink)
+{
+	ldv_log_flush();
+	if (log_sink.owned_file)
+		fclose(log_sink.target.file);
+	log_sink.owned_file = 0;
+	const ldv_sink prev_target = log_sink.target;
+	if (sink != NULL)
+	{
+		log_sink.target = *sink;
+	}
+	else
+	{
+		memset(&log_sink.target, 0, sizeof(ldv_sink));
+		log_sink.target.type = LDV_SINK_STDOUT;
+	}
+	log_sink.size = log_sink.base;
+	log_sink.written = 0;
+	log_sink.truncated = 0;
+	if (log_sink.buf != 0)
+		log_sink.buf[log_sink.size] = 0;
+	return prev_target;
+}
+
+void ldv_log_flush(void)
+{
+	if (log_sink.size == log_sink.base || log_sink.target.type == LDV_SINK_MEMORY)
+		return;
+	log_write(&log_sink.target, log_sink.buf + log_sink.base, log_sink.size - log_sink.base);
+	log_sink.size = log_sink.base;
+	log_sink.buf[log_sink.size] = 0;
+}
+
+const char* ldv_sink_memory(size_t* size)
+{
+	const int memory = log_sink.target.type == LDV_SINK_MEMORY && log_sink.buf != 0;
+	*size = memory ? log_sink.size - log_sink.base : 0;
+	return memory ? log_sink.buf + log_sink.base : "";
+}
+
+ldv_poison_mode ldv_set_poison(ldv_heap* heap, ldv_poison_mode mode)
+{
+	const ldv_poison_mode prev_mode = heap->poison_mode;
+	heap->poison_mode = mode;
+	return prev_mode;
+}
+
+int ldv_set_slab(ldv_heap* heap, int enabled)
+{
+	const int prev_enabled = heap->slab_enabled;
+	heap->slab_enabled = enabled;
+	return prev_enabled;
+}
+
+int ldv_set_redzone(ldv_heap* heap, size_t bytes)
+{
+	if (heap->stats.live_blocks != 0)
+		return 1;
+	heap->redzone_bytes = bytes;
+	return 0;
+}
+
+size_t ldv_set_quarantine(ldv_heap* heap, size_t bytes)
+{
+	const size_t prev_limit = heap->quarantine.limit;
+	heap->quarantine.limit = bytes;
+	while (heap->quarantine.count != 0 && (bytes == 0 || heap->quarantine.bytes > bytes))
+		quarantine_release(heap);
+	return prev_limit;
+}
+
+int ldv_set_thread_safe(ldv_heap* heap, int enabled)
+{
+	if (enabled == heap->thread_safe)
+		return 0;
+	if (enabled && heap->stats.live_blocks != 0)
+		return 1;
+	if (!enabled && thread_cache.heap == heap)
+		ldv_thread_flush();
+	heap->thread_safe = enabled;
+	return 0;
+}
+
+void ldv_thread_flush(void)
+{
+	cache_release(&thread_cache);
+}
+
+int ldv_trace_start(ldv_heap* heap, const char* path)
+{
+	ldv_trace_stop(heap);
+	AllocTrace* trace = &heap->trace;
+	trace->buf = (unsigned char*)malloc(TRACE_BUFF_SIZE);
+	trace->file = trace->buf != NULL ? fopen(path, "wb") : NULL;
+	if (trace->file == NULL)
+	{
+		free(trace->buf);
+		trace->buf = NULL;
+		return 1;
+	}
+	memcpy(trace->header.magic, LDV_TRACE_MAGIC, sizeof(LDV_TRACE_MAGIC));
+	trace->header.version = LDV_TRACE_VERSION;
+	trace->header.byte_order = LDV_TRACE_BYTE_ORDER;
+	trace->header.live_bytes = heap->stats.live_bytes;
+	trace->header.live_blocks = heap->stats.live_blocks;
+	memcpy(trace->buf, &trace->header, sizeof(ldv_trace_header));
+	trace->size = sizeof(ldv_trace_header);
+	trace->last_time = trace_time();
+	return 0;
 }
 
-/*
-		Checks validity of proto 
-		Params: lua state, proto
-		Return: valid state
-*/
-int check_proto(lua_State* L, const Proto* proto)
+int ldv_trace_stop(ldv_heap* heap)
 {
-	if (proto->source && !check_ptr(proto->source))
+	AllocTrace* trace = &heap->trace;
+	if (trace->file == NULL)
 		return 0;
-	if (proto->cache && !check_ptr(proto->cache))
-		return 0;
-	for (int i = 0; i < proto->sizep; ++i)
-	{
-		if (!check_ptr(proto->p + i) || proto->p[i] && !check_ptr(proto->p[i]))
-			return 0;
-	}
-	for (int i = 0; i < proto->sizecode; ++i)
-	{
-		if (!check_ptr(proto->code + i))
-			return 0;
-	}
-	for (int i = 0; i < proto->sizelocvars; ++i)
+	trace_flush(trace);
+	/*	Counters of header are known at the end of recording	*/
+	trace->header.id_count = trace->id_count;
+	if (!trace->failed && (fseek(trace->file, 0, SEEK_SET) != 0 || fwrite(&trace->header, sizeof(ldv_trace_header), 1, trace->file) != 1))
+		trace->failed = 1;
+	if (fclose(trace->file) != 0)
+		trace->failed = 1;
+	const int failed = trace->failed;
+	free(trace->buf);
+	free(trace->cells);
+	free(trace->free_ids);
+	memset(trace, 0, sizeof(AllocTrace));
+	return failed;
+}
+
+void ldv_realloc_stats(const ldv_heap* heap, size_t* in_place, size_t* moved)
+{
+	*in_place = heap->stats.realloc_in_place_count;
+	*moved = heap->stats.realloc_moved_count;
+}
+
+void ldv_get_stats(const ldv_heap* heap, ldv_stats* stats)
+{
+	/*	Lock is not a part of heap contents, so it is taken on heap, which is read only	*/
+	heap_lock((ldv_heap*)heap);
+	*stats = heap->stats;
+	/*	Live counters are updated by thread caches without lock	*/
+	stats->live_bytes = LDV_ATOMIC_LOAD(&heap->stats.live_bytes);
+	stats->live_blocks = LDV_ATOMIC_LOAD(&heap->stats.live_blocks);
+	stats->peak_bytes = LDV_ATOMIC_LOAD(&heap->stats.peak_bytes);
+	stats->free_blocks = 0;
+	size_t free_words = 0;
+	ldv_block_type largest_words = 0;
+	for (HeapRegion* region = heap->regions; region != 0; region = region->next)
 	{
-		if (!check_ptr(proto->locvars + i))
-			return 0;
+		const ldv_block_type region_largest = largest_free_words(region);
+		stats->free_blocks += region->free_blocks;
+		free_words += region->free_words;
+		if (region_largest > largest_words)
+			largest_words = region_largest;
 	}
-	for (int i = 0; i < proto->sizeupvalues; ++i)
+	stats->free_bytes = free_words * sizeof(ldv_block_type);
+	stats->largest_free = (size_t)largest_words * sizeof(ldv_block_type);
+	stats->fragmentation = free_words != 0 ? 1.0 - (double)largest_words / (double)free_words : 0.0;
+	heap_unlock((ldv_heap*)heap);
+}
+
+void ldv_get_fragmentation(const ldv_heap* heap, ldv_fragmentation* report)
+{
+	memset(report, 0, sizeof(ldv_fragmentation));
+	heap_lock((ldv_heap*)heap);
+	for (HeapRegion* region = heap->regions; region != 0; region = region->next)
 	{
-		if (!check_ptr(proto->upvalues + i))
-			return 0;
+		BlockHead* start_head = (BlockHead*)region->mem;
+		for (;;)
+		{
+			const size_t bytes = (size_t)block_words(start_head) * sizeof(ldv_block_type);
+			if (status(start_head, DataState) == Gem)
+			{
+				++report->gem_blocks;
+				report->gem_bytes += bytes;
+			}
+			else
+			{
+				const unsigned int bucket = bytes > (size_t)1 << (LDV_HISTOGRAM_SIZE - 1) ? LDV_HISTOGRAM_SIZE - 1 : highest_bit((ldv_block_type)(bytes - 1)) + 1;
+				++report->free_blocks;
+				report->free_bytes += bytes;
+				++report->free_count[bucket];
+				report->free_size[bucket] += bytes;
+				if (bytes > report->largest_free)
+					report->largest_free = bytes;
+			}
+			if (status(start_head, NextHeadState) == MarginHead)
+				break;
+			start_head = raw_move_head(start_head, NextHead, get_head_offset(start_head, NextHead));
+		}
 	}
-	return 1;
+	heap_unlock((ldv_heap*)heap);
 }
 
-/*
-		Checks validity of lua closure
-		Params: lua state, lua closure
-		Return: valid state
-*/
-int check_lclosure(lua_State* L, const LClosure* lclosure)
+void ldv_dump_fragmentation(const ldv_heap* heap)
 {
-	for (unsigned int i = 0; i < lclosure->nupvalues; ++i)
+	ldv_fragmentation report;
+	ldv_get_fragmentation(heap, &report);
+	log_batch_begin();
+	ldv_log(0, "=======           LDV FRAGMENTATION               ==============\n");
+	ldv_log(0, "gem blocks %" LDV_SIZE_FORMAT " (%" LDV_SIZE_FORMAT " bytes), garbage blocks %" LDV_SIZE_FORMAT " (%" LDV_SIZE_FORMAT " bytes), largest garbage block %" LDV_SIZE_FORMAT " bytes\n",
+		report.gem_blocks, report.gem_bytes, report.free_blocks, report.free_bytes, report.largest_free);
+	for (unsigned int i = 0; i < LDV_HISTOGRAM_SIZE; ++i)
 	{
-		if (!check_ptr(lclosure->upvals + i))
-			return 0;
-		check_upvalue(L, lclosure->upvals[i]);
+		if (report.free_count[i] != 0)
+			ldv_log(0, "up to %10" LDV_SIZE_FORMAT " bytes: %10" LDV_SIZE_FORMAT " blocks %12" LDV_SIZE_FORMAT " bytes\n", (size_t)1 << i, report.free_count[i], report.free_size[i]);
 	}
-	return check_proto(L, lclosure->p);
+	ldv_log(0, "================================================================\n");
+	log_batch_end();
 }
 
-/*
-		Check gc object on validness
-		Params: lua state, gc object
-		Return: valid state
-*/
-int check_gcobject(lua_State* L, const GCObject* gcobj)
+int ldv_set_relocation(ldv_heap* heap, int enabled)
 {
-	
-	if (!check_sized_ptr(gcobj, sizeof(GCObject)))
-		return 0;
-	switch (gcobj->tt)
+	const int prev_enabled = heap->relocation_enabled;
+	heap->relocation_enabled = enabled;
+	return prev_enabled;
+}
+
+int ldv_compact(lua_State* L, ldv_compaction* result)
+{
+	ldv_heap* heap = ldv_state_heap(L);
+	global_State* g = G(L);
+	if (!heap->relocation_enabled)
+		return 1;
+	ldv_compaction compaction;
+	memset(&compaction, 0, sizeof(ldv_compaction));
+	ldv_stats heap_stats;
+	ldv_get_stats(heap, &heap_stats);
+	compaction.largest_free_before = heap_stats.largest_free;
+	/*	Other threads of thread safe heap keep allocating, so lookups and moves are done under lock	*/
+	heap_lock(heap);
+	CompactIndex index;
+	if (compact_index_build(heap, &index) != 0)
 	{
-		case LUA_TTABLE:
+		heap_unlock(heap);
+		return 2;
+	}
+	/*	Parts are owned by tables only, so walk of all tables finds the only reference of each part	*/
+	GCObject* const gclists[] = { g->allgc, g->finobj, g->tobefnz, g->fixedgc };
+	RelocatedPart* parts = NULL;
+	size_t count = 0;
+	size_t capacity = 0;
+	for (unsigned int list = 0; list < sizeof(gclists) / sizeof(gclists[0]); ++list)
+	{
+		for (GCObject* gcobj = gclists[list]; gcobj != NULL; gcobj = gcobj->next)
 		{
-			const Table* table = gco2t(gcobj);
-			return check_sized_ptr(table, sizeof(Table)) ? check_table(L, table) : 0;
+			if (gcobj->tt != LUA_TTABLE)
+				continue;
+			Table* table = gco2t(gcobj);
+			for (int node = 0; node < 2; ++node)
+			{
+				void* mem = node ? (isdummy(table) ? NULL : (void*)table->node) : (table->sizearray != 0 ? (void*)table->array : NULL);
+				const unsigned int slot = mem != NULL ? region_slot(heap, mem) : heap->region_count;
+				if (slot == heap->region_count || find_slab_page(heap, mem) != 0)
+					continue;
+				if (count == capacity)
+				{
+					capacity = capacity != 0 ? capacity * 2 : VISITED_SET_SIZE;
+					RelocatedPart* grown = (RelocatedPart*)realloc(parts, capacity * sizeof(RelocatedPart));
+					if (grown == 0)
+					{
+						compact_index_release(&index);
+						heap_unlock(heap);
+						free(parts);
+						return 2;
+					}
+					parts = grown;
+				}
+				parts[count].mem = mem;
+				parts[count].table = table;
+				parts[count].node = node;
+				parts[count].slot = slot;
+				parts[count].rank = index.regions[slot].rank;
+				++count;
+			}
 		}
-		case LUA_TLCL:
+	}
+	/*	The last blocks in heap order are moved first, so they fill the lowest garbage blocks	*/
+	qsort(parts, count, sizeof(RelocatedPart), relocated_compare);
+	for (size_t i = 0; i < count; ++i)
+	{
+		Table* table = parts[i].table;
+		const size_t size = parts[i].node ? (size_t)sizenode(table) * sizeof(Node) : (size_t)table->sizearray * sizeof(TValue);
+		void* mem = relocate_block(heap, &index, &parts[i], size);
+		if (mem == 0)
+			continue;
+		tag_block(heap, parts[i].mem, mem, size, size);
+		/*	Moved block keeps its trace id, move is not recorded, because lua did not ask for it	*/
+		uint32_t id;
+		if (heap->trace.file != NULL && trace_remove(&heap->trace, parts[i].mem, &id) && trace_insert(&heap->trace, mem, id) != 0)
+			heap->trace.failed = 1;
+		if (parts[i].node)
 		{
-			const LClosure* lclosure = gco2lcl(gcobj);
-			return check_sized_ptr(lclosure, sizeof(LClosure)) ? check_lclosure(L, lclosure) : 0;
-		}
-		case LUA_TCCL:
-		{	
-			const CClosure* cclosure = gco2ccl(gcobj);
-			return check_sized_ptr(cclosure, sizeof(CClosure)) ? check_cclosure(L, cclosure) : 0;
+			table->lastfree = (Node*)mem + (table->lastfree - table->node);
+			table->node = (Node*)mem;
 		}
-		case LUA_TUSERDATA:
+		else
 		{
-			/*	TODO: (alex) how to check?	*/
-			return 1;
+			table->array = (TValue*)mem;
 		}
-		case LUA_TLCF:
-		{
-			/*	TODO: (alex) how to check?	*/
+		++compaction.moved_blocks;
+		compaction.moved_bytes += size;
+	}
+	compact_index_release(&index);
+	heap_unlock(heap);
+	free(parts);
+	ldv_get_stats(heap, &heap_stats);
+	compaction.largest_free_after = heap_stats.largest_free;
+	if (result != NULL)
+		*result = compaction;
+	return 0;
+}
+
+int ldv_set_tagging(ldv_heap* heap, int enabled, lua_State* L)
+{
+	BlockTags* tags = &heap->tags;
+	if (!enabled)
+	{
+		for (unsigned int i = 0; i < tags->site_count; ++i)
+			free(tags->sites[i].source);
+		free(tags->sites);
+		free(tags->site_cells);
+		free(tags->cells);
+		memset(tags, 0, sizeof(BlockTags));
+		return 0;
+	}
+	if (!tags->enabled)
+	{
+		/*	Unknown site is the first site	*/
+		tags->sites = (TagSite*)calloc(TAG_SITE_COUNT, sizeof(TagSite));
+		if (tags->sites == 0)
 			return 1;
-		}
-		case LUA_TSTRING:
-		{
-			const TString* str = gco2ts(gcobj);
-			return check_sized_ptr(str, sizeof(TString)) ? check_string(L, str) : 0;
-		}
-		case LUA_TLNGSTR:
-		{
-			const TString* str = gco2ts(gcobj);
-			return check_sized_ptr(str, sizeof(TString)) ? check_string(L, str) : 0;
-		}
-		case LUA_TPROTO:
-		{
-			const Proto* proto = gco2p(gcobj);
-			return check_sized_ptr(proto, sizeof(Proto)) ? check_proto(L, proto) : 0;
-		}
-		default:
-			ldv_log(0, "(check_gcobject func). Not recognized type: %i \n", gcobj->tt);
-			return 0;
+		tags->site_capacity = TAG_SITE_COUNT;
+		tags->site_count = 1;
+		tags->sites[0].line = -1;
+		tags->enabled = 1;
 	}
+	tags->L = L;
+	return 0;
 }
-/*			PRIVATE FUNCS END			*/	
 
-//	Public API implementation
-void ldv_load_lib(lua_State* L)
+size_t ldv_tag_report(const ldv_heap* heap, ldv_tag_group group, ldv_tag_entry* entries, size_t count)
 {
-	luaL_requiref (L, "ldv", ldv_load_libf, 1);
-	lua_pop(L, 1);  /* remove lib */
+	const BlockTags* tags = &heap->tags;
+	const size_t source_count = group == LDV_TAG_BY_TYPE ? TAG_TYPE_COUNT : tags->site_count;
+	ldv_tag_entry* report = (ldv_tag_entry*)malloc((source_count != 0 ? source_count : 1) * sizeof(ldv_tag_entry));
+	if (report == 0)
+		return 0;
+	size_t report_size = 0;
+	for (size_t i = 0; i < source_count; ++i)
+	{
+		const TagCounter* counter = group == LDV_TAG_BY_TYPE ? &tags->types[i] : &tags->sites[i].counter;
+		if (counter->live_blocks == 0)
+			continue;
+		ldv_tag_entry* entry = &report[report_size++];
+		entry->name = group == LDV_TAG_BY_TYPE ? tag_type_name((int)i) : tags->sites[i].source != 0 ? tags->sites[i].source : "?";
+		entry->line = group == LDV_TAG_BY_TYPE ? 0 : tags->sites[i].line;
+		entry->live_bytes = counter->live_bytes;
+		entry->live_blocks = counter->live_blocks;
+	}
+	qsort(report, report_size, sizeof(ldv_tag_entry), tag_entry_compare);
+	memcpy(entries, report, (count < report_size ? count : report_size) * sizeof(ldv_tag_entry));
+	free(report);
+	return report_size;
 }
 
-void ldv_clear_heap()
+void ldv_dump_tags(const ldv_heap* heap)
 {
-	if (MEM_BUFF_SIZE > block_data_mask())
+	log_batch_begin();
+	const size_t count = heap->tags.site_count > TAG_TYPE_COUNT ? heap->tags.site_count : TAG_TYPE_COUNT;
+	ldv_tag_entry* entries = (ldv_tag_entry*)malloc(count * sizeof(ldv_tag_entry));
+	if (entries == 0)
 	{
-		ldv_log(0, "Too big memory buffer size");
+		log_batch_end();
 		return;
 	}
-	for (int i = 0; i < MEM_BUFF_SIZE; ++i)
-		mem_buf[i] = 0;
-	set_head((BlockHead*)(mem_buf), NextHead, MEM_BUFF_SIZE);
+	ldv_log(0, "=======           LDV TAGGED MEMORY BY TYPE       ==============\n");
+	size_t size = ldv_tag_report(heap, LDV_TAG_BY_TYPE, entries, count);
+	for (size_t i = 0; i < size; ++i)
+		ldv_log(0, "%-14s %12" LDV_SIZE_FORMAT " bytes %10" LDV_SIZE_FORMAT " blocks\n", entries[i].name, entries[i].live_bytes, entries[i].live_blocks);
+	ldv_log(0, "=======           LDV TAGGED MEMORY BY SITE       ==============\n");
+	size = ldv_tag_report(heap, LDV_TAG_BY_SITE, entries, count);
+	for (size_t i = 0; i < size; ++i)
+		ldv_log(0, "%s:%i %" LDV_SIZE_FORMAT " bytes %" LDV_SIZE_FORMAT " blocks\n", entries[i].name, entries[i].line, entries[i].live_bytes, entries[i].live_blocks);
+	ldv_log(0, "================================================================\n");
+	free(entries);
+	log_batch_end();
 }
 
-int ldv_check_heap()
+size_t ldv_set_sampling(ldv_heap* heap, size_t mean_bytes, lua_State* L)
 {
-	int code = 0;
-	/*	Performs local check on valid heads	*/
-	ldv_log(0, "======	 Checking LDV HEADS  ============\n");
-	BlockHead* start_head = (BlockHead*)mem_buf;
-        for (unsigned int heads_count = 0; ; ++heads_count)
-        {
-                const ldv_block_type prev = get_head_offset(start_head, PrevHead);
-                const ldv_block_type next = get_head_offset(start_head, NextHead);
-		if (prev > MEM_BUFF_SIZE)
-		{
-			ldv_log(0, "Corrupted prev index of block %p %i %i\n", start_head, heads_count, prev);
-			code = 1;
-		}
-		if (next > MEM_BUFF_SIZE)
+	AllocSampler* sampler = &heap->sampler;
+	const size_t prev_mean_bytes = sampler->mean_bytes;
+	if (mean_bytes == 0)
+	{
+		for (size_t i = 0; i < sampler->capacity; ++i)
+			free(sampler->stacks[i].frames);
+		free(sampler->stacks);
+		memset(sampler, 0, sizeof(AllocSampler));
+		return prev_mean_bytes;
+	}
+	if (sampler->random == 0)
+		sampler->random = 0x9E3779B97F4A7C15ull ^ (uint64_t)(uintptr_t)heap;
+	sampler->mean_bytes = mean_bytes;
+	sampler->L = L;
+	sampler->countdown = sample_interval(sampler);
+	return prev_mean_bytes;
+}
+
+lua_State* ldv_switch_thread(ldv_heap* heap, lua_State* L)
+{
+	lua_State* prev_running = heap->running;
+	heap->running = L;
+	return prev_running;
+}
+
+void ldv_dump_samples(const ldv_heap* heap)
+{
+	log_batch_begin();
+	const AllocSampler* sampler = &heap->sampler;
+	for (size_t i = 0; i < sampler->capacity; ++i)
+	{
+		const SampledStack* stack = &sampler->stacks[i];
+		if (stack->frames != 0)
+			ldv_log(0, "%s %.0f\n", stack->frames, stack->bytes);
+	}
+	log_batch_end();
+}
+
+int ldv_snapshot(lua_State* L, const char* path)
+{
+	const ldv_heap* heap = ldv_state_heap(L);
+	global_State* g = G(L);
+	SnapshotWriter writer;
+	memset(&writer, 0, sizeof(SnapshotWriter));
+	writer.file = fopen(path, "wb");
+	writer.buf = (char*)malloc(SNAPSHOT_BUFF_SIZE);
+	writer.names = (char*)malloc(SNAPSHOT_BUFF_SIZE);
+	if (writer.file == NULL || writer.buf == NULL || writer.names == NULL)
+	{
+		if (writer.file != NULL)
+			fclose(writer.file);
+		free(writer.buf);
+		free(writer.names);
+		return 1;
+	}
+	/*	Empty name is the first name	*/
+	writer.name_capacity = SNAPSHOT_BUFF_SIZE;
+	writer.names[0] = '\0';
+	writer.name_bytes = 1;
+	ldv_snapshot_header header;
+	memset(&header, 0, sizeof(ldv_snapshot_header));
+	memcpy(header.magic, LDV_SNAPSHOT_MAGIC, sizeof(LDV_SNAPSHOT_MAGIC));
+	header.version = LDV_SNAPSHOT_VERSION;
+	header.byte_order = LDV_SNAPSHOT_BYTE_ORDER;
+	header.live_bytes = heap->stats.live_bytes;
+	snapshot_write(&writer, &header, sizeof(ldv_snapshot_header));
+	/*	Blocks of heap regions	*/
+	for (HeapRegion* region = heap->regions; region != 0; region = region->next)
+	{
+		BlockHead* start_head = (BlockHead*)region->mem;
+		for (;;)
 		{
-			ldv_log(0, "Corrupted next index of block %p %i %i\n", start_head, heads_count, next);
-			code = 1;
+			ldv_snapshot_block block;
+			block.address = (uint64_t)(uintptr_t)(RAW_MEMORY(start_head) + 2);
+			block.size = data_size(start_head);
+			block.state = status(start_head, DataState) == Gem ? LDV_SNAPSHOT_GEM : LDV_SNAPSHOT_GARBAGE;
+			block.reserved = 0;
+			const SlabPage* page = block.state == LDV_SNAPSHOT_GEM ? find_slab_page(heap, (unsigned char*)(RAW_MEMORY(start_head) + 2) + SLAB_PAGE_BYTES - 1) : 0;
+			if (page != 0 && page->block == RAW_MEMORY(start_head) + 2)
+				block.state = LDV_SNAPSHOT_SLAB;
+			snapshot_write(&writer, &block, sizeof(ldv_snapshot_block));
+			++header.block_count;
+			if (status(start_head, NextHeadState) == MarginHead)
+				break;
+			start_head = raw_move_head(start_head, NextHead, get_head_offset(start_head, NextHead));
 		}
-                if (status(start_head, NextHeadState) == MarginHead)
-                        break;
-                start_head = raw_move_head(start_head, NextHead, next);
-		const ldv_block_type next_prev = get_head_offset(start_head, PrevHead);
-		if (next != next_prev)
+	}
+	/*	Objects are numbered in order of gc lists, main thread is not kept in lists	*/
+	GCObject* const gclists[] = { obj2gco(g->mainthread), g->allgc, g->finobj, g->tobefnz, g->fixedgc };
+	const unsigned int list_count = sizeof(gclists) / sizeof(gclists[0]);
+	VisitedSet ids;
+	memset(&ids, 0, sizeof(VisitedSet));
+	for (unsigned int list = 0; list < list_count && !writer.failed; ++list)
+	{
+		for (const GCObject* gcobj = gclists[list]; gcobj != NULL && !writer.failed; gcobj = list != 0 ? gcobj->next : NULL)
 		{
-			ldv_log(0, "Inconsistent prev/next %i %i links (next head %p %i)", next, next_prev, start_head, heads_count);
-			code = 1;
+			if (visited_insert(&ids, gcobj) == 0)
+			{
+				writer.failed = 1;
+				break;
+			}
+			ldv_snapshot_object record;
+			snapshot_object(&writer, gcobj, &record);
+			record.flags = list == 4 ? LDV_SNAPSHOT_FIXED : list == 2 || list == 3 ? LDV_SNAPSHOT_FINALIZED : 0;
+			const int registry = iscollectable(&g->l_registry) && gcobj == gcvalue(&g->l_registry);
+			int root = list == 0 || registry;
+			for (int i = 0; i < LUA_NUMTAGS && !root; ++i)
+				root = g->mt[i] != NULL && gcobj == obj2gco(g->mt[i]);
+			record.flags |= (root ? LDV_SNAPSHOT_ROOT : 0) | (registry ? LDV_SNAPSHOT_REGISTRY : 0);
+			snapshot_write(&writer, &record, sizeof(ldv_snapshot_object));
+			++header.object_count;
 		}
-        }
-	ldv_log(0, "=======================================\n");
-	return code;
+	}
+	/*	References follow order of objects	*/
+	for (unsigned int list = 0; list < list_count && !writer.failed; ++list)
+	{
+		for (const GCObject* gcobj = gclists[list]; gcobj != NULL; gcobj = list != 0 ? gcobj->next : NULL)
+			snapshot_edges(&writer, &ids, gcobj);
+	}
+	free(ids.keys);
+	free(ids.ids);
+	snapshot_write(&writer, writer.names, writer.name_bytes);
+	if (!writer.failed && writer.size != 0 && fwrite(writer.buf, 1, writer.size, writer.file) != writer.size)
+		writer.failed = 1;
+	header.edge_count = writer.edge_count;
+	header.name_bytes = writer.name_bytes;
+	if (!writer.failed && (fseek(writer.file, 0, SEEK_SET) != 0 || fwrite(&header, sizeof(ldv_snapshot_header), 1, writer.file) != 1))
+		writer.failed = 1;
+	if (fclose(writer.file) != 0)
+		writer.failed = 1;
+	free(writer.buf);
+	free(writer.names);
+	return writer.failed;
 }
 
-int ldv_check_ptrs(lua_State* L)
+int ldv_top_retainers(lua_State* L, ldv_retainer* retainers, size_t* count)
+{
+	ObjectGraph graph;
+	if (!graph_build(L, &graph))
+	{
+		graph_release(&graph);
+		return 1;
+	}
+	unsigned int* order = (unsigned int*)malloc((graph.count + 1) * sizeof(unsigned int));
+	unsigned int* idom = (unsigned int*)malloc((graph.count + 1) * sizeof(unsigned int));
+	RetainedObject* objects = (RetainedObject*)malloc((graph.count + 1) * sizeof(RetainedObject));
+	const size_t reached = order != 0 && idom != 0 && objects != 0 ? graph_dominators(&graph, order, idom) : 0;
+	if (reached == 0)
+	{
+		free(order);
+		free(idom);
+		free(objects);
+		graph_release(&graph);
+		return 1;
+	}
+	/*	Dominators precede dominated vertices in depth first order, so sizes are summed up in reverse order	*/
+	for (size_t i = 1; i <= reached; ++i)
+	{
+		objects[i].number = (unsigned int)i;
+		objects[i].retained = i != 1 ? object_size(graph.objects[order[i]]) : 0;
+	}
+	for (size_t i = reached; i > 1; --i)
+		objects[idom[i]].retained += objects[i].retained;
+	qsort(objects + 2, reached - 1, sizeof(RetainedObject), retained_compare);
+	size_t written = 0;
+	for (; written < *count && written + 2 <= reached; ++written)
+	{
+		const GCObject* gcobj = graph.objects[order[objects[written + 2].number]];
+		ldv_retainer* retainer = &retainers[written];
+		retainer->object = gcobj;
+		retainer->type = gcobj->tt;
+		retainer->size = object_size(gcobj);
+		retainer->retained = objects[written + 2].retained;
+		object_name(gcobj, retainer->name, LDV_RETAINER_NAME_SIZE);
+	}
+	*count = written;
+	free(order);
+	free(idom);
+	free(objects);
+	graph_release(&graph);
+	return 0;
+}
+
+int ldv_duplicate_strings(lua_State* L, ldv_duplicate* duplicates, size_t* count, size_t* wasted)
 {
-	if (!check_ptr(L))
-		return 0;
 	global_State* g = G(L);
-	if (!check_ptr(g))
-		return 0;
-	GCObject* gobjects[10] = { g->allgc, g->sweepgc == NULL ? NULL : *(g->sweepgc), g->finobj, 
-							   g->gray, g->grayagain, g->weak, g->ephemeron, 
-							   g->allweak, g->tobefnz, g->fixedgc};
-	for (int i = 0; i < 10; ++i)
+	GCObject* const gclists[] = { g->allgc, g->finobj, g->tobefnz, g->fixedgc };
+	const unsigned int list_count = sizeof(gclists) / sizeof(gclists[0]);
+	size_t string_count = 0;
+	for (unsigned int list = 0; list < list_count; ++list)
 	{
-		GCObject* gcobj = gobjects[i];
-		while (gcobj != NULL)
+		for (const GCObject* gcobj = gclists[list]; gcobj != NULL; gcobj = gcobj->next)
+			string_count += gcobj->tt == LUA_TLNGSTR;
+	}
+	/*	Table of groups is at most half full, so it never grows	*/
+	size_t capacity = 16;
+	while (capacity < string_count * 2)
+		capacity *= 2;
+	StringGroup* groups = (StringGroup*)calloc(capacity, sizeof(StringGroup));
+	if (groups == NULL)
+		return 1;
+	const size_t mask = capacity - 1;
+	for (unsigned int list = 0; list < list_count; ++list)
+	{
+		for (const GCObject* gcobj = gclists[list]; gcobj != NULL; gcobj = gcobj->next)
 		{
-			if (!check_gcobject(L, gcobj))
-				return 0;
-			gcobj = gcobj->next;
+			if (gcobj->tt != LUA_TLNGSTR)
+				continue;
+			const TString* str = gco2ts(gcobj);
+			const size_t length = tsslen(str);
+			const uint64_t hash = content_hash(getstr(str), length);
+			size_t cell = (size_t)hash & mask;
+			for (; groups[cell].string != NULL; cell = (cell + 1) & mask)
+			{
+				const TString* first = groups[cell].string;
+				if (groups[cell].hash == hash && tsslen(first) == length && memcmp(getstr(first), getstr(str), length) == 0)
+					break;
+			}
+			groups[cell].string = str;
+			groups[cell].hash = hash;
+			++groups[cell].copies;
 		}
 	}
-	return 1;
+	/*	Groups of duplicates are packed to the beginning of table	*/
+	size_t group_count = 0;
+	*wasted = 0;
+	for (size_t cell = 0; cell < capacity; ++cell)
+	{
+		if (groups[cell].copies < 2)
+			continue;
+		groups[group_count] = groups[cell];
+		groups[group_count].wasted = (groups[cell].copies - 1) * sizelstring(tsslen(groups[cell].string));
+		*wasted += groups[group_count].wasted;
+		++group_count;
+	}
+	qsort(groups, group_count, sizeof(StringGroup), group_compare);
+	size_t written = 0;
+	for (; written < *count && written < group_count; ++written)
+	{
+		const StringGroup* group = &groups[written];
+		ldv_duplicate* duplicate = &duplicates[written];
+		duplicate->object = group->string;
+		duplicate->length = tsslen(group->string);
+		duplicate->copies = group->copies;
+		duplicate->wasted = group->wasted;
+		const size_t sample_length = duplicate->length < LDV_DUPLICATE_SAMPLE_SIZE - 1 ? duplicate->length : LDV_DUPLICATE_SAMPLE_SIZE - 1;
+		const char* contents = getstr(group->string);
+		for (size_t i = 0; i < sample_length; ++i)
+			duplicate->sample[i] = contents[i] >= 32 && contents[i] < 127 ? contents[i] : '.';
+		duplicate->sample[sample_length] = '\0';
+	}
+	*count = written;
+	free(groups);
+	return 0;
 }
 
-void* ldv_frealloc(void* ud, void* ptr, size_t osize, size_t nsize)
+int ldv_get_table_shape(const Table* table, ldv_table_shape* shape)
 {
-	LDV_UNUSED(ud)
-	if (nsize == 0)
+	unsigned char* linked = (unsigned char*)calloc(sizenode(table), 1);
+	if (linked == NULL)
+		return 1;
+	measure_table(table, linked, shape);
+	free(linked);
+	return 0;
+}
+
+int ldv_table_shapes(lua_State* L, ldv_table_shape* shapes, size_t* count, ldv_table_shape* total, size_t* table_count)
+{
+	global_State* g = G(L);
+	GCObject* const gclists[] = { g->allgc, g->finobj, g->tobefnz, g->fixedgc };
+	const unsigned int list_count = sizeof(gclists) / sizeof(gclists[0]);
+	size_t tables = 0;
+	int max_nodes = 1;
+	for (unsigned int list = 0; list < list_count; ++list)
 	{
-		ldv_free(ptr);
-		return 0;
+		for (const GCObject* gcobj = gclists[list]; gcobj != NULL; gcobj = gcobj->next)
+		{
+			if (gcobj->tt != LUA_TTABLE)
+				continue;
+			++tables;
+			if (sizenode(gco2t(gcobj)) > max_nodes)
+				max_nodes = sizenode(gco2t(gcobj));
+		}
 	}
-	void* all_mem = ldv_malloc(nsize);
-	LDV_ASSERT(check_ptr(all_mem))
-	if (ptr != 0 && osize != 0)
+	ldv_table_shape* all = (ldv_table_shape*)malloc((tables != 0 ? tables : 1) * sizeof(ldv_table_shape));
+	unsigned char* linked = (unsigned char*)calloc((size_t)max_nodes, 1);
+	if (all == NULL || linked == NULL)
 	{
-		LDV_ASSERT(check_ptr(ptr))
-		memcpy(all_mem, ptr, osize < nsize ? osize : nsize);
-		ldv_free(ptr);
+		free(all);
+		free(linked);
+		return 1;
 	}
-	return all_mem;
+	memset(total, 0, sizeof(ldv_table_shape));
+	size_t measured = 0;
+	for (unsigned int list = 0; list < list_count; ++list)
+	{
+		for (const GCObject* gcobj = gclists[list]; gcobj != NULL; gcobj = gcobj->next)
+		{
+			if (gcobj->tt != LUA_TTABLE)
+				continue;
+			ldv_table_shape* shape = &all[measured++];
+			measure_table(gco2t(gcobj), linked, shape);
+			total->array_size += shape->array_size;
+			total->array_used += shape->array_used;
+			total->node_size += shape->node_size;
+			total->node_used += shape->node_used;
+			total->dead_keys += shape->dead_keys;
+			total->integer_keys += shape->integer_keys;
+			total->chains += shape->chains;
+			total->wasted += shape->wasted;
+			if (shape->max_chain > total->max_chain)
+				total->max_chain = shape->max_chain;
+		}
+	}
+	free(linked);
+	if (total->chains != 0)
+		total->average_chain = (double)(total->node_used + total->dead_keys) / (double)total->chains;
+	qsort(all, measured, sizeof(ldv_table_shape), shape_compare);
+	if (*count > measured)
+		*count = measured;
+	memcpy(shapes, all, *count * sizeof(ldv_table_shape));
+	free(all);
+	*table_count = measured;
+	return 0;
 }
 
-void ldv_dump_heap()
+void ldv_dump_heap(const ldv_heap* heap)
 {
-	ldv_portion_dump(0, MEM_BUFF_SIZE);
+	ldv_portion_dump(heap, 0, (unsigned int)-1);
 }
 
-void ldv_portion_dump(const unsigned int fst_head, const unsigned int count)
+void ldv_portion_dump(const ldv_heap* heap, const unsigned int fst_head, const unsigned int count)
 {
-	BlockHead* start_head = (BlockHead*)mem_buf;
-	ldv_log(0, "======  LDV memory layout [%p, %p)         ===============\n", mem_buf, mem_buf + MEM_BUFF_SIZE);
-	for (unsigned int heads_count = 0; ; ++heads_count)
+	log_batch_begin();
+	unsigned int heads_count = 0;
+	for (HeapRegion* region = heap->regions; region != 0; region = region->next)
 	{
-		if (heads_count < fst_head)
-			continue;
-		if (heads_count >= fst_head + count)
-			break;
-		ldv_block_type prev = get_head_offset(start_head, PrevHead);
-		ldv_block_type next = get_head_offset(start_head, NextHead);
-		const char* data_status = status(start_head, DataState) == Gem ? "GEM" : "GARBAGE";
-		ldv_log(0, "HEAD %i, address %p, prev %i, next %i, data type %s \n", heads_count, start_head, prev, next, data_status);
-		if (status(start_head, NextHeadState) == MarginHead)
+		BlockHead* start_head = (BlockHead*)region->mem;
+		ldv_log(0, "======  LDV memory layout [%p, %p)         ===============\n", region->mem, region->mem + region->size);
+		for (;; ++heads_count)
+		{
+			if (heads_count >= fst_head && heads_count - fst_head >= count)
+				break;
+			ldv_block_type next = get_head_offset(start_head, NextHead);
+			if (heads_count >= fst_head)
+			{
+				ldv_block_type prev = get_head_offset(start_head, PrevHead);
+				const char* data_status = status(start_head, DataState) == Gem ? "GEM" : "GARBAGE";
+				const SlabPage* page = status(start_head, DataState) == Gem ? find_slab_page(heap, (unsigned char*)(RAW_MEMORY(start_head) + 2) + SLAB_PAGE_BYTES - 1) : 0;
+				const BlockTag* tag = status(start_head, DataState) == Gem && heap->tags.count != 0 ? &heap->tags.cells[tag_cell(&heap->tags, RAW_MEMORY(start_head) + 2)] : 0;
+				if (tag != 0 && tag->ptr == 0)
+					tag = 0;
+				if (page != 0 && page->block == RAW_MEMORY(start_head) + 2)
+					ldv_log(0, "HEAD %i, address %p, prev %i, next %i, data type SLAB (slot %i bytes, used %i of %i slots) \n", heads_count, start_head, prev, next, page->slot_size, page->slot_count - page->free_count, page->slot_count);
+				else if (tag != 0)
+					ldv_log(0, "HEAD %i, address %p, prev %i, next %i, data type %s (%s, %s:%i) \n", heads_count, start_head, prev, next, data_status,
+						tag_type_name(tag->type), tag->site != 0 ? heap->tags.sites[tag->site].source : "?", heap->tags.sites[tag->site].line);
+				else
+					ldv_log(0, "HEAD %i, address %p, prev %i, next %i, data type %s \n", heads_count, start_head, prev, next, data_status);
+			}
+			if (status(start_head, NextHeadState) == MarginHead)
+			{
+				++heads_count;
+				break;
+			}
+			start_head = raw_move_head(start_head, NextHead, next);
+		}
+		if (heads_count >= fst_head && heads_count - fst_head >= count)
 			break;
-		start_head = raw_move_head(start_head, NextHead, next);
 	}
 	ldv_log(0, "==========================================================\n");
-
+	log_batch_end();
 }
 
-void (ldv_dump_ldv_heap_at_mem)(const void* ptr)
+void (ldv_dump_ldv_heap_at_mem)(const ldv_heap* heap, const void* ptr)
 {
-	LDV_UNUSED(ptr)
+	LDV_UNUSED(heap) LDV_UNUSED(ptr)
 	/* Not implemented */
 }
 
 void (ldv_dump_hash_strtable)(lua_State* L)
 {
+	log_batch_begin();
 	stringtable* hash_string_table = &G(L)->strt;
 	ldv_log(0, "======= HASH STRING TABLE DUMP (nuse: %i) (size: %i) ==============\n", hash_string_table->nuse, hash_string_table->size);
 	for (int i = 0; i < hash_string_table->size; ++i)
@@ -785,10 +7052,99 @@ void (ldv_dump_hash_strtable)(lua_State* L)
 		ldv_log(INDENT_SIZE, "=======================================\n");
 	}
 	ldv_log(0, "==========================================================\n");
+	log_batch_end();
+}
+
+/*
+		Compares hashes of strings for sorting
+		Params: hashes
+		Return: comparison result
+*/
+static int hash_compare(const void* a, const void* b)
+{
+	const unsigned int x = *(const unsigned int*)a;
+	const unsigned int y = *(const unsigned int*)b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+int (ldv_get_strtable_stats)(lua_State* L, ldv_strtable_stats* stats)
+{
+	const stringtable* strt = &G(L)->strt;
+	memset(stats, 0, sizeof(ldv_strtable_stats));
+	stats->size = strt->size;
+	stats->count = strt->nuse;
+	stats->load_factor = strt->size != 0 ? (double)strt->nuse / (double)strt->size : 0.0;
+	for (int i = 0; i < strt->size; ++i)
+	{
+		int length = 0;
+		for (const TString* ts = strt->hash[i]; ts != NULL; ts = ts->u.hnext)
+			++length;
+		++stats->chain_histogram[length < LDV_CHAIN_HISTOGRAM_SIZE ? length : LDV_CHAIN_HISTOGRAM_SIZE - 1];
+		if (length == 0)
+		{
+			++stats->empty_buckets;
+			continue;
+		}
+		if (length > stats->max_chain)
+			stats->max_chain = length;
+		/*	The longest chains are kept sorted by insertion	*/
+		int pos = stats->longest_count < LDV_LONGEST_CHAINS ? stats->longest_count++ : LDV_LONGEST_CHAINS;
+		for (; pos > 0 && stats->longest[pos - 1].length < length; --pos)
+		{
+			if (pos < LDV_LONGEST_CHAINS)
+				stats->longest[pos] = stats->longest[pos - 1];
+		}
+		if (pos < LDV_LONGEST_CHAINS)
+		{
+			stats->longest[pos].bucket = i;
+			stats->longest[pos].length = length;
+			stats->longest[pos].distinct_hashes = length;
+			stats->longest[pos].hash = strt->hash[i]->hash;
+		}
+	}
+	const int used_buckets = strt->size - stats->empty_buckets;
+	stats->average_chain = used_buckets != 0 ? (double)strt->nuse / (double)used_buckets : 0.0;
+	stats->observed_collisions = strt->nuse != 0 ? (double)(strt->nuse - used_buckets) / (double)strt->nuse : 0.0;
+	/*	Uniform hash leaves each bucket empty with probability (1 - 1/size)^count	*/
+	if (strt->nuse != 0 && strt->size != 0)
+	{
+		const double expected_used = (double)strt->size * (1.0 - exp((double)strt->nuse * log1p(-1.0 / (double)strt->size)));
+		stats->expected_collisions = ((double)strt->nuse - expected_used) / (double)strt->nuse;
+	}
+	if (stats->max_chain < 2)
+		return 0;
+	/*	Strings of same full hash collide at any size of table, they are counted by sorted hashes of chains	*/
+	unsigned int* hashes = (unsigned int*)malloc((size_t)stats->max_chain * sizeof(unsigned int));
+	if (hashes == NULL)
+		return 1;
+	for (int i = 0; i < strt->size; ++i)
+	{
+		int length = 0;
+		for (const TString* ts = strt->hash[i]; ts != NULL; ts = ts->u.hnext)
+			hashes[length++] = ts->hash;
+		if (length < 2)
+			continue;
+		qsort(hashes, (size_t)length, sizeof(unsigned int), hash_compare);
+		int distinct_hashes = 1;
+		for (int j = 1; j < length; ++j)
+		{
+			if (hashes[j] != hashes[j - 1])
+				++distinct_hashes;
+		}
+		stats->same_hash += length - distinct_hashes;
+		for (int j = 0; j < stats->longest_count; ++j)
+		{
+			if (stats->longest[j].bucket == i)
+				stats->longest[j].distinct_hashes = distinct_hashes;
+		}
+	}
+	free(hashes);
+	return 0;
 }
 
 void ldv_bt(lua_State* L)
 {
+	log_batch_begin();
 	ldv_log(0, "=======           LUA BACKTRACE       ==============\n");
 	int index = 0;
 	for (CallInfo* ci = &(L->base_ci); ci != 0; ci = ci->next, ++index)
@@ -796,10 +7152,13 @@ void ldv_bt(lua_State* L)
 		ldv_log(0, "Frame %i: results: %i, [%i, %i] \n", index, ci->nresults, ci->func - L->base_ci.func, ci->top - L->base_ci.func);
 	}
 	ldv_log(0, "=========================================================\n");
+	log_batch_end();
 }
 
 void ldv_f(lua_State* L, const int frame_index, const int depth)
 {
+	log_batch_begin();
+	dump_session_begin();
 	int index = 0;
 	CallInfo* ci = &(L->base_ci);
 	for (; ci != 0 && index != frame_index; ci = ci->next)
@@ -814,10 +7173,14 @@ void ldv_f(lua_State* L, const int frame_index, const int depth)
 		}
 	}
 	ldv_log(0, "=========================================================\n");
+	dump_session_end();
+	log_batch_end();
 }
 
 void ldv_stack(lua_State* L, const int depth)
 {
+	log_batch_begin();
+	dump_session_begin();
 	ldv_log(0, "=================  Lua stack  =======================\n");
 	for (StkId it = L->stack; it != L->top; ++it)
 	{
@@ -826,10 +7189,14 @@ void ldv_stack(lua_State* L, const int depth)
 		ldv_log(0, "\n");
 	}
 	ldv_log(0, "=========================================================\n");
+	dump_session_end();
+	log_batch_end();
 }
 
 void ldv_dump_tops(lua_State* L, const int tops, const int depth)
 {
+	log_batch_begin();
+	dump_session_begin();
 	ldv_log(0, "=========TOPS: %i===========\n", tops);
 	for (int i = 1; i <= tops; ++i)
 	{
@@ -837,6 +7204,8 @@ void ldv_dump_tops(lua_State* L, const int tops, const int depth)
 		ldv_log(0, "\n\n");
 	}
 	ldv_log(0, "===============================\n");
+	dump_session_end();
+	log_batch_end();
 }
 
 void ldv_dump_upvalue(const int depth, lua_State* L, const UpVal* upval)
@@ -849,27 +7218,8 @@ void ldv_dump_upvalue(const int depth, lua_State* L, const UpVal* upval)
 
 void ldv_dump_value(const int depth, lua_State* L, const TValue* value)
 {
-	LDV_DEPTH_CHECK(depth)
-	switch (ttype(value))
-	{
-
-		case LUA_TNIL:			 ldv_dump_nil(depth - 1, L, value);							return;
-		case LUA_TBOOLEAN:		 ldv_dump_boolean(depth - 1, L, bvalue(value));				return;
-		case LUA_TTABLE:		 ldv_dump_table(depth - 1, L, hvalue(value));					return;
-		case LUA_TLCL:			 ldv_dump_lua_closure(depth - 1, L, clLvalue(value));			return;
-		case LUA_TCCL:			 ldv_dump_c_closure(depth - 1, L, clCvalue(value));			return;
-		case LUA_TLCF:			 ldv_dump_c_light_func(depth - 1, L, fvalue(value));			return;
-		case LUA_TNUMFLT:		 ldv_dump_float_number(depth - 1, L, fltvalue(value));			return;
-		case LUA_TNUMINT:		 ldv_dump_int_number(depth - 1, L, ivalue(value));				return;
-		case LUA_TTHREAD:		 ldv_dump_thread(depth - 1, L, thvalue(value));				return;
-		case LUA_TUSERDATA:		 ldv_dump_user_data(depth - 1, L, getudatamem(uvalue(value))); return;
-		case LUA_TLIGHTUSERDATA: ldv_dump_light_user_data(depth - 1, L, pvalue(value));		return;
-		case LUA_TSHRSTR:		 ldv_dump_short_string(depth - 1, L, tsvalue(value));			return;
-		case LUA_TLNGSTR:		 ldv_dump_long_string(depth - 1, L, tsvalue(value));			return;
-		default:
-			ldv_log(0, "(ldv_dump_value func). Not recognized type: %s \n", ttypename(ttnov(value)));
-			return;
-	}
+	const WalkItem item = value_item(value);
+	dump_item(depth, L, &item);
 }
 
 void ldv_dump_nil(const int depth, lua_State* L, const TValue* nil_object)
@@ -888,63 +7238,20 @@ void ldv_dump_boolean(const int depth, lua_State* L, const int bool_val)
 
 void ldv_dump_table(const int depth, lua_State* L, const Table* table)
 {
-	LDV_DEPTH_CHECK(depth)
-	int first = 1;
-	ldv_log(0, "{");
-	for (unsigned int i = 0; i < table->sizearray; ++i) 
-	{
-		if (!first)
-		{
-			ldv_log(0, ",");
-		}
-		first = 0;
-		ldv_log(0, "[%i]=", i);
-		ldv_dump_value(depth - 1, L, &table->array[i]);
-    }
-	for (int i = 0; i < sizenode(table); ++i)
-	{
-		Node* node = &table->node[i];
-		if (ttisnil(gkey(node)) || ttisnil(gval(node)))
-			continue;
-		if (!first)
-		{
-			ldv_log(0, ",");
-		}
-		first = 0;
-		ldv_log(0,"[");
-		ldv_dump_value(depth - 1, L, gkey(node));
-		ldv_log(0,"]=");
-		ldv_dump_value(depth - 1, L, gval(node));
-	}
-	ldv_log(0, "}");
+	const WalkItem item = object_item(LUA_TTABLE, table);
+	dump_item(depth, L, &item);
 }
 
-
 void ldv_dump_lua_closure(const int depth, lua_State* L, const LClosure* lclosure)
 {
-	LDV_UNUSED(L) LDV_UNUSED(lclosure)
-	LDV_DEPTH_CHECK(depth)
-	ldv_log(0, "LuaClosure (");
-	for (unsigned int i = 0; i < lclosure->nupvalues; ++i)
-	{
-		ldv_dump_upvalue(depth - 1, L, lclosure->upvals[i]);
-		ldv_log(0, ",");
-	}
-	ldv_log(0, ") ");
-	ldv_dump_proto(depth - 1, L, lclosure->p);
+	const WalkItem item = object_item(LUA_TLCL, lclosure);
+	dump_item(depth, L, &item);
 }
 
 void ldv_dump_proto(const int depth, lua_State* L, const Proto* proto)
 {
-	LDV_DEPTH_CHECK(depth)
-	ldv_log(0, "Proto(up %i, csize %i, ksize %i) (", proto->sizeupvalues, proto->sizecode, proto->sizek);
-	for (int i = 0; i < proto->sizeupvalues; ++i)
-	{
-		//	TODO: (alex) think about long string, I am not sure that it is right
-		ldv_dump_short_string(depth - 1, L, proto->upvalues[i].name);	
-		ldv_log(0, ",");
-	}
-	ldv_log(0, ")");
+	const WalkItem item = object_item(LUA_TPROTO, proto);
+	dump_item(depth, L, &item);
 }
 
 void ldv_dump_c_closure(const int depth, lua_State* L, const CClosure* cclosure)
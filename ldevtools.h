@@ -5,9 +5,218 @@
 #ifndef LUA_DEV_TOOLS_INCLUDED_H__
 #define LUA_DEV_TOOLS_INCLUDED_H__
 
+#include <stdio.h>
+
 #include "lua.h"
 #include "lobject.h"
 
+/*
+		Targets of ldv output
+*/
+typedef enum ldv_sink_type
+{
+	LDV_SINK_STDOUT,	/*	Output is written to stdout	*/
+	LDV_SINK_FILE,		/*	Output is written to FILE stream	*/
+	LDV_SINK_FD,		/*	Output is written to file descriptor	*/
+	LDV_SINK_MEMORY,	/*	Output is collected in memory (see ldv_sink_memory)	*/
+	LDV_SINK_CALLBACK	/*	Output is passed to user callback	*/
+} ldv_sink_type;
+
+/*
+		User callback of ldv output. Output is passed in batches
+*/
+typedef void (*ldv_sink_writer)(void* ud, const char* data, size_t size);
+
+/*
+		Target of ldv output
+*/
+typedef struct ldv_sink
+{
+	ldv_sink_type type;		/*	Type of target	*/
+	FILE* file;				/*	Stream (LDV_SINK_FILE)	*/
+	int fd;					/*	File descriptor (LDV_SINK_FD)	*/
+	ldv_sink_writer writer;	/*	Callback (LDV_SINK_CALLBACK)	*/
+	void* ud;				/*	User data of callback	*/
+} ldv_sink;
+
+/*
+		Poisoning policy of ldv heap blocks
+*/
+typedef enum ldv_poison_mode
+{
+	LDV_POISON_OFF,		/*	Blocks are not poisoned	*/
+	LDV_POISON_HEADER,	/*	Only first words of block payload are poisoned	*/
+	LDV_POISON_FULL		/*	Whole payload of block is poisoned	*/
+} ldv_poison_mode;
+
+/*
+		LDV heap. Each heap owns own memory regions and state
+*/
+typedef struct ldv_heap ldv_heap;
+
+/*
+		Status of incremental check of lua objects
+*/
+typedef enum ldv_check_status
+{
+	LDV_CHECK_RUNNING,	/*	Check is in progress	*/
+	LDV_CHECK_DONE,		/*	All objects are checked	*/
+	LDV_CHECK_FAILED	/*	Invalid object is found	*/
+} ldv_check_status;
+
+//		Count of buckets in size histogram of ldv heap statistics
+#define LDV_HISTOGRAM_SIZE 24
+//		Size of name buffer of retainer (name is cut to fit it)
+#define LDV_RETAINER_NAME_SIZE 64
+//		Size of contents sample of duplicated long string (contents are cut to fit it)
+#define LDV_DUPLICATE_SAMPLE_SIZE 64
+//		Count of buckets in chain length histogram of string table
+#define LDV_CHAIN_HISTOGRAM_SIZE 16
+//		Count of the longest chains of string table, which are reported
+#define LDV_LONGEST_CHAINS 8
+
+/*
+		Statistics of ldv heap. Sizes are sizes of memory requested by lua (in bytes)
+*/
+typedef struct ldv_stats
+{
+	size_t live_bytes;				/*	Size of allocated objects	*/
+	size_t live_blocks;				/*	Count of allocated objects	*/
+	size_t peak_bytes;				/*	Maximal size of allocated objects	*/
+	size_t alloc_count;				/*	Count of allocations	*/
+	size_t free_count;				/*	Count of frees	*/
+	size_t realloc_count;			/*	Count of reallocations	*/
+	size_t realloc_in_place_count;	/*	Count of reallocations served in place	*/
+	size_t realloc_moved_count;		/*	Count of reallocations served by copying to new block	*/
+	size_t free_blocks;				/*	Count of garbage blocks of heap	*/
+	size_t free_bytes;				/*	Size of garbage blocks of heap (heads included)	*/
+	size_t largest_free;			/*	Size of the largest garbage block of heap (head included)	*/
+	double fragmentation;			/*	1 - largest_free / free_bytes (0 - no free memory)	*/
+	size_t histogram[LDV_HISTOGRAM_SIZE];	/*	Count of (re)allocations of sizes (2^(k-1), 2^k], the last bucket also counts larger sizes	*/
+	size_t invalid_frees;			/*	Count of frees and reallocations of blocks, which are not allocated (double frees included)	*/
+	size_t overflows;				/*	Count of blocks, which redzone was overwritten	*/
+	size_t freed_writes;			/*	Count of quarantined blocks, which were written after free	*/
+	size_t lock_contentions;		/*	Count of heap lock acquisitions, which waited for other thread (thread safe mode)	*/
+} ldv_stats;
+
+/*
+		Fragmentation of free memory of ldv heap. Sizes are sizes of heap blocks (heads included, in bytes)
+*/
+typedef struct ldv_fragmentation
+{
+	size_t free_blocks;				/*	Count of garbage blocks	*/
+	size_t free_bytes;				/*	Size of garbage blocks	*/
+	size_t largest_free;			/*	Size of the largest contiguous garbage block	*/
+	size_t gem_blocks;				/*	Count of allocated blocks (slab pages included)	*/
+	size_t gem_bytes;				/*	Size of allocated blocks	*/
+	size_t free_count[LDV_HISTOGRAM_SIZE];	/*	Count of garbage blocks of sizes (2^(k-1), 2^k], the last bucket also counts larger sizes	*/
+	size_t free_size[LDV_HISTOGRAM_SIZE];	/*	Size of garbage blocks of each bucket	*/
+} ldv_fragmentation;
+
+/*
+		Result of heap compaction
+*/
+typedef struct ldv_compaction
+{
+	size_t moved_blocks;			/*	Count of relocated blocks	*/
+	size_t moved_bytes;				/*	Size of relocated memory (requested by lua)	*/
+	size_t largest_free_before;		/*	Size of the largest garbage block before compaction	*/
+	size_t largest_free_after;		/*	Size of the largest garbage block after compaction	*/
+} ldv_compaction;
+
+/*
+		Grouping of tagged heap blocks in report
+*/
+typedef enum ldv_tag_group
+{
+	LDV_TAG_BY_TYPE,	/*	Blocks are grouped by lua type	*/
+	LDV_TAG_BY_SITE		/*	Blocks are grouped by allocation site (source:line)	*/
+} ldv_tag_group;
+
+/*
+		Entry of report on tagged heap blocks
+*/
+typedef struct ldv_tag_entry
+{
+	const char* name;		/*	Name of lua type ("memory" - not lua object) or source of allocation site ("?" - unknown site)	*/
+	int line;				/*	Line of allocation site (-1 - unknown line, 0 for types)	*/
+	size_t live_bytes;		/*	Size of live blocks	*/
+	size_t live_blocks;		/*	Count of live blocks	*/
+} ldv_tag_entry;
+
+/*
+		Long strings with same contents
+*/
+typedef struct ldv_duplicate
+{
+	const void* object;		/*	Address of one of strings	*/
+	size_t length;			/*	Length of contents	*/
+	size_t copies;			/*	Count of strings with same contents	*/
+	size_t wasted;			/*	Size of memory of all copies but one	*/
+	char sample[LDV_DUPLICATE_SAMPLE_SIZE];	/*	Beginning of contents (bytes, which are not printable, are replaced by '.')	*/
+} ldv_duplicate;
+
+/*
+		Shape of table: utilisation of array and hash parts and collision chains of hash part. Chain is list of nodes,
+		which are linked by next offsets of nodes (keys with same main position), lookup of key walks its chain
+*/
+typedef struct ldv_table_shape
+{
+	const void* object;		/*	Address of table (NULL for totals of all tables)	*/
+	size_t array_size;		/*	Count of array slots	*/
+	size_t array_used;		/*	Count of non nil array slots	*/
+	size_t node_size;		/*	Count of nodes (0 - hash part is empty and shared dummy node is used)	*/
+	size_t node_used;		/*	Count of nodes with non nil values	*/
+	size_t dead_keys;		/*	Count of nodes with nil values, which still hold keys and stay in chains till rehash	*/
+	size_t integer_keys;	/*	Count of integer keys of hash part (keys, which were added out of order or to sparse table)	*/
+	size_t chains;			/*	Count of chains	*/
+	size_t max_chain;		/*	Length of the longest chain	*/
+	double average_chain;	/*	Average length of chains (count of nodes with keys / count of chains)	*/
+	size_t wasted;			/*	Size of unused array slots and nodes	*/
+} ldv_table_shape;
+
+/*
+		Chain of string table bucket
+*/
+typedef struct ldv_strtable_chain
+{
+	int bucket;				/*	Index of bucket	*/
+	int length;				/*	Count of strings in chain	*/
+	int distinct_hashes;	/*	Count of distinct full hashes in chain (less than length - strings have same hash)	*/
+	unsigned int hash;		/*	Hash of the first string of chain	*/
+} ldv_strtable_chain;
+
+/*
+		Health of string table of short strings. Collision rate is share of strings, which are not the first ones in their chains
+*/
+typedef struct ldv_strtable_stats
+{
+	int size;						/*	Count of buckets	*/
+	int count;						/*	Count of strings	*/
+	double load_factor;				/*	count / size	*/
+	int empty_buckets;				/*	Count of empty buckets	*/
+	int max_chain;					/*	Length of the longest chain	*/
+	double average_chain;			/*	Average length of non empty chains (average probe length of successful lookup is (1 + average_chain) / 2 at most)	*/
+	size_t chain_histogram[LDV_CHAIN_HISTOGRAM_SIZE];	/*	Count of buckets with chain of each length, the last bucket also counts longer chains	*/
+	double expected_collisions;		/*	Collision rate of uniform hash with same count and size	*/
+	double observed_collisions;		/*	Collision rate of string table	*/
+	int same_hash;					/*	Count of strings, which full hash equals hash of previous string of its chain (bad seeding)	*/
+	int longest_count;				/*	Count of reported chains	*/
+	ldv_strtable_chain longest[LDV_LONGEST_CHAINS];	/*	The longest chains (in descending order of length)	*/
+} ldv_strtable_stats;
+
+/*
+		Gc object with size of memory, which it retains
+*/
+typedef struct ldv_retainer
+{
+	const void* object;		/*	Address of gc object	*/
+	int type;				/*	Variant type tag of object (LUA_TSHRSTR, LUA_TTABLE, LUA_TLCL, ..., LUA_TPROTO)	*/
+	size_t size;			/*	Size of object with its own arrays	*/
+	size_t retained;		/*	Size of object and objects, which are reachable from roots only through it	*/
+	char name[LDV_RETAINER_NAME_SIZE];	/*	Contents of string, source of function (empty for other objects)	*/
+} ldv_retainer;
+
 //	Public API
 /*
 		Loads LDV library (to use functions from library)
@@ -17,56 +226,378 @@
 LUA_API void (ldv_load_lib)(lua_State* L);
 
 /*
-		Clears custom ldv heap 
+		Gets default ldv heap. It is used by ldv_frealloc, when no heap is passed as user data.
+		Without initialization default heap starts from static memory buffer
 		Params: none
+		Return: default heap
+*/
+LUA_API ldv_heap* (ldv_default_heap)(void);
+
+/*
+		Creates ldv heap. Heap is passed as user data to ldv_frealloc (lua_newstate(ldv_frealloc, heap))
+		Params: size of heap region in bytes (0 - default size), maximal size of heap in bytes (0 - heap is not limited)
+		Return: created heap (NULL on failure)
+*/
+LUA_API ldv_heap* (ldv_heap_create)(size_t size, size_t max_size);
+
+/*
+		Destroys ldv heap with all its regions
+		Params: heap
+		Return: none
+*/
+LUA_API void (ldv_heap_destroy)(ldv_heap* heap);
+
+/*
+		Gets ldv heap of lua state
+		Params: lua state
+		Return: heap, passed to ldv_frealloc of lua state (default heap, if state does not use own heap)
+*/
+LUA_API ldv_heap* (ldv_state_heap)(lua_State* L);
+
+/*
+		Initializes ldv heap. All regions of heap are released, so it has to be called before any allocation
+		Params: heap, size of heap region in bytes (0 - default size, static memory buffer for default heap), 
+				maximal size of heap in bytes (0 - heap is not limited)
+		Return: error code (0 - success)
+*/
+LUA_API int (ldv_init_heap)(ldv_heap* heap, size_t size, size_t max_size);
+
+/*
+		Clears custom ldv heap 
+		Params: heap
 		Return: none
 */
-LUA_API void (ldv_clear_heap)();
+LUA_API void (ldv_clear_heap)(ldv_heap* heap);
 
 /*
 		Performs local checks on ldv heap
-		Params: none
+		Params: heap
 		Return: error code (0 - success)
 */
-LUA_API int (ldv_check_heap)();
+LUA_API int (ldv_check_heap)(ldv_heap* heap);
 
 /*
-		Checks pointers in lua objects
+		Checks pointers in lua objects. Each object and each array of object has to be payload of live block,
+		which is large enough to hold it
 		Params: lua state
 		Return: error code
 */
 LUA_API int (ldv_check_ptrs)(lua_State* L);
 
+/*
+		Checks pointers in lua objects incrementally. Each call checks at most budget objects
+		of gc lists and resumes from the place, where previous call stopped
+		Params: lua state, maximal count of checked objects
+		Return: check status (next call after LDV_CHECK_DONE/LDV_CHECK_FAILED starts new check)
+
+		NOTE: Lua keeps running between calls. Freed objects are skipped. Check is bound to global state of lua state,
+		it starts anew for other state, and when objects moved between gc lists since previous call (objects got
+		finalizers or were finalized), so objects are not missed, but states, which keep doing that, need larger budget.
+*/
+LUA_API ldv_check_status (ldv_check_ptrs_step)(lua_State* L, size_t budget);
+
 /*
 		LDV frealloc function
-		Params: user data, ptr to data, original size, new size
+		Params: user data (ldv heap, NULL - default heap), ptr to data, original size, new size
 		Return: ptr to freallocated memory
 
-		NOTE: Freallocation works inside static memory pool.
+		NOTE: Freallocation works inside memory pool of heap regions. Heap grows by adding
+		new regions, allocated blocks are never moved between regions.
 		Such behaviour "simulates" "fixed" pointers during lua session.
 */
 LUA_API void* (ldv_frealloc)(void* ud, void* ptr, size_t osize, size_t nsize);
 
 /*
-		Dumps layout of ldv heap
+		Sets poisoning policy of allocated/freed blocks
+		Params: heap, poisoning policy
+		Return: previous poisoning policy
+*/
+LUA_API ldv_poison_mode (ldv_set_poison)(ldv_heap* heap, ldv_poison_mode mode);
+
+/*
+		Enables/disables slab pages for small objects (objects up to 128 bytes)
+		Params: heap, enabled flag
+		Return: previous enabled flag
+
+		NOTE: Slab pages are kept in gem blocks of heap. Objects allocated from slab pages
+		stay there after disabling, only new allocations go to heap blocks.
+*/
+LUA_API int (ldv_set_slab)(ldv_heap* heap, int enabled);
+
+/*
+		Sets size of redzone, which follows payload of each heap block. Redzone is filled with pattern, which is checked
+		on free and reallocation of block and by ldv_check_heap. Overwritten redzones are reported and counted in ldv_stats
+		Params: heap, minimal size of redzone in bytes (0 - no redzones)
+		Return: error code (0 - success, 1 - heap has live blocks)
+
+		NOTE: Redzones are set before lua state is created (all blocks of heap have same redzone).
+		Objects of slab pages have no redzones, so new objects skip slab pages, while redzones are enabled.
+*/
+LUA_API int (ldv_set_redzone)(ldv_heap* heap, size_t bytes);
+
+/*
+		Sets size of quarantine. Freed heap blocks are filled with pattern and kept from reuse, till newer freed blocks
+		push them out of quarantine. Writes to quarantined blocks are detected, when they leave quarantine or by ldv_check_heap
+		Params: heap, maximal size of quarantined objects in bytes (0 - quarantine is disabled, quarantined blocks are freed)
+		Return: previous size of quarantine
+
+		NOTE: Double frees are detected regardless of quarantine, quarantine also catches double frees of blocks,
+		which would be reused otherwise. Objects of slab pages are not quarantined, so new objects skip slab pages.
+*/
+LUA_API size_t (ldv_set_quarantine)(ldv_heap* heap, size_t bytes);
+
+/*
+		Sets thread safe mode of heap, so heap is shared by lua states of several threads (or by lua_lock builds).
+		Heap operations are serialized by lock, while new and freed small objects are served by caches of threads
+		without lock. Caches are refilled by batches of blocks and flushed back to heap, when they grow too large
+		Params: heap, flag, whether heap is thread safe
+		Return: error code (0 - success, 1 - heap has live blocks)
+
+		NOTE: Mode is set before lua states are created. Small objects take whole slots of their size class.
+		Live and peak counters are updated atomically by each operation, other counters of cached operations are merged
+		to heap, when thread refills or flushes its cache, so they lag behind operations.
+		Tagging, sampling, redzones, quarantine and incremental check make all operations take lock.
+		Functions, which walk objects of lua state, are not synchronized: other threads of heap must not run them.
+*/
+LUA_API int (ldv_set_thread_safe)(ldv_heap* heap, int enabled);
+
+/*
+		Returns blocks cached by current thread to their heap and merges its counters
+		Params: none
+		Return: none
+
+		NOTE: Caches are flushed on thread exit by thread exit callback (pthread key or fiber local storage), so it is called
+		to return blocks earlier. Blocks cached for heap, which was destroyed or cleared since, are dropped without touching that heap.
+*/
+LUA_API void (ldv_thread_flush)(void);
+
+/*
+		Gets counters of ldv_frealloc reallocations
+		Params: heap, count of reallocations served in place, count of reallocations served by copy
+		Return: none
+*/
+LUA_API void (ldv_realloc_stats)(const ldv_heap* heap, size_t* in_place, size_t* moved);
+
+/*
+		Gets statistics of ldv heap. Counters are maintained on each allocation, so getting them is cheap
+		Params: heap, statistics
+		Return: none
+
+		NOTE: Free memory counters are summed over heap regions (one region by default).
+*/
+LUA_API void (ldv_get_stats)(const ldv_heap* heap, ldv_stats* stats);
+
+/*
+		Analyses fragmentation of free memory. All blocks of heap are walked
+		Params: heap, fragmentation report (out)
+		Return: none
+*/
+LUA_API void (ldv_get_fragmentation)(const ldv_heap* heap, ldv_fragmentation* report);
+
+/*
+		Dumps size distribution of garbage blocks of heap
+		Params: heap
+		Return: none
+*/
+LUA_API void (ldv_dump_fragmentation)(const ldv_heap* heap);
+
+/*
+		Enables/disables relocating mode of heap, which allows ldv_compact to move memory of lua objects
+		Params: heap, enabled flag
+		Return: previous enabled flag
+
+		NOTE: Heap promises fixed addresses of blocks by default. Relocating mode breaks this promise for
+		array and hash parts of tables, so C code must not keep pointers into them across ldv_compact.
+*/
+LUA_API int (ldv_set_relocation)(ldv_heap* heap, int enabled);
+
+/*
+		Compacts heap of lua state: array and hash parts of tables are moved to lower free blocks of their region
+		or to free blocks of earlier regions of heap, so garbage blocks are merged at the end of heap. Free blocks
+		are indexed once, so each part is placed in logarithmic time. References are fixed up by walk of all gc objects.
+		Gc objects themselves are never moved, since C code and string table keep their addresses
+		Params: lua state, result (out, may be NULL)
+		Return: error code (0 - success, 1 - relocating mode is disabled, 2 - out of memory)
+
+		NOTE: Lua state has to be quiescent: no C function keeps pointers into table parts (call from lua script is safe).
+		Compaction never grows heap. Parts, which are kept in slab pages, are not moved. Thread safe heap is locked
+		during compaction, so other lua states of heap keep running, tables of this state are moved only.
+*/
+LUA_API int (ldv_compact)(lua_State* L, ldv_compaction* result);
+
+/*
+		Enables tagging of heap blocks. Each new block is tagged with lua type and with line of lua function,
+		which is running at allocation (C functions are attributed to lua line, which calls them)
+		Params: heap, enabled flag (disabling forgets all tags), lua state, which call stack gives allocation sites
+				(NULL - sites are not recorded)
+		Return: error code (0 - success)
+
+		NOTE: Blocks allocated before tagging are not reported. Allocator has no access to running coroutine,
+		so allocations of coroutines are attributed to call stack of passed state, unless resumes of coroutines
+		are reported by ldv_switch_thread (resume and wrap of ldv lua library do it, coroutine library is not changed).
+*/
+LUA_API int (ldv_set_tagging)(ldv_heap* heap, int enabled, lua_State* L);
+
+/*
+		Reports live memory of tagged blocks. Entries are sorted by live bytes (descending order)
+		Params: heap, grouping of blocks, entries (out), max count of entries
+		Return: count of groups (entries beyond max count are not written). Names are valid till tagging is disabled
+*/
+LUA_API size_t (ldv_tag_report)(const ldv_heap* heap, ldv_tag_group group, ldv_tag_entry* entries, size_t count);
+
+/*
+		Dumps live memory of tagged blocks by lua types and by allocation sites
+		Params: heap
+		Return: none
+*/
+LUA_API void (ldv_dump_tags)(const ldv_heap* heap);
+
+/*
+		Sets mean interval of sampling profiler of allocations. Intervals are random (geometric distribution),
+		so allocations of any size pattern are sampled fairly. Sample holds stack of lua state and a few native frames,
+		which called lua memory manager (frames of allocator and memory manager are skipped)
+		Params: heap, mean count of allocated bytes between samples (0 - sampling is disabled, profile is dropped),
+				lua state, which stack is sampled (NULL - only native frames are sampled)
+		Return: previous mean count of bytes
+
+		NOTE: Stacks of coroutines are sampled only while they are running ones of ldv_switch_thread, otherwise
+		stack of passed state is sampled. Native frames are sampled on systems with backtraces (windows, glibc, macOS, FreeBSD),
+		their names are addresses, which are resolved by symbolizer of host (e.g. addr2line).
+*/
+LUA_API size_t (ldv_set_sampling)(ldv_heap* heap, size_t mean_bytes, lua_State* L);
+
+/*
+		Sets running coroutine, which call stack gives allocation sites of tags and sampled stacks instead of states,
+		passed to ldv_set_tagging and ldv_set_sampling. Host, which resumes coroutines, switches to coroutine before
+		lua_resume and back to previous thread after it
+		Params: heap, running coroutine (NULL - states of tags and sampler are running)
+		Return: previous running coroutine
+*/
+LUA_API lua_State* (ldv_switch_thread)(ldv_heap* heap, lua_State* L);
+
+/*
+		Dumps profile of sampled allocations in folded stack format, which is read by flame graph tools:
+		line per stack with frames from the outermost one, separated by ';', and estimation of allocated bytes
+		Params: heap
+		Return: none
+*/
+LUA_API void (ldv_dump_samples)(const ldv_heap* heap);
+
+/*
+		Writes binary snapshot of heap: blocks of heap regions and graph of gc objects (format is described in ldvsnapshot.h).
+		Two snapshots are compared offline by tools/ldvdiff
+		Params: lua state, path of snapshot file
+		Return: error code (0 - success)
+
+		NOTE: Objects are identified by addresses, so object, which is freed and replaced by object of same type
+		at same address, is seen as same object. Full gc cycle before snapshot removes dead objects from snapshot.
+*/
+LUA_API int (ldv_snapshot)(lua_State* L, const char* path);
+
+/*
+		Starts recording of allocation trace: each successful ldv_frealloc call of heap is streamed to trace file
+		as compact record (format is described in ldvtrace.h). Trace is replayed offline by tools/ldvreplay
+		Params: heap, path of trace file
+		Return: error code (0 - success, 1 - file is not opened)
+
+		NOTE: Recording, which is in progress, is stopped. Threads of thread safe heap take heap lock for each operation,
+		while recording is on. Recording stops, when heap is cleared or destroyed.
+*/
+LUA_API int (ldv_trace_start)(ldv_heap* heap, const char* path);
+
+/*
+		Stops recording of allocation trace and closes trace file
+		Params: heap
+		Return: error code (0 - success or recording is off, 1 - trace is cut by write error or lack of memory)
+*/
+LUA_API int (ldv_trace_stop)(ldv_heap* heap);
+
+/*
+		Finds gc objects, which retain the most memory. Retained size of object is computed over dominator tree
+		of object graph: object dominates objects, which are reachable from roots (registry, main thread with its stack,
+		metatables of basic types, fixed objects and objects waiting for finalization) only through it
+		Params: lua state, retainers (out, sorted by retained size in descending order), max count of retainers (in),
+				count of written retainers (out)
+		Return: error code (0 - success)
+
+		NOTE: Objects, which are not reachable from roots (garbage of unfinished gc cycle), are not reported.
+		Roots themselves are reported too, so registry usually retains nearly all memory.
+*/
+LUA_API int (ldv_top_retainers)(lua_State* L, ldv_retainer* retainers, size_t* count);
+
+/*
+		Finds long strings, which have same contents. Long strings are not interned, so each copy holds own memory,
+		which would be saved by interning or caching of contents
+		Params: lua state, groups of duplicates (out, sorted by wasted memory in descending order), max count of groups (in),
+				count of written groups (out), wasted memory of all groups (out)
+		Return: error code (0 - success)
+
+		NOTE: Dead strings of unfinished gc cycle are counted too, full gc cycle before search leaves live strings only.
+*/
+LUA_API int (ldv_duplicate_strings)(lua_State* L, ldv_duplicate* duplicates, size_t* count, size_t* wasted);
+
+/*
+		Measures shape of table
+		Params: table, shape (out)
+		Return: error code (0 - success, 1 - out of memory)
+*/
+LUA_API int (ldv_get_table_shape)(const Table* table, ldv_table_shape* shape);
+
+/*
+		Measures shapes of all tables and finds the worst shaped ones, which should be presized
+		Params: lua state, shapes (out, sorted by wasted memory in descending order), max count of shapes (in),
+				count of written shapes (out), totals of all tables (out, average chain is average of all chains),
+				count of tables (out)
+		Return: error code (0 - success, 1 - out of memory)
+
+		NOTE: Dead tables of unfinished gc cycle are measured too, full gc cycle before search leaves live tables only.
+*/
+LUA_API int (ldv_table_shapes)(lua_State* L, ldv_table_shape* shapes, size_t* count, ldv_table_shape* total, size_t* table_count);
+
+/*
+		Sets target of ldv output of current thread. Output of previous target is flushed
+		Params: target (NULL - stdout)
+		Return: previous target
+
+		NOTE: Output is buffered. Stream targets get it by complete lines (or by large batches
+		within dumps of ldv library functions). Memory target keeps its output until target is changed.
+*/
+LUA_API ldv_sink (ldv_set_sink)(const ldv_sink* sink);
+
+/*
+		Flushes buffered ldv output of current thread to its target
 		Params: none
 		Return: none
 */
-LUA_API void (ldv_dump_heap)();
+LUA_API void (ldv_log_flush)(void);
+
+/*
+		Gets output collected by memory target of current thread
+		Params: size of output (out)
+		Return: collected output (zero terminated, valid until next output)
+*/
+LUA_API const char* (ldv_sink_memory)(size_t* size);
+
+/*
+		Dumps layout of ldv heap
+		Params: heap
+		Return: none
+*/
+LUA_API void (ldv_dump_heap)(const ldv_heap* heap);
 
 /*
 		Dumps portion layout of ldv heap by heads
-		Params: index of start head, heads count
+		Params: heap, index of start head, heads count
 		Return: none
 */
-LUA_API void (ldv_portion_dump)(const unsigned int start_head, const unsigned int heads_count);
+LUA_API void (ldv_portion_dump)(const ldv_heap* heap, const unsigned int start_head, const unsigned int heads_count);
 
 /*
 		Dumps ldv heap at memory
-		Params: pointer
+		Params: heap, pointer
 		Return: none
 */
-LUA_API void (ldv_dump_ldv_heap_at_mem)(const void* ptr);
+LUA_API void (ldv_dump_ldv_heap_at_mem)(const ldv_heap* heap, const void* ptr);
 
 /*
 		Dumpts hash table for strings of global state
@@ -75,6 +606,14 @@ LUA_API void (ldv_dump_ldv_heap_at_mem)(const void* ptr);
 */
 LUA_API void (ldv_dump_hash_strtable)(lua_State* L);
 
+/*
+		Analyses health of string table: load factor, chain lengths and collision rate. Strings are not printed,
+		so analysis of tables with millions of strings is cheap
+		Params: lua state, statistics (out)
+		Return: error code (0 - success, 1 - out of memory)
+*/
+LUA_API int (ldv_get_strtable_stats)(lua_State* L, ldv_strtable_stats* stats);
+
 /*
 		Dumps information about backtrace
 		Params: lua state
@@ -98,20 +637,20 @@ LUA_API void ldv_stack(lua_State* L, const int depth);
 
 /*
 		Dumpts tops values from lua stack
-		Params: lua state, count of top values
+		Params: lua state, count of top values, depth of dumping
 		Return: none
 */
-LUA_API void (ldv_dump_tops)(lua_State* L, const int tops);
+LUA_API void (ldv_dump_tops)(lua_State* L, const int tops, const int depth);
 
 /*
 		Dumps upvalue 
-		Params: lua state, upvalue
-		Params: none
+		Params: dump depth, lua state, upvalue
+		Return: none
 */
-LUA_API void (ldv_dump_upvalue)(lua_State* L, const UpVal* upval);
+LUA_API void (ldv_dump_upvalue)(const int depth, lua_State* L, const UpVal* upval);
 
 /*
-		Dumps object
+		Dumps object. Objects are walked iteratively, each table/closure/proto is expanded once
 		Params: dump depth, lua state, value
 		Return: none
 */
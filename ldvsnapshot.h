@@ -0,0 +1,135 @@
+/*
+			Binary snapshot of ldv heap. Format is shared by ldv library (writer) and offline tools (readers),
+			so it depends on standard headers only
+*/
+
+#ifndef LUA_DEV_TOOLS_SNAPSHOT_INCLUDED_H__
+#define LUA_DEV_TOOLS_SNAPSHOT_INCLUDED_H__
+
+#include <stdint.h>
+
+/*
+		Layout of snapshot file (all records are written in native byte order, which is marked in header):
+			ldv_snapshot_header
+			ldv_snapshot_block[block_count]		blocks of heap regions in address order
+			ldv_snapshot_object[object_count]	gc objects, index of object is its position
+			ldv_snapshot_edge[edge_count]		references between objects, grouped by source object
+			char[name_bytes]					zero terminated names of objects
+*/
+
+//		Magic of snapshot file
+#define LDV_SNAPSHOT_MAGIC "LDVSNAP"
+//		Version of snapshot format
+#define LDV_SNAPSHOT_VERSION 1
+//		Byte order mark (reads as other value on machine with other byte order)
+#define LDV_SNAPSHOT_BYTE_ORDER 0x01020304u
+//		Maximal length of object name (longer names are cut)
+#define LDV_SNAPSHOT_NAME_SIZE 64
+//		No object (key object of edge)
+#define LDV_SNAPSHOT_NO_OBJECT 0xFFFFFFFFu
+
+/*
+		States of heap blocks
+*/
+typedef enum ldv_snapshot_block_state
+{
+	LDV_SNAPSHOT_GARBAGE,	/*	Free block	*/
+	LDV_SNAPSHOT_GEM,		/*	Allocated block	*/
+	LDV_SNAPSHOT_SLAB		/*	Allocated block, which holds slab page of small objects	*/
+} ldv_snapshot_block_state;
+
+/*
+		Types of gc objects
+*/
+typedef enum ldv_snapshot_type
+{
+	LDV_SNAPSHOT_STRING,		/*	Short or long string	*/
+	LDV_SNAPSHOT_TABLE,			/*	Table	*/
+	LDV_SNAPSHOT_LCLOSURE,		/*	Lua closure	*/
+	LDV_SNAPSHOT_CCLOSURE,		/*	C closure	*/
+	LDV_SNAPSHOT_USERDATA,		/*	Full user data	*/
+	LDV_SNAPSHOT_THREAD,		/*	Thread	*/
+	LDV_SNAPSHOT_PROTO,			/*	Function prototype	*/
+	LDV_SNAPSHOT_TYPE_COUNT
+} ldv_snapshot_type;
+
+/*
+		Flags of gc objects
+*/
+typedef enum ldv_snapshot_flag
+{
+	LDV_SNAPSHOT_ROOT = 1,		/*	Object is root of object graph (registry, main thread, metatable of basic type)	*/
+	LDV_SNAPSHOT_FIXED = 2,		/*	Object is never collected	*/
+	LDV_SNAPSHOT_FINALIZED = 4,	/*	Object has finalizer	*/
+	LDV_SNAPSHOT_REGISTRY = 8	/*	Object is registry table	*/
+} ldv_snapshot_flag;
+
+/*
+		Kinds of references between objects
+*/
+typedef enum ldv_snapshot_edge_kind
+{
+	LDV_SNAPSHOT_ARRAY_ITEM,	/*	Item of table array part (index is 0 based)	*/
+	LDV_SNAPSHOT_NODE_KEY,		/*	Key of table node	*/
+	LDV_SNAPSHOT_NODE_VALUE,	/*	Value of table node (key object or integer key in index)	*/
+	LDV_SNAPSHOT_METATABLE,		/*	Metatable of table or user data	*/
+	LDV_SNAPSHOT_UPVALUE,		/*	Upvalue of closure	*/
+	LDV_SNAPSHOT_PROTO_REF,		/*	Proto of lua closure	*/
+	LDV_SNAPSHOT_UPVALUE_NAME,	/*	Name of proto upvalue	*/
+	LDV_SNAPSHOT_CONSTANT,		/*	Constant of proto	*/
+	LDV_SNAPSHOT_CHILD_PROTO,	/*	Nested proto	*/
+	LDV_SNAPSHOT_USER_VALUE,	/*	User value of user data	*/
+	LDV_SNAPSHOT_STACK_SLOT		/*	Slot of thread stack	*/
+} ldv_snapshot_edge_kind;
+
+/*
+		Header of snapshot file
+*/
+typedef struct ldv_snapshot_header
+{
+	char magic[8];				/*	LDV_SNAPSHOT_MAGIC	*/
+	uint32_t version;			/*	LDV_SNAPSHOT_VERSION	*/
+	uint32_t byte_order;		/*	LDV_SNAPSHOT_BYTE_ORDER	*/
+	uint64_t block_count;		/*	Count of heap blocks	*/
+	uint64_t object_count;		/*	Count of gc objects	*/
+	uint64_t edge_count;		/*	Count of references	*/
+	uint64_t name_bytes;		/*	Size of names	*/
+	uint64_t live_bytes;		/*	Size of objects allocated by lua	*/
+} ldv_snapshot_header;
+
+/*
+		Heap block
+*/
+typedef struct ldv_snapshot_block
+{
+	uint64_t address;			/*	Address of block payload	*/
+	uint64_t size;				/*	Size of block payload in bytes	*/
+	uint32_t state;				/*	ldv_snapshot_block_state	*/
+	uint32_t reserved;
+} ldv_snapshot_block;
+
+/*
+		Gc object
+*/
+typedef struct ldv_snapshot_object
+{
+	uint64_t address;			/*	Address of object	*/
+	uint64_t size;				/*	Size of object with its own arrays in bytes	*/
+	uint64_t name;				/*	Offset of name in names (string contents, proto source, function address)	*/
+	uint32_t type;				/*	ldv_snapshot_type	*/
+	uint32_t flags;				/*	ldv_snapshot_flag	*/
+} ldv_snapshot_object;
+
+/*
+		Reference between objects
+*/
+typedef struct ldv_snapshot_edge
+{
+	uint32_t from;				/*	Index of referencing object	*/
+	uint32_t to;				/*	Index of referenced object	*/
+	uint32_t kind;				/*	ldv_snapshot_edge_kind	*/
+	uint32_t key;				/*	Index of key object of node value (LDV_SNAPSHOT_NO_OBJECT - key is not object)	*/
+	int64_t index;				/*	Index of array item, upvalue, constant, stack slot or integer key	*/
+} ldv_snapshot_edge;
+
+#endif
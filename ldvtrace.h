@@ -0,0 +1,61 @@
+/*
+			Allocation trace of ldv heap. Format is shared by ldv library (writer) and offline tools (readers),
+			so it depends on standard headers only
+*/
+
+#ifndef LUA_DEV_TOOLS_TRACE_INCLUDED_H__
+#define LUA_DEV_TOOLS_TRACE_INCLUDED_H__
+
+#include <stdint.h>
+
+/*
+		Layout of trace file (header is written in native byte order, which is marked in header):
+			ldv_trace_header
+			records till the end of file
+
+		Record is operation byte followed by unsigned LEB128 numbers (7 bits per byte, low bits first,
+		high bit of byte marks next byte):
+			LDV_TRACE_MALLOC	id, lua type of object (0 - not lua object), new size, time delta
+			LDV_TRACE_FREE		id, old size, time delta
+			LDV_TRACE_REALLOC	id, old size, new size, time delta
+
+		Id names block from its allocation till its free (moved block keeps its id), ids of freed blocks are reused.
+		Time delta is count of nanoseconds since previous record (since start of recording for the first one).
+		Failed allocations are not recorded. Blocks allocated before recording started have no ids: their frees
+		are not recorded and their reallocations are recorded as allocations.
+*/
+
+//		Magic of trace file
+#define LDV_TRACE_MAGIC "LDVTRAC"
+//		Version of trace format
+#define LDV_TRACE_VERSION 1
+//		Byte order mark (reads as other value on machine with other byte order)
+#define LDV_TRACE_BYTE_ORDER 0x01020304u
+//		Maximal size of record in bytes
+#define LDV_TRACE_RECORD_SIZE 41
+
+/*
+		Operations of trace records
+*/
+typedef enum ldv_trace_op
+{
+	LDV_TRACE_MALLOC,		/*	New block	*/
+	LDV_TRACE_FREE,			/*	Freed block	*/
+	LDV_TRACE_REALLOC		/*	Resized block	*/
+} ldv_trace_op;
+
+/*
+		Header of trace file
+*/
+typedef struct ldv_trace_header
+{
+	char magic[8];				/*	LDV_TRACE_MAGIC	*/
+	uint32_t version;			/*	LDV_TRACE_VERSION	*/
+	uint32_t byte_order;		/*	LDV_TRACE_BYTE_ORDER	*/
+	uint64_t record_count;		/*	Count of records (0 - recording was not stopped, records are read till the end of file)	*/
+	uint64_t id_count;			/*	Count of ids (maximal id + 1)	*/
+	uint64_t live_bytes;		/*	Size of objects allocated by lua, when recording started	*/
+	uint64_t live_blocks;		/*	Count of objects allocated by lua, when recording started	*/
+} ldv_trace_header;
+
+#endif
@@ -1,28 +1,588 @@
-/*	Standard includes	*/
+/*
+			Benchmark of ldv allocator against system allocator. Each workload runs on each allocator twice:
+			the first run measures throughput, the second one measures latency of each allocator call.
+			Footprint and fragmentation of ldv heaps are taken at checkpoints of workloads.
+
+			Build: cc -O2 -I.. -I<lua>/src allocator_test.c ../ldevtools.c <lua>/src/liblua.a -lm -o allocator_test
+			Usage: allocator_test [-s scale] [workload...]
+*/
+
+//		POSIX clocks are declared in strict C modes too
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+	#define _POSIX_C_SOURCE 200112L
+#endif
+
+//	Standard includes
 #include <stdio.h>
-#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
 
-/*	Includes	*/
-#include "Lua.h"
+#ifdef _WIN32
+	#include <windows.h>
+#endif
+
+//	Includes
+#include "lua.h"
+#include "lauxlib.h"
+#include "lualib.h"
 #include "ldevtools.h"
 
-int main()
-{
-	ldv_initialize_heap();
-	lua_newstate(ldv_frealloc, 0);
-	ldv_dump_ldv_heap_layout();
-
-	///*	Initializes ldv heap */
-	//ldv_initialize_heap();
-	///*	Dumping ldv heap layout to test, whether it's ok*/
-	//ldv_dump_ldv_heap_layout();
-	//void* ptr1 = ldv_frealloc(0, 0, 0, 4);
-	//ldv_dump_ldv_heap_layout();
-	//void* ptr2 = ldv_frealloc(0, 0, 0, 4);
-	//ldv_dump_ldv_heap_layout();
-	//ldv_frealloc(0, ptr1, 4, 0);
-	//ldv_dump_ldv_heap_layout();
-	//ldv_frealloc(0, ptr2, 4, 0);
-	//ldv_dump_ldv_heap_layout();
+//	Types
+//		Count of latency samples (the latest calls of timed run are kept)
+#define LATENCY_SAMPLES 0x100000
+//		Size of the first region of ldv heaps in bytes
+#define HEAP_SIZE 0x100000
+//		Count of live objects of synthetic workloads
+#define LIVE_OBJECTS 4096
+//		Count of operations of churn workloads (multiplied by scale)
+#define CHURN_OPS 200000
+//		Count of rounds of free order workloads (multiplied by scale)
+#define ORDER_ROUNDS 40
+//		Count of interleaved realloc chains
+#define CHAIN_COUNT 64
+//		Maximal size of realloc chain in bytes
+#define CHAIN_MAX_SIZE 0x10000
+
+/*
+		Allocator under benchmark
+*/
+typedef struct Allocator
+{
+	/*	Name of allocator	*/
+	const char* name;
+	/*	Flag, whether allocator is ldv heap	*/
+	int ldv;
+	/*	Poisoning policy of ldv heap	*/
+	ldv_poison_mode poison;
+} Allocator;
+
+/*
+		State of workload run. Workloads allocate through bench_frealloc, which counts, times and forwards calls
+*/
+typedef struct Bench
+{
+	/*	Allocator under benchmark	*/
+	lua_Alloc frealloc;
+	/*	User data of allocator (ldv heap)	*/
+	void* ud;
+	/*	Flag, whether calls are timed	*/
+	int timed;
+	/*	Count of allocator calls	*/
+	size_t calls;
+	/*	Size of live objects	*/
+	size_t live_bytes;
+	/*	Maximal size of live objects	*/
+	size_t peak_bytes;
+	/*	Latencies of calls in nanoseconds (ring buffer)	*/
+	uint64_t* latencies;
+	/*	Count of timed calls	*/
+	size_t latency_count;
+	/*	Maximal size of ldv heap regions in bytes	*/
+	size_t footprint;
+	/*	Maximal fragmentation of ldv heap	*/
+	double fragmentation;
+	/*	State of random generator	*/
+	uint64_t random;
+	/*	Multiplier of operation counts	*/
+	size_t scale;
+} Bench;
+
+/*
+		Workload. It is synthetic sequence of calls or lua script
+*/
+typedef struct Workload
+{
+	/*	Name of workload	*/
+	const char* name;
+	/*	Runs synthetic workload (0 - workload is script)	*/
+	void (*run)(Bench* bench);
+	/*	Lua script (global SCALE is multiplier of iterations, checkpoint() takes heap checkpoint)	*/
+	const char* script;
+} Workload;
+
+/*
+		Gets monotonic time
+		Params: none
+		Return: time in nanoseconds
+*/
+static uint64_t now_ns(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/*
+		Gets next pseudo random number (xorshift)
+		Params: bench
+		Return: random number
+*/
+static uint64_t next_random(Bench* bench)
+{
+	uint64_t x = bench->random;
+	x ^= x << 13;
+	x ^= x >> 7;
+	x ^= x << 17;
+	bench->random = x;
+	return x;
+}
+
+/*
+		System allocator with lua_Alloc interface
+		Params: user data (unused), pointer to memory, old size, new size
+		Return: pointer to memory (0 - memory is freed or allocation failed)
+*/
+static void* system_frealloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	(void)ud;
+	(void)osize;
+	if (nsize == 0)
+	{
+		free(ptr);
+		return NULL;
+	}
+	return realloc(ptr, nsize);
+}
+
+/*
+		Allocator of workloads. It forwards call to allocator under benchmark and times it in timed run
+		Params: bench, pointer to memory, old size, new size
+		Return: pointer to memory (0 - memory is freed or allocation failed)
+*/
+static void* bench_frealloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	Bench* bench = (Bench*)ud;
+	void* mem;
+	if (bench->timed)
+	{
+		const uint64_t start = now_ns();
+		mem = bench->frealloc(bench->ud, ptr, osize, nsize);
+		bench->latencies[bench->latency_count++ % LATENCY_SAMPLES] = now_ns() - start;
+	}
+	else
+	{
+		mem = bench->frealloc(bench->ud, ptr, osize, nsize);
+	}
+	++bench->calls;
+	/*	Lua passes type of new object as old size	*/
+	const size_t old_size = ptr != NULL ? osize : 0;
+	if (nsize == 0 || mem != NULL)
+		bench->live_bytes += nsize - old_size;
+	if (bench->live_bytes > bench->peak_bytes)
+		bench->peak_bytes = bench->live_bytes;
+	return mem;
+}
+
+/*
+		Takes footprint and fragmentation of ldv heap. Checkpoints are taken, when workloads hold most memory
+		Params: bench
+		Return: none
+*/
+static void bench_checkpoint(Bench* bench)
+{
+	if (bench->ud == NULL)
+		return;
+	ldv_fragmentation report;
+	ldv_get_fragmentation((const ldv_heap*)bench->ud, &report);
+	const size_t footprint = report.gem_bytes + report.free_bytes;
+	const double fragmentation = report.free_bytes != 0 ? 1.0 - (double)report.largest_free / (double)report.free_bytes : 0.0;
+	if (footprint > bench->footprint)
+		bench->footprint = footprint;
+	if (fragmentation > bench->fragmentation)
+		bench->fragmentation = fragmentation;
+}
+
+/*
+		Gets size of small object (uniform in [8, 128])
+		Params: bench
+		Return: size in bytes
+*/
+static size_t small_size(Bench* bench)
+{
+	return 8 + (size_t)(next_random(bench) % 121);
+}
+
+/*
+		Gets size of object of mixed sizes (log-uniform in [8, 16384])
+		Params: bench
+		Return: size in bytes
+*/
+static size_t mixed_size(Bench* bench)
+{
+	const uint64_t r = next_random(bench);
+	const unsigned int shift = 3 + (unsigned int)(r % 11);
+	return ((size_t)1 << shift) + (size_t)((r >> 8) % ((size_t)1 << shift));
+}
+
+/*
+		Gets size of object, which follows sizes of lua objects (mostly small strings, tables and closures)
+		Params: bench
+		Return: size in bytes
+*/
+static size_t lua_size(Bench* bench)
+{
+	const uint64_t r = next_random(bench);
+	const unsigned int bucket = (unsigned int)(r % 100);
+	if (bucket < 60)
+		return 16 + (size_t)((r >> 8) % 49);
+	if (bucket < 90)
+		return 64 + (size_t)((r >> 8) % 193);
+	return 256 + (size_t)((r >> 8) % 3841);
+}
+
+/*
+		Allocates and frees objects of random slots of live set
+		Params: bench, size distribution
+		Return: none
+*/
+static void run_churn(Bench* bench, size_t (*size_of)(Bench*))
+{
+	void* objects[LIVE_OBJECTS] = { 0 };
+	size_t sizes[LIVE_OBJECTS] = { 0 };
+	const size_t ops = CHURN_OPS * bench->scale;
+	for (size_t i = 0; i < ops; ++i)
+	{
+		if (i == ops / 2)
+			bench_checkpoint(bench);
+		const size_t slot = (size_t)(next_random(bench) % LIVE_OBJECTS);
+		if (objects[slot] != NULL)
+		{
+			bench_frealloc(bench, objects[slot], sizes[slot], 0);
+			objects[slot] = NULL;
+			continue;
+		}
+		sizes[slot] = size_of(bench);
+		objects[slot] = bench_frealloc(bench, NULL, 0, sizes[slot]);
+		if (objects[slot] != NULL)
+			*(char*)objects[slot] = (char)slot;
+	}
+	for (size_t slot = 0; slot < LIVE_OBJECTS; ++slot)
+	{
+		if (objects[slot] != NULL)
+			bench_frealloc(bench, objects[slot], sizes[slot], 0);
+	}
+}
+
+/*
+		Allocates rounds of objects and frees each round in specific order
+		Params: bench, order of frees (0 - LIFO, 1 - FIFO, 2 - random)
+		Return: none
+*/
+static void run_order(Bench* bench, int order)
+{
+	void* objects[LIVE_OBJECTS];
+	size_t sizes[LIVE_OBJECTS];
+	size_t order_slots[LIVE_OBJECTS];
+	const size_t rounds = ORDER_ROUNDS * bench->scale;
+	for (size_t round = 0; round < rounds; ++round)
+	{
+		for (size_t i = 0; i < LIVE_OBJECTS; ++i)
+		{
+			sizes[i] = lua_size(bench);
+			objects[i] = bench_frealloc(bench, NULL, 0, sizes[i]);
+			if (objects[i] != NULL)
+				*(char*)objects[i] = (char)i;
+			order_slots[i] = order == 0 ? LIVE_OBJECTS - 1 - i : i;
+		}
+		if (round == 0)
+			bench_checkpoint(bench);
+		if (order == 2)
+		{
+			for (size_t i = LIVE_OBJECTS - 1; i > 0; --i)
+			{
+				const size_t j = (size_t)(next_random(bench) % (i + 1));
+				const size_t slot = order_slots[i];
+				order_slots[i] = order_slots[j];
+				order_slots[j] = slot;
+			}
+		}
+		for (size_t i = 0; i < LIVE_OBJECTS; ++i)
+		{
+			const size_t slot = order_slots[i];
+			if (objects[slot] != NULL)
+				bench_frealloc(bench, objects[slot], sizes[slot], 0);
+		}
+	}
+}
+
+/*
+		Grows interleaved objects by 1.5 factor till maximal size, then frees them (growth of buffers and arrays)
+		Params: bench
+		Return: none
+*/
+static void run_realloc_chain(Bench* bench)
+{
+	void* objects[CHAIN_COUNT] = { 0 };
+	size_t sizes[CHAIN_COUNT] = { 0 };
+	const size_t rounds = ORDER_ROUNDS * bench->scale;
+	for (size_t round = 0; round < rounds; ++round)
+	{
+		int growing = 1;
+		for (size_t i = 0; i < CHAIN_COUNT; ++i)
+			sizes[i] = 0;
+		while (growing)
+		{
+			growing = 0;
+			for (size_t i = 0; i < CHAIN_COUNT; ++i)
+			{
+				/*	Chains start with different sizes, so they do not grow in lockstep	*/
+				const size_t nsize = sizes[i] == 0 ? 16 + i * 8 : sizes[i] + sizes[i] / 2;
+				if (nsize > CHAIN_MAX_SIZE)
+					continue;
+				void* mem = bench_frealloc(bench, objects[i], sizes[i], nsize);
+				if (mem == NULL)
+					continue;
+				((char*)mem)[nsize - 1] = (char)i;
+				objects[i] = mem;
+				sizes[i] = nsize;
+				growing = 1;
+			}
+		}
+		if (round == 0)
+			bench_checkpoint(bench);
+		for (size_t i = 0; i < CHAIN_COUNT; ++i)
+		{
+			if (objects[i] != NULL)
+				bench_frealloc(bench, objects[i], sizes[i], 0);
+			objects[i] = NULL;
+		}
+	}
+}
+
+static void run_small_random(Bench* bench) { run_churn(bench, small_size); }
+static void run_mixed_random(Bench* bench) { run_churn(bench, mixed_size); }
+static void run_lua_random(Bench* bench) { run_churn(bench, lua_size); }
+static void run_lifo(Bench* bench) { run_order(bench, 0); }
+static void run_fifo(Bench* bench) { run_order(bench, 1); }
+static void run_random_order(Bench* bench) { run_order(bench, 2); }
+
+/*
+		Takes heap checkpoint from lua script
+		Params: none
+		Return: none
+*/
+static int script_checkpoint(lua_State* L)
+{
+	void* ud = NULL;
+	lua_getallocf(L, &ud);
+	bench_checkpoint((Bench*)ud);
+	return 0;
+}
+
+/*
+		Runs lua script in new lua state, which allocates through bench
+		Params: bench, script
+		Return: none
+*/
+static void run_script(Bench* bench, const char* script)
+{
+	lua_State* L = lua_newstate(bench_frealloc, bench);
+	if (L == NULL)
+	{
+		fprintf(stderr, "can not create lua state\n");
+		return;
+	}
+	luaL_openlibs(L);
+	lua_pushinteger(L, (lua_Integer)bench->scale);
+	lua_setglobal(L, "SCALE");
+	lua_register(L, "checkpoint", script_checkpoint);
+	if (luaL_dostring(L, script) != LUA_OK)
+		fprintf(stderr, "script error: %s\n", lua_tostring(L, -1));
+	lua_close(L);
+}
+
+//		Workloads
+static const Workload workloads[] =
+{
+	{ "small-random", run_small_random, NULL },
+	{ "mixed-random", run_mixed_random, NULL },
+	{ "lua-random", run_lua_random, NULL },
+	{ "lifo", run_lifo, NULL },
+	{ "fifo", run_fifo, NULL },
+	{ "random-order", run_random_order, NULL },
+	{ "realloc-chain", run_realloc_chain, NULL },
+	{ "table-heavy", NULL,
+		"local rows = {}\n"
+		"for i = 1, 200000 * SCALE do\n"
+		"	rows[i % 20000 + 1] = { id = i, name = 'row', x = i * 0.5, [1] = i, [2] = i + 1 }\n"
+		"	if i == 100000 then checkpoint() end\n"
+		"end\n"
+		"for j = 1, 20 * SCALE do\n"
+		"	local array, hash = {}, {}\n"
+		"	for i = 1, 20000 do array[i] = i; hash[i * 7] = i end\n"
+		"end\n" },
+	{ "string-heavy", NULL,
+		"local parts, cache = {}, {}\n"
+		"for i = 1, 200000 * SCALE do\n"
+		"	local s = 'key' .. i .. ':' .. string.rep('x', i % 64)\n"
+		"	cache[i % 5000 + 1] = s:upper()\n"
+		"	parts[#parts + 1] = s\n"
+		"	if #parts == 1000 then\n"
+		"		cache[0] = table.concat(parts, ',')\n"
+		"		parts = {}\n"
+		"	end\n"
+		"	if i == 100000 then checkpoint() end\n"
+		"end\n"
+		"for i = 1, 2000 * SCALE do\n"
+		"	local text = string.rep('lorem ipsum ', 100)\n"
+		"	text = text:gsub('ipsum', tostring(i))\n"
+		"end\n" },
+	{ "closure-heavy", NULL,
+		"local handlers = {}\n"
+		"local function counter(start)\n"
+		"	local n = start\n"
+		"	return function(step) n = n + step; return n end\n"
+		"end\n"
+		"for i = 1, 200000 * SCALE do\n"
+		"	local c = counter(i)\n"
+		"	handlers[i % 10000 + 1] = function() return c(1) end\n"
+		"	if i == 100000 then checkpoint() end\n"
+		"end\n"
+		"for i = 1, 20000 * SCALE do\n"
+		"	local co = coroutine.wrap(function(a) local b = coroutine.yield(a + 1); return b * 2 end)\n"
+		"	co(i)\n"
+		"	co(i)\n"
+		"end\n" }
+};
+
+//		Allocators
+static const Allocator allocators[] =
+{
+	{ "system", 0, LDV_POISON_OFF },
+	{ "ldv", 1, LDV_POISON_OFF },
+	{ "ldv-poison", 1, LDV_POISON_FULL }
+};
+
+/*
+		Compares latencies for sorting
+		Params: latencies
+		Return: comparison result
+*/
+static int latency_compare(const void* a, const void* b)
+{
+	const uint64_t x = *(const uint64_t*)a;
+	const uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/*
+		Runs workload once on allocator
+		Params: bench (counters are reset), workload, allocator, flag, whether calls are timed
+		Return: duration of run in nanoseconds (0 - heap is not created)
+*/
+static uint64_t run_once(Bench* bench, const Workload* workload, const Allocator* allocator, int timed)
+{
+	ldv_heap* heap = NULL;
+	if (allocator->ldv)
+	{
+		heap = ldv_heap_create(HEAP_SIZE, 0);
+		if (heap == NULL)
+			return 0;
+		ldv_set_poison(heap, allocator->poison);
+	}
+	bench->frealloc = heap != NULL ? ldv_frealloc : system_frealloc;
+	bench->ud = heap;
+	bench->timed = timed;
+	bench->calls = 0;
+	bench->live_bytes = 0;
+	bench->peak_bytes = 0;
+	bench->latency_count = 0;
+	bench->footprint = 0;
+	bench->fragmentation = 0.0;
+	/*	Both allocators get same sequence of calls	*/
+	bench->random = 0x9E3779B97F4A7C15ull;
+	const uint64_t start = now_ns();
+	if (workload->run != NULL)
+		workload->run(bench);
+	else
+		run_script(bench, workload->script);
+	const uint64_t duration = now_ns() - start;
+	if (heap != NULL)
+	{
+		bench_checkpoint(bench);
+		ldv_heap_destroy(heap);
+	}
+	return duration != 0 ? duration : 1;
+}
+
+/*
+		Runs workload on allocator and prints results
+		Params: bench, workload, allocator
+		Return: none
+*/
+static void run_workload(Bench* bench, const Workload* workload, const Allocator* allocator)
+{
+	const uint64_t duration = run_once(bench, workload, allocator, 0);
+	if (duration == 0)
+	{
+		fprintf(stderr, "can not create ldv heap\n");
+		return;
+	}
+	const size_t calls = bench->calls;
+	const size_t peak_bytes = bench->peak_bytes;
+	if (run_once(bench, workload, allocator, 1) == 0)
+		return;
+	const size_t sample_count = bench->latency_count < LATENCY_SAMPLES ? bench->latency_count : LATENCY_SAMPLES;
+	qsort(bench->latencies, sample_count, sizeof(uint64_t), latency_compare);
+	const uint64_t p50 = sample_count != 0 ? bench->latencies[sample_count / 2] : 0;
+	const uint64_t p99 = sample_count != 0 ? bench->latencies[sample_count * 99 / 100] : 0;
+	char footprint[32] = "-";
+	char fragmentation[32] = "-";
+	if (allocator->ldv)
+	{
+		snprintf(footprint, sizeof(footprint), "%zu", bench->footprint / 1024);
+		snprintf(fragmentation, sizeof(fragmentation), "%.1f", bench->fragmentation * 100.0);
+	}
+	printf("%-14s %-11s %10zu %12.0f %8llu %8llu %10zu %13s %8s\n", workload->name, allocator->name, calls,
+		(double)calls * 1e9 / (double)duration, (unsigned long long)p50, (unsigned long long)p99, peak_bytes / 1024, footprint, fragmentation);
+}
+
+int main(int argc, char** argv)
+{
+	Bench bench;
+	memset(&bench, 0, sizeof(bench));
+	bench.scale = 1;
+	int arg = 1;
+	if (argc > 2 && strcmp(argv[1], "-s") == 0)
+	{
+		bench.scale = (size_t)strtoul(argv[2], NULL, 10);
+		arg = 3;
+	}
+	if (bench.scale == 0)
+	{
+		fprintf(stderr, "usage: %s [-s scale] [workload...]\n", argv[0]);
+		return 2;
+	}
+	bench.latencies = (uint64_t*)malloc(LATENCY_SAMPLES * sizeof(uint64_t));
+	if (bench.latencies == NULL)
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	const size_t workload_count = sizeof(workloads) / sizeof(workloads[0]);
+	const size_t allocator_count = sizeof(allocators) / sizeof(allocators[0]);
+	printf("%-14s %-11s %10s %12s %8s %8s %10s %13s %8s\n", "workload", "allocator", "calls", "ops/sec", "p50 ns", "p99 ns", "peak KB", "footprint KB", "frag %");
+	for (size_t i = 0; i < workload_count; ++i)
+	{
+		int selected = arg == argc;
+		for (int j = arg; j < argc && !selected; ++j)
+			selected = strcmp(argv[j], workloads[i].name) == 0;
+		if (!selected)
+			continue;
+		for (size_t j = 0; j < allocator_count; ++j)
+			run_workload(&bench, &workloads[i], &allocators[j]);
+	}
+	free(bench.latencies);
 	return 0;
 }
@@ -0,0 +1,467 @@
+/*
+			Offline diff of two ldv heap snapshots (written by ldv_snapshot / ldv.snapshot).
+			Reports new, freed and grown objects by type and retention paths of the largest new objects.
+
+			Build: cc -O2 -I.. ldvdiff.c -o ldvdiff
+			Usage: ldvdiff [-n count] old.snap new.snap
+*/
+
+//	Standard includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#ifndef _WIN32
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+//	Includes
+#include "ldvsnapshot.h"
+
+//	Types
+//		Default count of new objects with retention paths
+#define PATH_COUNT 10
+//		Maximal length of retention path in references
+#define MAX_PATH_LENGTH 256
+
+/*
+		Loaded snapshot. Records point into memory of snapshot file
+*/
+typedef struct Snapshot
+{
+	/*	Memory of snapshot file	*/
+	unsigned char* data;
+	/*	Size of snapshot file	*/
+	size_t size;
+	/*	Flag, whether memory is mapped	*/
+	int mapped;
+	/*	Header of snapshot	*/
+	const ldv_snapshot_header* header;
+	/*	Blocks of heap	*/
+	const ldv_snapshot_block* blocks;
+	/*	Gc objects	*/
+	const ldv_snapshot_object* objects;
+	/*	References between objects	*/
+	const ldv_snapshot_edge* edges;
+	/*	Names of objects	*/
+	const char* names;
+	/*	Indices of objects sorted by address	*/
+	uint32_t* by_address;
+} Snapshot;
+
+/*
+		Changes of objects of one type
+*/
+typedef struct TypeDiff
+{
+	/*	Count of new objects	*/
+	size_t new_count;
+	/*	Size of new objects	*/
+	uint64_t new_bytes;
+	/*	Count of freed objects	*/
+	size_t freed_count;
+	/*	Size of freed objects	*/
+	uint64_t freed_bytes;
+	/*	Count of grown objects	*/
+	size_t grown_count;
+	/*	Growth of grown objects	*/
+	uint64_t grown_bytes;
+} TypeDiff;
+
+//		Names of object types
+static const char* const type_names[LDV_SNAPSHOT_TYPE_COUNT] = { "string", "table", "lua closure", "c closure", "userdata", "thread", "proto" };
+//		Snapshot, which objects are sorted by address (qsort has no user data)
+static const Snapshot* sorted_snapshot;
+
+/*
+		Compares objects by address
+		Params: indices of objects
+		Return: comparison result
+*/
+static int address_compare(const void* left, const void* right)
+{
+	const uint64_t left_address = sorted_snapshot->objects[*(const uint32_t*)left].address;
+	const uint64_t right_address = sorted_snapshot->objects[*(const uint32_t*)right].address;
+	return left_address < right_address ? -1 : left_address > right_address ? 1 : 0;
+}
+
+/*
+		Releases memory of snapshot
+		Params: snapshot
+		Return: none
+*/
+static void unload_snapshot(Snapshot* snapshot)
+{
+#ifndef _WIN32
+	if (snapshot->mapped)
+		munmap(snapshot->data, snapshot->size);
+	else
+#endif
+		free(snapshot->data);
+	free(snapshot->by_address);
+	memset(snapshot, 0, sizeof(Snapshot));
+}
+
+/*
+		Loads snapshot file. File is mapped to memory, where it is supported, otherwise it is read
+		Params: path of snapshot, snapshot (out)
+		Return: error code (0 - success)
+*/
+static int load_snapshot(const char* path, Snapshot* snapshot)
+{
+	memset(snapshot, 0, sizeof(Snapshot));
+#ifndef _WIN32
+	const int fd = open(path, O_RDONLY);
+	struct stat file_stat;
+	if (fd >= 0 && fstat(fd, &file_stat) == 0 && file_stat.st_size > 0)
+	{
+		void* data = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data != MAP_FAILED)
+		{
+			snapshot->data = (unsigned char*)data;
+			snapshot->size = (size_t)file_stat.st_size;
+			snapshot->mapped = 1;
+		}
+	}
+	if (fd >= 0)
+		close(fd);
+#endif
+	if (snapshot->data == NULL)
+	{
+		FILE* file = fopen(path, "rb");
+		long size = -1;
+		if (file != NULL && fseek(file, 0, SEEK_END) == 0 && (size = ftell(file)) > 0 && fseek(file, 0, SEEK_SET) == 0)
+		{
+			snapshot->data = (unsigned char*)malloc((size_t)size);
+			snapshot->size = (size_t)size;
+			if (snapshot->data != NULL && fread(snapshot->data, 1, snapshot->size, file) != snapshot->size)
+			{
+				free(snapshot->data);
+				snapshot->data = NULL;
+			}
+		}
+		if (file != NULL)
+			fclose(file);
+	}
+	if (snapshot->data == NULL)
+	{
+		fprintf(stderr, "%s: cannot read snapshot\n", path);
+		return 1;
+	}
+	const ldv_snapshot_header* header = (const ldv_snapshot_header*)snapshot->data;
+	if (snapshot->size < sizeof(ldv_snapshot_header) || memcmp(header->magic, LDV_SNAPSHOT_MAGIC, sizeof(LDV_SNAPSHOT_MAGIC)) != 0
+		|| header->version != LDV_SNAPSHOT_VERSION || header->byte_order != LDV_SNAPSHOT_BYTE_ORDER)
+	{
+		fprintf(stderr, "%s: not a snapshot of this version and byte order\n", path);
+		unload_snapshot(snapshot);
+		return 1;
+	}
+	const uint64_t expected_size = sizeof(ldv_snapshot_header) + header->block_count * sizeof(ldv_snapshot_block)
+		+ header->object_count * sizeof(ldv_snapshot_object) + header->edge_count * sizeof(ldv_snapshot_edge) + header->name_bytes;
+	if (expected_size != snapshot->size || header->name_bytes == 0 || header->object_count >= LDV_SNAPSHOT_NO_OBJECT)
+	{
+		fprintf(stderr, "%s: truncated snapshot\n", path);
+		unload_snapshot(snapshot);
+		return 1;
+	}
+	snapshot->header = header;
+	snapshot->blocks = (const ldv_snapshot_block*)(header + 1);
+	snapshot->objects = (const ldv_snapshot_object*)(snapshot->blocks + header->block_count);
+	snapshot->edges = (const ldv_snapshot_edge*)(snapshot->objects + header->object_count);
+	snapshot->names = (const char*)(snapshot->edges + header->edge_count);
+	for (uint64_t i = 0; i < header->object_count; ++i)
+	{
+		if (snapshot->objects[i].type >= LDV_SNAPSHOT_TYPE_COUNT || snapshot->objects[i].name >= header->name_bytes)
+		{
+			fprintf(stderr, "%s: corrupted object %llu\n", path, (unsigned long long)i);
+			unload_snapshot(snapshot);
+			return 1;
+		}
+	}
+	for (uint64_t i = 0; i < header->edge_count; ++i)
+	{
+		const ldv_snapshot_edge* edge = &snapshot->edges[i];
+		if (edge->from >= header->object_count || edge->to >= header->object_count || (edge->key != LDV_SNAPSHOT_NO_OBJECT && edge->key >= header->object_count))
+		{
+			fprintf(stderr, "%s: corrupted reference %llu\n", path, (unsigned long long)i);
+			unload_snapshot(snapshot);
+			return 1;
+		}
+	}
+	if (snapshot->names[header->name_bytes - 1] != '\0')
+	{
+		fprintf(stderr, "%s: corrupted names\n", path);
+		unload_snapshot(snapshot);
+		return 1;
+	}
+	snapshot->by_address = (uint32_t*)malloc((size_t)(header->object_count + 1) * sizeof(uint32_t));
+	if (snapshot->by_address == NULL)
+	{
+		unload_snapshot(snapshot);
+		return 1;
+	}
+	for (uint32_t i = 0; i < header->object_count; ++i)
+		snapshot->by_address[i] = i;
+	sorted_snapshot = snapshot;
+	qsort(snapshot->by_address, (size_t)header->object_count, sizeof(uint32_t), address_compare);
+	return 0;
+}
+
+/*
+		Finds object of snapshot by address
+		Params: snapshot, address
+		Return: index of object (LDV_SNAPSHOT_NO_OBJECT - not found)
+*/
+static uint32_t find_object(const Snapshot* snapshot, const uint64_t address)
+{
+	size_t low = 0;
+	size_t high = (size_t)snapshot->header->object_count;
+	while (low < high)
+	{
+		const size_t middle = (low + high) / 2;
+		const uint64_t middle_address = snapshot->objects[snapshot->by_address[middle]].address;
+		if (address < middle_address)
+			high = middle;
+		else if (address > middle_address)
+			low = middle + 1;
+		else
+			return snapshot->by_address[middle];
+	}
+	return LDV_SNAPSHOT_NO_OBJECT;
+}
+
+/*
+		Finds object of other snapshot, which is the same object (same address and type)
+		Params: snapshot of object, object index, other snapshot
+		Return: index of object in other snapshot (LDV_SNAPSHOT_NO_OBJECT - not found)
+*/
+static uint32_t match_object(const Snapshot* snapshot, const uint32_t index, const Snapshot* other)
+{
+	const ldv_snapshot_object* object = &snapshot->objects[index];
+	const uint32_t other_index = find_object(other, object->address);
+	return other_index != LDV_SNAPSHOT_NO_OBJECT && other->objects[other_index].type == object->type ? other_index : LDV_SNAPSHOT_NO_OBJECT;
+}
+
+/*
+		Finds shortest retention paths from roots (breadth first search)
+		Params: snapshot, parent references (out, LDV_SNAPSHOT_NO_OBJECT - root or unreachable object)
+		Return: error code (0 - success)
+*/
+static int find_parents(const Snapshot* snapshot, uint32_t* parents)
+{
+	const size_t object_count = (size_t)snapshot->header->object_count;
+	const size_t edge_count = (size_t)snapshot->header->edge_count;
+	/*	References are grouped by source object, so first reference of each object is found by counting	*/
+	uint32_t* first_edge = (uint32_t*)calloc(object_count + 1, sizeof(uint32_t));
+	uint32_t* queue = (uint32_t*)malloc((object_count + 1) * sizeof(uint32_t));
+	unsigned char* reached = (unsigned char*)calloc(object_count + 1, 1);
+	if (first_edge == NULL || queue == NULL || reached == NULL)
+	{
+		free(first_edge);
+		free(queue);
+		free(reached);
+		return 1;
+	}
+	for (size_t i = 0; i < edge_count; ++i)
+		++first_edge[snapshot->edges[i].from + 1];
+	for (size_t i = 0; i < object_count; ++i)
+		first_edge[i + 1] += first_edge[i];
+	size_t head = 0;
+	size_t tail = 0;
+	for (uint32_t i = 0; i < object_count; ++i)
+	{
+		parents[i] = LDV_SNAPSHOT_NO_OBJECT;
+		if (snapshot->objects[i].flags & LDV_SNAPSHOT_ROOT)
+		{
+			reached[i] = 1;
+			queue[tail++] = i;
+		}
+	}
+	while (head < tail)
+	{
+		const uint32_t object = queue[head++];
+		for (uint32_t edge = first_edge[object]; edge < first_edge[object + 1]; ++edge)
+		{
+			/*	Edges of object are expected to be adjacent, other order gives no paths	*/
+			const uint32_t child = snapshot->edges[edge].to;
+			if (snapshot->edges[edge].from != object || reached[child])
+				continue;
+			reached[child] = 1;
+			parents[child] = edge;
+			queue[tail++] = child;
+		}
+	}
+	free(first_edge);
+	free(queue);
+	free(reached);
+	return 0;
+}
+
+/*
+		Prints reference as step of retention path
+		Params: snapshot, reference
+		Return: none
+*/
+static void print_edge(const Snapshot* snapshot, const ldv_snapshot_edge* edge)
+{
+	const ldv_snapshot_object* from = &snapshot->objects[edge->from];
+	switch (edge->kind)
+	{
+		case LDV_SNAPSHOT_ARRAY_ITEM:
+			printf("[%lld]", (long long)edge->index + 1);
+			break;
+		case LDV_SNAPSHOT_NODE_VALUE:
+			if (edge->key != LDV_SNAPSHOT_NO_OBJECT && snapshot->objects[edge->key].type == LDV_SNAPSHOT_STRING)
+				printf(".%s", snapshot->names + snapshot->objects[edge->key].name);
+			else if (edge->key == LDV_SNAPSHOT_NO_OBJECT)
+				printf("[%lld]", (long long)edge->index);
+			else
+				printf("[<%s>]", type_names[snapshot->objects[edge->key].type]);
+			break;
+		case LDV_SNAPSHOT_NODE_KEY:			printf(".<key>");										break;
+		case LDV_SNAPSHOT_METATABLE:		printf(".<metatable>");									break;
+		case LDV_SNAPSHOT_UPVALUE:			printf(".<upvalue %lld of %s>", (long long)edge->index + 1, snapshot->names + from->name);	break;
+		case LDV_SNAPSHOT_PROTO_REF:		printf(".<proto>");										break;
+		case LDV_SNAPSHOT_UPVALUE_NAME:		printf(".<upvalue name %lld>", (long long)edge->index + 1);	break;
+		case LDV_SNAPSHOT_CONSTANT:			printf(".<constant %lld>", (long long)edge->index + 1);	break;
+		case LDV_SNAPSHOT_CHILD_PROTO:		printf(".<proto %lld>", (long long)edge->index + 1);	break;
+		case LDV_SNAPSHOT_USER_VALUE:		printf(".<uservalue>");									break;
+		case LDV_SNAPSHOT_STACK_SLOT:		printf(".<stack %lld>", (long long)edge->index);		break;
+		default:							printf(".<?>");											break;
+	}
+}
+
+/*
+		Prints retention path of object: root and references from root to object
+		Params: snapshot, parent references, object index
+		Return: none
+*/
+static void print_path(const Snapshot* snapshot, const uint32_t* parents, const uint32_t index)
+{
+	uint32_t path[MAX_PATH_LENGTH];
+	size_t length = 0;
+	uint32_t object = index;
+	while (parents[object] != LDV_SNAPSHOT_NO_OBJECT && length < MAX_PATH_LENGTH)
+	{
+		path[length++] = parents[object];
+		object = snapshot->edges[parents[object]].from;
+	}
+	/*	References near object are kept, walk of long path goes on to its root, so root is labeled by real root	*/
+	const int truncated = parents[object] != LDV_SNAPSHOT_NO_OBJECT;
+	while (parents[object] != LDV_SNAPSHOT_NO_OBJECT)
+		object = snapshot->edges[parents[object]].from;
+	const ldv_snapshot_object* root = &snapshot->objects[object];
+	if (!(root->flags & LDV_SNAPSHOT_ROOT))
+		printf("  <unreachable>");
+	else if (root->flags & LDV_SNAPSHOT_REGISTRY)
+		printf("  registry");
+	else if (root->type == LDV_SNAPSHOT_THREAD)
+		printf("  main thread");
+	else
+		printf("  <root %s>", type_names[root->type]);
+	if (truncated)
+		printf("...");
+	while (length-- > 0)
+		print_edge(snapshot, &snapshot->edges[path[length]]);
+	printf("\n");
+}
+
+/*
+		Compares objects by size (descending order)
+		Params: indices of objects
+		Return: comparison result
+*/
+static int size_compare(const void* left, const void* right)
+{
+	const uint64_t left_size = sorted_snapshot->objects[*(const uint32_t*)left].size;
+	const uint64_t right_size = sorted_snapshot->objects[*(const uint32_t*)right].size;
+	return left_size < right_size ? 1 : left_size > right_size ? -1 : 0;
+}
+
+int main(int argc, char** argv)
+{
+	size_t path_count = PATH_COUNT;
+	int arg = 1;
+	if (argc > 2 && strcmp(argv[1], "-n") == 0)
+	{
+		path_count = (size_t)strtoul(argv[2], NULL, 10);
+		arg = 3;
+	}
+	if (argc - arg != 2)
+	{
+		fprintf(stderr, "usage: %s [-n count] old.snap new.snap\n", argv[0]);
+		return 2;
+	}
+	Snapshot old_snapshot, new_snapshot;
+	if (load_snapshot(argv[arg], &old_snapshot) != 0)
+		return 1;
+	if (load_snapshot(argv[arg + 1], &new_snapshot) != 0)
+	{
+		unload_snapshot(&old_snapshot);
+		return 1;
+	}
+	TypeDiff diffs[LDV_SNAPSHOT_TYPE_COUNT];
+	memset(diffs, 0, sizeof(diffs));
+	const uint32_t new_object_count = (uint32_t)new_snapshot.header->object_count;
+	uint32_t* new_objects = (uint32_t*)malloc(((size_t)new_object_count + 1) * sizeof(uint32_t));
+	uint32_t* parents = (uint32_t*)malloc(((size_t)new_object_count + 1) * sizeof(uint32_t));
+	if (new_objects == NULL || parents == NULL || find_parents(&new_snapshot, parents) != 0)
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	size_t new_count = 0;
+	for (uint32_t i = 0; i < new_object_count; ++i)
+	{
+		const ldv_snapshot_object* object = &new_snapshot.objects[i];
+		const uint32_t old_index = match_object(&new_snapshot, i, &old_snapshot);
+		TypeDiff* diff = &diffs[object->type];
+		if (old_index == LDV_SNAPSHOT_NO_OBJECT)
+		{
+			++diff->new_count;
+			diff->new_bytes += object->size;
+			new_objects[new_count++] = i;
+		}
+		else if (object->size > old_snapshot.objects[old_index].size)
+		{
+			++diff->grown_count;
+			diff->grown_bytes += object->size - old_snapshot.objects[old_index].size;
+		}
+	}
+	for (uint32_t i = 0; i < old_snapshot.header->object_count; ++i)
+	{
+		if (match_object(&old_snapshot, i, &new_snapshot) != LDV_SNAPSHOT_NO_OBJECT)
+			continue;
+		++diffs[old_snapshot.objects[i].type].freed_count;
+		diffs[old_snapshot.objects[i].type].freed_bytes += old_snapshot.objects[i].size;
+	}
+	printf("live bytes: %llu -> %llu\n", (unsigned long long)old_snapshot.header->live_bytes, (unsigned long long)new_snapshot.header->live_bytes);
+	printf("objects:    %llu -> %llu\n\n", (unsigned long long)old_snapshot.header->object_count, (unsigned long long)new_snapshot.header->object_count);
+	printf("%-12s %10s %12s %10s %12s %10s %12s\n", "type", "new", "new bytes", "freed", "freed bytes", "grown", "grown bytes");
+	for (int type = 0; type < LDV_SNAPSHOT_TYPE_COUNT; ++type)
+	{
+		const TypeDiff* diff = &diffs[type];
+		printf("%-12s %10zu %12llu %10zu %12llu %10zu %12llu\n", type_names[type], diff->new_count, (unsigned long long)diff->new_bytes,
+			diff->freed_count, (unsigned long long)diff->freed_bytes, diff->grown_count, (unsigned long long)diff->grown_bytes);
+	}
+	sorted_snapshot = &new_snapshot;
+	qsort(new_objects, new_count, sizeof(uint32_t), size_compare);
+	if (new_count != 0 && path_count != 0)
+		printf("\nlargest new objects:\n");
+	for (size_t i = 0; i < new_count && i < path_count; ++i)
+	{
+		const ldv_snapshot_object* object = &new_snapshot.objects[new_objects[i]];
+		printf("%s 0x%llx, %llu bytes %s\n", type_names[object->type], (unsigned long long)object->address, (unsigned long long)object->size,
+			new_snapshot.names + object->name);
+		print_path(&new_snapshot, parents, new_objects[i]);
+	}
+	free(new_objects);
+	free(parents);
+	unload_snapshot(&old_snapshot);
+	unload_snapshot(&new_snapshot);
+	return 0;
+}
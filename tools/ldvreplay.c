@@ -0,0 +1,400 @@
+/*
+			Replay of ldv allocation trace (written by ldv_trace_start / ldv.traceStart) against ldv heap and system allocator.
+			Calls of trace are executed in recorded order, so each run sees same sequence of allocations.
+			Reports throughput of allocators, peak of live memory and fragmentation of ldv heap at the end of trace.
+
+			Build: cc -O2 -I.. -I<lua>/src ldvreplay.c ../ldevtools.c <lua>/src/liblua.a -lm -o ldvreplay
+			Usage: ldvreplay [-a allocator] [-r repeats] trace
+			Allocators: ldv, ldv-poison, system (all by default)
+*/
+
+//		POSIX clocks are declared in strict C modes too
+#if !defined(_WIN32) && !defined(_POSIX_C_SOURCE)
+	#define _POSIX_C_SOURCE 200112L
+#endif
+
+//	Standard includes
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef _WIN32
+	#include <windows.h>
+#endif
+
+//	Includes
+#include "lua.h"
+#include "ldevtools.h"
+#include "ldvtrace.h"
+
+//	Types
+//		Default count of runs of each allocator (the fastest run is reported)
+#define REPEAT_COUNT 3
+//		Size of the first region of ldv heaps in bytes
+#define HEAP_SIZE 0x100000
+
+/*
+		Decoded trace record
+*/
+typedef struct TraceOp
+{
+	/*	ldv_trace_op	*/
+	uint32_t op;
+	/*	Id of block	*/
+	uint32_t id;
+	/*	Old size (lua type of new object)	*/
+	size_t osize;
+	/*	New size	*/
+	size_t nsize;
+} TraceOp;
+
+/*
+		Loaded trace
+*/
+typedef struct Trace
+{
+	/*	Header of trace	*/
+	ldv_trace_header header;
+	/*	Records of trace	*/
+	TraceOp* ops;
+	/*	Count of records	*/
+	size_t count;
+	/*	Count of ids (maximal id + 1)	*/
+	size_t id_count;
+	/*	Duration of recording in nanoseconds	*/
+	uint64_t duration;
+} Trace;
+
+/*
+		Allocator of replay
+*/
+typedef struct Allocator
+{
+	/*	Name of allocator	*/
+	const char* name;
+	/*	Flag, whether allocator is ldv heap	*/
+	int ldv;
+	/*	Poisoning policy of ldv heap	*/
+	ldv_poison_mode poison;
+} Allocator;
+
+/*
+		Result of replay run
+*/
+typedef struct ReplayResult
+{
+	/*	Duration of replay in nanoseconds	*/
+	uint64_t duration;
+	/*	Count of failed allocations (later records of their blocks are skipped)	*/
+	size_t failed;
+	/*	Maximal size of live blocks	*/
+	size_t peak_bytes;
+	/*	Size of live blocks at the end of trace	*/
+	size_t live_bytes;
+	/*	Statistics of ldv heap at the end of trace	*/
+	ldv_stats stats;
+	/*	Size of ldv heap regions at the end of trace	*/
+	size_t footprint;
+} ReplayResult;
+
+//		Allocators
+static const Allocator allocators[] =
+{
+	{ "ldv", 1, LDV_POISON_OFF },
+	{ "ldv-poison", 1, LDV_POISON_FULL },
+	{ "system", 0, LDV_POISON_OFF }
+};
+
+/*
+		Gets monotonic time
+		Params: none
+		Return: time in nanoseconds
+*/
+static uint64_t now_ns(void)
+{
+#ifdef _WIN32
+	static LARGE_INTEGER frequency;
+	LARGE_INTEGER counter;
+	if (frequency.QuadPart == 0)
+		QueryPerformanceFrequency(&frequency);
+	QueryPerformanceCounter(&counter);
+	return (uint64_t)((double)counter.QuadPart * 1e9 / (double)frequency.QuadPart);
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+#endif
+}
+
+/*
+		System allocator with lua_Alloc interface
+		Params: user data (unused), pointer to memory, old size, new size
+		Return: pointer to memory (0 - memory is freed or allocation failed)
+*/
+static void* system_frealloc(void* ud, void* ptr, size_t osize, size_t nsize)
+{
+	(void)ud;
+	(void)osize;
+	if (nsize == 0)
+	{
+		free(ptr);
+		return NULL;
+	}
+	return realloc(ptr, nsize);
+}
+
+/*
+		Reads unsigned LEB128 number of record
+		Params: position in trace (advanced), end of trace, number (out)
+		Return: error code (0 - success, 1 - number is cut)
+*/
+static int read_number(const unsigned char** pos, const unsigned char* end, uint64_t* value)
+{
+	*value = 0;
+	for (unsigned int shift = 0; *pos < end && shift < 64; shift += 7)
+	{
+		const unsigned char byte = *(*pos)++;
+		*value |= (uint64_t)(byte & 0x7F) << shift;
+		if ((byte & 0x80) == 0)
+			return 0;
+	}
+	return 1;
+}
+
+/*
+		Loads and decodes trace file
+		Params: path of trace, trace (out)
+		Return: error code (0 - success)
+*/
+static int load_trace(const char* path, Trace* trace)
+{
+	memset(trace, 0, sizeof(Trace));
+	FILE* file = fopen(path, "rb");
+	if (file == NULL)
+	{
+		fprintf(stderr, "cannot open %s\n", path);
+		return 1;
+	}
+	size_t capacity = 0x10000;
+	size_t size = 0;
+	unsigned char* data = (unsigned char*)malloc(capacity);
+	while (data != NULL)
+	{
+		size += fread(data + size, 1, capacity - size, file);
+		if (size < capacity)
+			break;
+		unsigned char* grown = (unsigned char*)realloc(data, capacity * 2);
+		if (grown == NULL)
+			free(data);
+		data = grown;
+		capacity *= 2;
+	}
+	fclose(file);
+	if (data == NULL)
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	memcpy(&trace->header, data, size < sizeof(ldv_trace_header) ? size : sizeof(ldv_trace_header));
+	if (size < sizeof(ldv_trace_header) || memcmp(trace->header.magic, LDV_TRACE_MAGIC, sizeof(LDV_TRACE_MAGIC)) != 0 ||
+		trace->header.version != LDV_TRACE_VERSION || trace->header.byte_order != LDV_TRACE_BYTE_ORDER)
+	{
+		fprintf(stderr, "%s is not ldv trace of this version and byte order\n", path);
+		free(data);
+		return 1;
+	}
+	size_t op_capacity = trace->header.record_count != 0 ? (size_t)trace->header.record_count : 0x10000;
+	trace->ops = (TraceOp*)malloc(op_capacity * sizeof(TraceOp));
+	const unsigned char* pos = data + sizeof(ldv_trace_header);
+	const unsigned char* end = data + size;
+	int cut = 0;
+	while (pos < end && trace->ops != NULL)
+	{
+		if (trace->count == op_capacity)
+		{
+			op_capacity *= 2;
+			TraceOp* ops = (TraceOp*)realloc(trace->ops, op_capacity * sizeof(TraceOp));
+			if (ops == NULL)
+				free(trace->ops);
+			trace->ops = ops;
+			if (ops == NULL)
+				break;
+		}
+		TraceOp* op = &trace->ops[trace->count];
+		uint64_t id = 0, osize = 0, nsize = 0, delta = 0;
+		op->op = *pos++;
+		cut = op->op > LDV_TRACE_REALLOC || read_number(&pos, end, &id) != 0 || id > UINT32_MAX || read_number(&pos, end, &osize) != 0 ||
+			(op->op != LDV_TRACE_FREE && read_number(&pos, end, &nsize) != 0) || read_number(&pos, end, &delta) != 0;
+		if (cut)
+			break;
+		op->id = (uint32_t)id;
+		op->osize = (size_t)osize;
+		op->nsize = (size_t)nsize;
+		if (op->id >= trace->id_count)
+			trace->id_count = (size_t)op->id + 1;
+		trace->duration += delta;
+		++trace->count;
+	}
+	free(data);
+	if (trace->ops == NULL)
+	{
+		fprintf(stderr, "out of memory\n");
+		return 1;
+	}
+	/*	Trace of process, which did not stop recording, has no counters, it is replayed till the last complete record	*/
+	if (cut || (trace->header.record_count != 0 && trace->header.record_count != trace->count))
+		fprintf(stderr, "warning: trace is cut after %zu records\n", trace->count);
+	return 0;
+}
+
+/*
+		Replays trace once on allocator
+		Params: trace, allocator, result (out)
+		Return: error code (0 - success)
+*/
+static int replay(const Trace* trace, const Allocator* allocator, ReplayResult* result)
+{
+	memset(result, 0, sizeof(ReplayResult));
+	ldv_heap* heap = NULL;
+	if (allocator->ldv)
+	{
+		heap = ldv_heap_create(HEAP_SIZE, 0);
+		if (heap == NULL)
+			return 1;
+		ldv_set_poison(heap, allocator->poison);
+	}
+	const lua_Alloc frealloc = heap != NULL ? ldv_frealloc : system_frealloc;
+	void** blocks = (void**)calloc(trace->id_count + 1, sizeof(void*));
+	size_t* sizes = (size_t*)calloc(trace->id_count + 1, sizeof(size_t));
+	if (blocks == NULL || sizes == NULL)
+	{
+		free(blocks);
+		free(sizes);
+		if (heap != NULL)
+			ldv_heap_destroy(heap);
+		return 1;
+	}
+	size_t live_bytes = 0;
+	const uint64_t start = now_ns();
+	for (size_t i = 0; i < trace->count; ++i)
+	{
+		const TraceOp* op = &trace->ops[i];
+		void* ptr = blocks[op->id];
+		if (op->op == LDV_TRACE_MALLOC)
+		{
+			blocks[op->id] = frealloc(heap, NULL, op->osize, op->nsize);
+			if (blocks[op->id] == NULL)
+			{
+				++result->failed;
+				continue;
+			}
+			sizes[op->id] = op->nsize;
+			live_bytes += op->nsize;
+		}
+		else if (ptr == NULL)
+		{
+			/*	Block, which allocation failed	*/
+			continue;
+		}
+		else if (op->op == LDV_TRACE_FREE)
+		{
+			frealloc(heap, ptr, op->osize, 0);
+			blocks[op->id] = NULL;
+			live_bytes -= op->osize;
+		}
+		else
+		{
+			void* mem = frealloc(heap, ptr, op->osize, op->nsize);
+			if (mem == NULL)
+			{
+				++result->failed;
+				continue;
+			}
+			blocks[op->id] = mem;
+			sizes[op->id] = op->nsize;
+			live_bytes += op->nsize - op->osize;
+		}
+		if (live_bytes > result->peak_bytes)
+			result->peak_bytes = live_bytes;
+	}
+	result->duration = now_ns() - start;
+	result->live_bytes = live_bytes;
+	if (heap != NULL)
+	{
+		ldv_fragmentation report;
+		ldv_get_stats(heap, &result->stats);
+		ldv_get_fragmentation(heap, &report);
+		result->footprint = report.gem_bytes + report.free_bytes;
+	}
+	/*	Blocks, which live at the end of trace, are freed out of measured time	*/
+	for (size_t id = 0; id < trace->id_count; ++id)
+	{
+		if (blocks[id] != NULL)
+			frealloc(heap, blocks[id], sizes[id], 0);
+	}
+	free(blocks);
+	free(sizes);
+	if (heap != NULL)
+		ldv_heap_destroy(heap);
+	return 0;
+}
+
+int main(int argc, char** argv)
+{
+	const char* allocator_name = NULL;
+	unsigned long repeat_count = REPEAT_COUNT;
+	int arg = 1;
+	for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+	{
+		if (strcmp(argv[arg], "-a") == 0)
+			allocator_name = argv[arg + 1];
+		else if (strcmp(argv[arg], "-r") == 0)
+			repeat_count = strtoul(argv[arg + 1], NULL, 10);
+		else
+			break;
+	}
+	if (argc - arg != 1 || repeat_count == 0)
+	{
+		fprintf(stderr, "usage: %s [-a ldv|ldv-poison|system] [-r repeats] trace\n", argv[0]);
+		return 2;
+	}
+	Trace trace;
+	if (load_trace(argv[arg], &trace) != 0)
+		return 1;
+	printf("%zu records, %zu ids, recorded in %.1f ms, %llu bytes in %llu blocks were live before recording\n",
+		trace.count, trace.id_count, (double)trace.duration / 1e6, (unsigned long long)trace.header.live_bytes, (unsigned long long)trace.header.live_blocks);
+	printf("%-11s %10s %12s %8s %8s %12s %12s %12s %8s\n", "allocator", "time ms", "ops/sec", "failed", "peak KB", "end live KB", "footprint KB", "largest KB", "frag %");
+	int code = 0;
+	for (size_t i = 0; i < sizeof(allocators) / sizeof(allocators[0]); ++i)
+	{
+		const Allocator* allocator = &allocators[i];
+		if (allocator_name != NULL && strcmp(allocator_name, allocator->name) != 0)
+			continue;
+		ReplayResult best;
+		for (unsigned long run = 0; run < repeat_count; ++run)
+		{
+			ReplayResult result;
+			if (replay(&trace, allocator, &result) != 0)
+			{
+				fprintf(stderr, "out of memory\n");
+				code = 1;
+				break;
+			}
+			if (run == 0 || result.duration < best.duration)
+				best = result;
+		}
+		if (code != 0)
+			break;
+		const double seconds = best.duration != 0 ? (double)best.duration / 1e9 : 1e-9;
+		printf("%-11s %10.2f %12.0f %8zu %8zu %12zu", allocator->name, seconds * 1e3, (double)trace.count / seconds,
+			best.failed, best.peak_bytes / 1024, best.live_bytes / 1024);
+		if (allocator->ldv)
+			printf(" %12zu %12zu %8.1f\n", best.footprint / 1024, best.stats.largest_free / 1024, best.stats.fragmentation * 100.0);
+		else
+			printf(" %12s %12s %8s\n", "-", "-", "-");
+	}
+	free(trace.ops);
+	return code;
+}